@@ -30,12 +30,33 @@ static time_t timegm_compat(tm* t) { return timegm(t); }
 static void gmtime_compat(const time_t* tt, tm* out) { gmtime_r(tt, out); }
 #endif
 
+// Дни от 1970-01-01 до даты (days_from_civil); выход дня за месяц переносится, как в timegm
+static int64_t days_from_civil(int64_t y, int64_t m, int64_t d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
 static time_t parse_iso_utc(const string& iso) {
     tm t{};
     if (iso.size() < 20 || iso[4] != '-' || iso[7] != '-' || iso[10] != 'T' ||
         iso[13] != ':' || iso[16] != ':' || iso.back() != 'Z')
         return (time_t)-1;
 
+    // Канонический "YYYY-MM-DDTHH:MM:SSZ": считаем арифметикой, без substr/stoi/timegm
+    if (iso.size() == 20) {
+        bool ok = true;
+        auto dg = [&](int i) { int v = iso[i] - '0'; ok = ok && v >= 0 && v <= 9; return (int64_t)v; };
+        int64_t y = dg(0) * 1000 + dg(1) * 100 + dg(2) * 10 + dg(3);
+        int64_t mo = dg(5) * 10 + dg(6), d = dg(8) * 10 + dg(9);
+        int64_t h = dg(11) * 10 + dg(12), mi = dg(14) * 10 + dg(15), se = dg(17) * 10 + dg(18);
+        if (ok && mo >= 1 && mo <= 12)
+            return (time_t)(days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + se);
+    }
+
     t.tm_year = stoi(iso.substr(0, 4)) - 1900;
     t.tm_mon  = stoi(iso.substr(5, 2)) - 1;
     t.tm_mday = stoi(iso.substr(8, 2));
@@ -55,6 +76,24 @@ static string iso_utc_from(time_t tt) {
     return os.str();
 }
 
+// Температура "[-]123.456" без atof (не зависит от локали); иной формат - atof как раньше
+static double parse_temp(const char* p) {
+    static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    const char* s = p;
+    bool neg = (*s == '-');
+    if (*s == '-' || *s == '+') s++;
+    int64_t v = 0;
+    int digits = 0, frac = 0;
+    while (*s >= '0' && *s <= '9' && digits < 15) { v = v * 10 + (*s - '0'); s++; digits++; }
+    if (*s == '.') {
+        s++;
+        while (*s >= '0' && *s <= '9' && digits < 15) { v = v * 10 + (*s - '0'); s++; digits++; frac++; }
+    }
+    if (!digits || (*s >= '0' && *s <= '9') || *s == 'e' || *s == 'E' || *s == 'x' || *s == 'X') return atof(p);
+    double r = (double)v / POW10[frac];
+    return neg ? -r : r;
+}
+
 static time_t floor_hour(time_t tt) { return (tt / 3600) * 3600; }
 static time_t floor_day (time_t tt) { return (tt / 86400) * 86400; }
 
@@ -158,7 +197,7 @@ int main(int argc, char** argv) {
             auto p = line.find(',');
             if (p == string::npos) continue;
             string ts = line.substr(0, p);
-            double v = atof(line.c_str() + p + 1);
+            double v = parse_temp(line.c_str() + p + 1);
             feed_sample(ts, v);
         }
     }
@@ -1,12 +1,17 @@
 #include <atomic>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <csignal>
+#include <cstring>
 #include <ctime>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <random>
@@ -26,8 +31,10 @@
   static void closesock(SOCKET s){ closesocket(s); }
 #else
   #include <arpa/inet.h>
+  #include <netdb.h>
   #include <netinet/in.h>
   #include <sys/select.h>
+  #include <fcntl.h>
   #include <sys/socket.h>
   #include <unistd.h>
   using SOCKET = int;
@@ -92,10 +99,77 @@ static string iso_utc_from_epoch(int64_t epoch){
   return os.str();
 }
 
+// Сглаживание серии на сервере (smooth=sma:60, ema:60, roc:60, min:60, max:60; окно в секундах).
+// Состояние окна обновляется за O(1) амортизированно на точку:
+// sma - скользящая сумма, min/max - монотонная очередь, ema - с учетом реального шага по времени,
+// roc - скорость изменения (ед./с) относительно самой старой точки окна
+struct Smoother {
+  enum Kind { SMA, EMA, ROC, MIN, MAX };
+  Kind kind = SMA;
+  int64_t window = 60;
+  string spec;
+
+  deque<pair<int64_t,double>> win;  // точки окна (sma, roc) или монотонная очередь (min, max)
+  double sum = 0.0;
+  bool have = false;
+  double ema = 0.0;
+  int64_t last_ts = 0;
+
+  static optional<Smoother> parse(const string& s){
+    auto colon = s.find(':');
+    string name = s.substr(0, colon);
+    Smoother sm;
+    if(name=="sma") sm.kind = SMA;
+    else if(name=="ema") sm.kind = EMA;
+    else if(name=="roc") sm.kind = ROC;
+    else if(name=="min") sm.kind = MIN;
+    else if(name=="max") sm.kind = MAX;
+    else return nullopt;
+    if(colon != string::npos){
+      string w = s.substr(colon+1);
+      if(w.empty() || w.size() > 7 || w.find_first_not_of("0123456789") != string::npos) return nullopt;
+      sm.window = stoll(w);
+    }
+    if(sm.window < 1 || sm.window > 7*86400) return nullopt;
+    sm.spec = name + ":" + to_string(sm.window);
+    return sm;
+  }
+
+  // Следующая точка (ts по возрастанию) -> сглаженное значение
+  double push(int64_t ts, double v){
+    switch(kind){
+      case SMA:
+        win.push_back({ts,v}); sum += v;
+        while(win.front().first <= ts - window){ sum -= win.front().second; win.pop_front(); }
+        return sum / (double)win.size();
+      case EMA:
+        if(!have){ ema = v; have = true; }
+        else ema += (1.0 - exp(-(double)(ts - last_ts) / (double)window)) * (v - ema);
+        last_ts = ts;
+        return ema;
+      case ROC:
+        win.push_back({ts,v});
+        while(win.front().first < ts - window) win.pop_front();
+        return (ts > win.front().first) ? (v - win.front().second) / (double)(ts - win.front().first) : 0.0;
+      case MIN:
+      case MAX:
+        while(!win.empty() && (kind==MIN ? win.back().second >= v : win.back().second <= v)) win.pop_back();
+        win.push_back({ts,v});
+        while(win.front().first <= ts - window) win.pop_front();
+        return win.front().second;
+    }
+    return v;
+  }
+};
+
 // Обертка над SQLite: потокобезопасно (mutex), потому что симулятор и HTTP сервер в одном процессе
 struct Db {
   sqlite3* db=nullptr;
   mutex m;
+  int64_t next_seq=1; // номер следующего изменения (для /api/changes), под mutex
+
+  // Одна строка ленты изменений: seq - порядок вставки
+  struct Change { int64_t seq=0; int64_t ts=0; double temp=0.0; };
 
   // Открыть базу и создать таблицу
   bool open(const string& path){
@@ -105,12 +179,13 @@ struct Db {
     }
 
     // WAL лучше для записи/чтения одновременно
-    // measurements(ts PRIMARY KEY, temp REAL)
+    // measurements(ts PRIMARY KEY, temp REAL, seq - порядок вставки для ленты изменений)
     const char* sql =
       "PRAGMA journal_mode=WAL;"
       "CREATE TABLE IF NOT EXISTS measurements("
       " ts INTEGER PRIMARY KEY,"
-      " temp REAL NOT NULL"
+      " temp REAL NOT NULL,"
+      " seq INTEGER"
       ");";
 
     char* err=nullptr;
@@ -119,26 +194,121 @@ struct Db {
       sqlite3_free(err);
       return false;
     }
+
+    // старые базы без seq: добавляем колонку, старым строкам seq=ts (порядок по времени)
+    bool has_seq = false;
+    sqlite3_stmt* st=nullptr;
+    if(sqlite3_prepare_v2(db, "PRAGMA table_info(measurements);", -1, &st, nullptr) == SQLITE_OK){
+      while(sqlite3_step(st) == SQLITE_ROW){
+        const unsigned char* name = sqlite3_column_text(st, 1);
+        if(name && string((const char*)name) == "seq") has_seq = true;
+      }
+      sqlite3_finalize(st);
+    }
+    const char* migrate =
+      "ALTER TABLE measurements ADD COLUMN seq INTEGER;"
+      "UPDATE measurements SET seq=ts WHERE seq IS NULL;";
+    if(!has_seq && sqlite3_exec(db, migrate, nullptr, nullptr, &err) != SQLITE_OK){
+      log_line(string("DB migrate failed: ") + (err?err:"(null)"));
+      sqlite3_free(err);
+      return false;
+    }
+    if(sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS measurements_seq ON measurements(seq);",
+                    nullptr, nullptr, &err) != SQLITE_OK){
+      log_line(string("DB index failed: ") + (err?err:"(null)"));
+      sqlite3_free(err);
+      return false;
+    }
+
+    next_seq = max_seq() + 1;
     return true;
   }
 
+  // Максимальный seq в базе (0 если пусто); реплика продолжает ленту с него
+  int64_t max_seq(){
+    int64_t res = 0;
+    sqlite3_stmt* st=nullptr;
+    if(sqlite3_prepare_v2(db, "SELECT MAX(seq) FROM measurements;", -1, &st, nullptr) != SQLITE_OK) return 0;
+    if(sqlite3_step(st) == SQLITE_ROW) res = sqlite3_column_int64(st, 0);
+    sqlite3_finalize(st);
+    return res;
+  }
+
   void close(){
     lock_guard<mutex> lk(m);
     if(db){ sqlite3_close(db); db=nullptr; }
   }
 
-  // Вставка одного измерения (ts в секундах epoch)
-  // INSERT OR REPLACE, чтобы если ts совпал, строка обновилась
-  bool insert(int64_t ts, double temp){
+  // Пачка измерений одной транзакцией (seq назначаем по порядку в пачке)
+  bool insert_batch(vector<Change>& rows){
+    if(rows.empty()) return true;
     lock_guard<mutex> lk(m);
-    static const char* sql = "INSERT OR REPLACE INTO measurements(ts,temp) VALUES(?,?);";
+    for(size_t i=0;i<rows.size();i++) rows[i].seq = next_seq + (int64_t)i;
+    if(!write_rows(rows)) return false;
+    next_seq += (int64_t)rows.size();
+    return true;
+  }
+
+  // Применить изменения с primary (режим реплики): seq сохраняем как есть
+  bool apply(const vector<Change>& rows){
+    if(rows.empty()) return true;
+    lock_guard<mutex> lk(m);
+    if(!write_rows(rows)) return false;
+    if(rows.back().seq >= next_seq) next_seq = rows.back().seq + 1;
+    return true;
+  }
+
+  // INSERT OR REPLACE всех строк одной транзакцией (вызывать под mutex)
+  bool write_rows(const vector<Change>& rows){
+    static const char* sql = "INSERT OR REPLACE INTO measurements(ts,temp,seq) VALUES(?,?,?);";
+    sqlite3_stmt* st=nullptr;
+    if(sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr) != SQLITE_OK) return false;
+    if(sqlite3_prepare_v2(db, sql, -1, &st, nullptr) != SQLITE_OK){
+      sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+      return false;
+    }
+    bool ok = true;
+    for(const auto& r: rows){
+      sqlite3_bind_int64(st, 1, r.ts);
+      sqlite3_bind_double(st, 2, r.temp);
+      sqlite3_bind_int64(st, 3, r.seq);
+      if(sqlite3_step(st) != SQLITE_DONE){ ok = false; break; }
+      sqlite3_reset(st);
+    }
+    sqlite3_finalize(st);
+    if(!ok || sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK){
+      sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+      return false;
+    }
+    return true;
+  }
+
+  // Лента изменений в порядке вставки: seq > since_seq (или ts >= since_ts, если задан)
+  // Возвращает не больше limit строк; more=true, если есть продолжение,
+  // next - курсор для следующего запроса (since=next)
+  bool changes(int64_t since_seq, optional<int64_t> since_ts, int limit,
+               vector<Change>& out, int64_t& next, bool& more){
+    lock_guard<mutex> lk(m);
+    const char* sql = since_ts
+      ? "SELECT seq,ts,temp FROM measurements WHERE ts>=? ORDER BY seq ASC LIMIT ?;"
+      : "SELECT seq,ts,temp FROM measurements WHERE seq>? ORDER BY seq ASC LIMIT ?;";
     sqlite3_stmt* st=nullptr;
     if(sqlite3_prepare_v2(db, sql, -1, &st, nullptr) != SQLITE_OK) return false;
-    sqlite3_bind_int64(st, 1, ts);
-    sqlite3_bind_double(st, 2, temp);
-    bool ok = (sqlite3_step(st) == SQLITE_DONE);
+    sqlite3_bind_int64(st, 1, since_ts ? *since_ts : since_seq);
+    sqlite3_bind_int(st, 2, limit + 1);
+    while(sqlite3_step(st) == SQLITE_ROW){
+      Change c;
+      c.seq  = sqlite3_column_int64(st, 0);
+      c.ts   = sqlite3_column_int64(st, 1);
+      c.temp = sqlite3_column_double(st, 2);
+      out.push_back(c);
+    }
     sqlite3_finalize(st);
-    return ok;
+    more = (int)out.size() > limit;
+    if(more) out.resize((size_t)limit);
+    if(!out.empty()) next = out.back().seq;
+    else next = since_ts ? max_seq() : since_seq;
+    return true;
   }
 
   // Последнее измерение по времени
@@ -168,7 +338,8 @@ struct Db {
   };
 
   // from/to - epoch seconds, max_points - ограничение точек на графике что бы не было каши
-  optional<Stats> stats(int64_t from, int64_t to, int max_points=300){
+  // smooth - если задан, серия строится по сглаженным значениям полного разрешения
+  optional<Stats> stats(int64_t from, int64_t to, int max_points=300, Smoother* smooth=nullptr){
     if(to <= from) return nullopt;
 
     Stats s; s.from=from; s.to=to;
@@ -199,6 +370,24 @@ struct Db {
     int64_t step = (span / max_points);
     if(step < 1) step = 1;
 
+    // Сглаживание: идем по всем строкам (с разгоном окна до from) и оставляем
+    // те же точки (ts-from) % step == 0, но со сглаженными значениями
+    if(smooth){
+      static const char* sqls =
+        "SELECT ts,temp FROM measurements WHERE ts>=? AND ts<=? ORDER BY ts ASC;";
+      sqlite3_stmt* st=nullptr;
+      if(sqlite3_prepare_v2(db, sqls, -1, &st, nullptr) != SQLITE_OK) return nullopt;
+      sqlite3_bind_int64(st, 1, from - smooth->window);
+      sqlite3_bind_int64(st, 2, to);
+      while(sqlite3_step(st) == SQLITE_ROW){
+        int64_t ts = sqlite3_column_int64(st, 0);
+        double v = smooth->push(ts, sqlite3_column_double(st, 1));
+        if(ts >= from && (ts - from) % step == 0) s.series.push_back({ts,v});
+      }
+      sqlite3_finalize(st);
+      return s;
+    }
+
     // Берем точки, где (ts-from) % step == 0
     static const char* sql2 =
       "SELECT ts,temp FROM measurements "
@@ -221,11 +410,192 @@ struct Db {
 
     return s;
   }
+
+  // Прогресс онлайн-бэкапа (обновляется из потока бэкапа)
+  struct BackupProgress {
+    atomic<int> pages_total{0};
+    atomic<int> pages_done{0};
+    atomic<int64_t> bytes_done{0};
+  };
+
+  // Онлайн-бэкап через sqlite3_backup: копируем по pages_per_step страниц,
+  // mutex держим только на время одного шага, между шагами спим,
+  // чтобы вставки и запросы шли дальше. rate_bytes>0 - ограничение скорости (байт/с).
+  // Пишем в dest.part и переименовываем только после успешного завершения.
+  bool backup_to(const string& dest, int pages_per_step, int64_t rate_bytes,
+                 BackupProgress& prog, string& err){
+    if(pages_per_step < 1) pages_per_step = 1;
+    const string part = dest + ".part";
+    error_code ec;
+    filesystem::remove(part, ec);
+
+    sqlite3* out=nullptr;
+    if(sqlite3_open(part.c_str(), &out) != SQLITE_OK){
+      err = string("open dest failed: ") + (out?sqlite3_errmsg(out):"unknown");
+      sqlite3_close(out);
+      return false;
+    }
+
+    int64_t page_size = 4096;
+    sqlite3_backup* b=nullptr;
+    {
+      lock_guard<mutex> lk(m);
+      sqlite3_stmt* st=nullptr;
+      if(sqlite3_prepare_v2(db, "PRAGMA page_size;", -1, &st, nullptr) == SQLITE_OK){
+        if(sqlite3_step(st) == SQLITE_ROW) page_size = sqlite3_column_int64(st, 0);
+        sqlite3_finalize(st);
+      }
+      b = sqlite3_backup_init(out, "main", db, "main");
+    }
+    if(!b){
+      err = string("backup init failed: ") + sqlite3_errmsg(out);
+      sqlite3_close(out);
+      filesystem::remove(part, ec);
+      return false;
+    }
+
+    auto t0 = chrono::steady_clock::now();
+    int rc = SQLITE_OK;
+    while(true){
+      {
+        lock_guard<mutex> lk(m);
+        rc = sqlite3_backup_step(b, pages_per_step);
+        prog.pages_total = sqlite3_backup_pagecount(b);
+        prog.pages_done  = prog.pages_total - sqlite3_backup_remaining(b);
+      }
+      prog.bytes_done = (int64_t)prog.pages_done * page_size;
+      if(rc == SQLITE_DONE) break;
+      if(rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED) break;
+      if(g_stop){ rc = SQLITE_INTERRUPT; break; }
+
+      // пауза между пачками: минимум 1мс (отдать mutex), плюс троттлинг по скорости
+      auto pause = chrono::milliseconds(1);
+      if(rate_bytes > 0){
+        auto need = chrono::milliseconds(prog.bytes_done * 1000 / rate_bytes);
+        auto spent = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - t0);
+        if(need - spent > pause) pause = need - spent;
+      }
+      this_thread::sleep_for(pause);
+    }
+
+    {
+      lock_guard<mutex> lk(m);
+      sqlite3_backup_finish(b);
+    }
+    if(rc != SQLITE_DONE){
+      err = (rc == SQLITE_INTERRUPT) ? string("interrupted") : string("backup step failed: ") + sqlite3_errstr(rc);
+      sqlite3_close(out);
+      filesystem::remove(part, ec);
+      return false;
+    }
+    sqlite3_close(out);
+
+    filesystem::rename(part, dest, ec);
+    if(ec){
+      err = "rename failed: " + ec.message();
+      filesystem::remove(part, ec);
+      return false;
+    }
+    return true;
+  }
+};
+
+// Экранирование строки для JSON (текст ошибок SQLite/ОС может содержать кавычки и т.п.)
+static string json_escape(const string& s){
+  ostringstream os;
+  for(char c: s){
+    switch(c){
+      case '\\': os<<"\\\\"; break;
+      case '"':  os<<"\\\""; break;
+      case '\n': os<<"\\n"; break;
+      case '\r': os<<"\\r"; break;
+      case '\t': os<<"\\t"; break;
+      default:
+        if((unsigned char)c < 0x20){
+          os<<"\\u"<<hex<<setw(4)<<setfill('0')<<(int)(unsigned char)c<<dec;
+        } else os<<c;
+    }
+  }
+  return os.str();
+}
+
+// Фоновая задача бэкапа для admin-эндпоинта (одна за раз)
+struct BackupJob {
+  mutex m;
+  thread thr;
+  string state = "idle"; // idle|running|done|failed
+  string file;
+  string error;
+  int64_t started_ms = 0, elapsed_ms = 0;
+  Db::BackupProgress prog;
+
+  static int64_t now_ms(){
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Запуск, если сейчас ничего не выполняется
+  bool start(Db& db, const string& dest, int pages_per_step, int64_t rate_bytes){
+    lock_guard<mutex> lk(m);
+    if(state == "running") return false;
+    if(thr.joinable()) thr.join();
+    state = "running"; file = dest; error.clear();
+    started_ms = now_ms(); elapsed_ms = 0;
+    prog.pages_total = 0; prog.pages_done = 0; prog.bytes_done = 0;
+    thr = thread([this, &db, dest, pages_per_step, rate_bytes](){
+      string err;
+      bool ok = db.backup_to(dest, pages_per_step, rate_bytes, prog, err);
+      lock_guard<mutex> lk2(m);
+      state = ok ? "done" : "failed";
+      error = err;
+      elapsed_ms = now_ms() - started_ms;
+      log_line(ok ? ("Backup done: " + dest) : ("WARN: backup failed: " + err));
+    });
+    return true;
+  }
+
+  string status_json(){
+    lock_guard<mutex> lk(m);
+    int64_t el = (state == "running") ? now_ms() - started_ms : elapsed_ms;
+    ostringstream os;
+    os << "{\"state\":\"" << state << "\",\"file\":\"" << json_escape(file) << "\""
+       << ",\"pages_done\":" << prog.pages_done << ",\"pages_total\":" << prog.pages_total
+       << ",\"bytes\":" << prog.bytes_done << ",\"elapsed_ms\":" << el
+       << ",\"error\":" << (error.empty() ? string("null") : "\"" + json_escape(error) + "\"") << "}";
+    return os.str();
+  }
+
+  void join(){
+    if(thr.joinable()) thr.join();
+  }
 };
 
+// Имя файла бэкапа: только [A-Za-z0-9._-], без ведущей точки (никаких путей)
+static bool is_safe_file_name(const string& s){
+  if(s.empty() || s.size() > 128 || s[0]=='.') return false;
+  for(char c: s){
+    if(!(isalnum((unsigned char)c) || c=='.' || c=='_' || c=='-')) return false;
+  }
+  return true;
+}
+
+// Имя по умолчанию: temp-YYYYMMDDTHHMMSSZ.db
+static string default_backup_name(){
+  time_t tt = time(nullptr);
+  tm t{};
+#ifdef _WIN32
+  gmtime_s(&t, &tt);
+#else
+  gmtime_r(&tt, &t);
+#endif
+  ostringstream os;
+  os << put_time(&t, "temp-%Y%m%dT%H%M%SZ.db");
+  return os.str();
+}
+
 // Сборка HTTP ответа строкой (минимальный HTTP/1.1)
 static string http_response(int code, const string& ct, const string& body){
-  const char* msg = (code==200) ? "OK" : (code==404 ? "Not Found" : "Error");
+  const char* msg = (code==200) ? "OK" : (code==404) ? "Not Found" :
+                    (code==403) ? "Forbidden" : (code==405) ? "Method Not Allowed" : "Error";
   ostringstream os;
   os << "HTTP/1.1 " << code << " " << msg << "\r\n";
   os << "Content-Type: " << ct << "\r\n";
@@ -314,6 +684,34 @@ static unordered_map<string,string> parse_query(const string& q){
   return m;
 }
 
+// Значение заголовка запроса (имя без учета регистра); "" - нет такого
+static string header_value(const string& req, const string& name){
+  size_t pos = req.find("\r\n");
+  while(pos != string::npos && pos + 2 < req.size()){
+    size_t b = pos + 2, e = req.find("\r\n", b);
+    if(e == string::npos || e == b) break;
+    size_t colon = req.find(':', b);
+    if(colon < e && colon - b == name.size()){
+      bool same = true;
+      for(size_t i=0;i<name.size() && same;i++) same = tolower((unsigned char)req[b+i]) == tolower((unsigned char)name[i]);
+      if(same){
+        size_t v = req.find_first_not_of(" \t", colon + 1);
+        return v < e ? req.substr(v, req.find_last_not_of(" \t", e - 1) + 1 - v) : string();
+      }
+    }
+    pos = e;
+  }
+  return "";
+}
+
+// Сравнение токенов за время, не зависящее от места первого расхождения
+static bool same_token(const string& a, const string& b){
+  if(a.size() != b.size()) return false;
+  unsigned char d = 0;
+  for(size_t i=0;i<a.size();i++) d |= (unsigned char)(a[i] ^ b[i]);
+  return d == 0;
+}
+
 // Прочитать файл (для статики web/)
 static string read_file_bin(const filesystem::path& p){
   ifstream f(p, ios::binary);
@@ -334,6 +732,458 @@ static string content_type_for(const string& path){
   return "application/octet-stream";
 }
 
+// JSON ленты изменений: {"next":N,"more":bool,"changes":[[seq,ts,temp],...]}
+static string changes_json(const vector<Db::Change>& rows, int64_t next, bool more){
+  ostringstream os;
+  os << setprecision(numeric_limits<double>::max_digits10);   // strtod на реплике вернет то же double
+  os << "{\"next\":" << next << ",\"more\":" << (more ? "true" : "false") << ",\"changes\":[";
+  for(size_t i=0;i<rows.size();i++){
+    if(i) os << ",";
+    os << "[" << rows[i].seq << "," << rows[i].ts << "," << rows[i].temp << "]";
+  }
+  os << "]}";
+  return os.str();
+}
+
+// Разбор ответа /api/changes (формат changes_json, других мы не принимаем)
+static bool parse_changes_json(const string& body, vector<Db::Change>& rows, int64_t& next, bool& more){
+  auto pn = body.find("\"next\":");
+  auto pm = body.find("\"more\":");
+  auto pc = body.find("\"changes\":[");
+  if(pn==string::npos || pm==string::npos || pc==string::npos) return false;
+  next = strtoll(body.c_str() + pn + 7, nullptr, 10);
+  more = body.compare(pm + 7, 4, "true") == 0;
+
+  const char* p = body.c_str() + pc + 11;
+  while(*p){
+    while(*p==',' || *p==' ') p++;
+    if(*p==']') return true;
+    if(*p!='[') return false;
+    char* e=nullptr;
+    Db::Change c;
+    c.seq = strtoll(p+1, &e, 10);  if(*e!=',') return false;
+    c.ts  = strtoll(e+1, &e, 10);  if(*e!=',') return false;
+    c.temp = strtod(e+1, &e);      if(*e!=']') return false;
+    rows.push_back(c);
+    p = e + 1;
+  }
+  return false;
+}
+
+// "http://host:port" -> host, port (путь игнорируем)
+static bool parse_http_url(const string& url, string& host, int& port){
+  string rest = url;
+  if(rest.compare(0, 7, "http://") == 0) rest = rest.substr(7);
+  rest = rest.substr(0, rest.find('/'));
+  auto colon = rest.rfind(':');
+  port = 80;
+  if(colon != string::npos){
+    port = atoi(rest.c_str() + colon + 1);
+    rest = rest.substr(0, colon);
+  }
+  host = rest;
+  return !host.empty() && port > 0 && port < 65536;
+}
+
+// Минимальный HTTP GET клиент (Connection: close, читаем до закрытия); тело при 200
+static optional<string> http_get(const string& host, int port, const string& target){
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res=nullptr;
+  if(getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &res) != 0 || !res) return nullopt;
+
+  SOCKET c = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if(c == (SOCKET)INVALID_SOCKET){ freeaddrinfo(res); return nullopt; }
+
+  // таймаут чтения, чтобы зависший primary не подвешивал реплику
+#ifdef _WIN32
+  DWORD tmo = 5000;
+  setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tmo, sizeof(tmo));
+#else
+  timeval tmo{}; tmo.tv_sec = 5;
+  setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+#endif
+
+  bool ok = ::connect(c, res->ai_addr, (int)res->ai_addrlen) != SOCKET_ERROR;
+  freeaddrinfo(res);
+  if(!ok){ closesock(c); return nullopt; }
+
+  string req = "GET " + target + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+  if(!send_all(c, req)){ closesock(c); return nullopt; }
+
+  string buf;
+  char tmp[16384];
+  while(true){
+#ifdef _WIN32
+    int n = ::recv(c, tmp, (int)sizeof(tmp), 0);
+#else
+    ssize_t n = ::recv(c, tmp, sizeof(tmp), 0);
+#endif
+    if(n <= 0) break;
+    buf.append(tmp, tmp+n);
+  }
+  closesock(c);
+
+  auto hdr_end = buf.find("\r\n\r\n");
+  if(hdr_end == string::npos || buf.compare(0, 12, "HTTP/1.1 200") != 0) return nullopt;
+  return buf.substr(hdr_end + 4);
+}
+
+// Ограниченная lock-free очередь (Vyukov bounded MPMC): у каждой ячейки свой номер,
+// производители и потребитель двигают head/tail через CAS, без mutex.
+// Емкость округляется вверх до степени двойки.
+template<class T>
+class BoundedQueue {
+  struct Cell { atomic<size_t> seq; T data; };
+  unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) atomic<size_t> head{0}; // позиция записи
+  alignas(64) atomic<size_t> tail{0}; // позиция чтения
+
+public:
+  explicit BoundedQueue(size_t capacity){
+    size_t cap = 2;
+    while(cap < capacity) cap <<= 1;
+    cells.reset(new Cell[cap]);
+    mask = cap - 1;
+    for(size_t i=0;i<cap;i++) cells[i].seq.store(i, memory_order_relaxed);
+  }
+
+  size_t capacity() const { return mask + 1; }
+
+  size_t size() const {
+    size_t h = head.load(memory_order_relaxed), t = tail.load(memory_order_relaxed);
+    return h >= t ? h - t : 0;
+  }
+
+  bool try_push(const T& v){
+    size_t pos = head.load(memory_order_relaxed);
+    while(true){
+      Cell& c = cells[pos & mask];
+      size_t seq = c.seq.load(memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if(dif == 0){
+        if(head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)){
+          c.data = v;
+          c.seq.store(pos + 1, memory_order_release);
+          return true;
+        }
+      } else if(dif < 0){
+        return false; // полна
+      } else {
+        pos = head.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  bool try_pop(T& out){
+    size_t pos = tail.load(memory_order_relaxed);
+    while(true){
+      Cell& c = cells[pos & mask];
+      size_t seq = c.seq.load(memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if(dif == 0){
+        if(tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)){
+          out = c.data;
+          c.seq.store(pos + mask + 1, memory_order_release);
+          return true;
+        }
+      } else if(dif < 0){
+        return false; // пуста
+      } else {
+        pos = tail.load(memory_order_relaxed);
+      }
+    }
+  }
+};
+
+// Очередь записи: производители (симулятор, UDP) кладут измерения,
+// один поток-писатель забирает их пачками и пишет в SQLite одной транзакцией.
+// Если писатель отстал (checkpoint, fsync) и очередь полна - действует policy:
+//   block       - производитель ждет места;
+//   drop-oldest - выкидываем самое старое измерение из очереди;
+//   drop        - выкидываем новое, только считаем потери.
+// Пустая очередь - писатель спит на not_empty, полная при block - производитель на not_full.
+// Будим только спящих (флаг/счетчик + seq_cst fence с обеих сторон): быстрый путь без mutex.
+struct WriteQueue {
+  enum Policy { Block, DropOldest, Drop };
+
+  BoundedQueue<Db::Change> q;
+  Policy policy;
+  atomic<bool> stop{false}; // писатель дописывает остаток и выходит (ставить через finish())
+
+  mutex wait_mu; // только для сна, сама очередь без mutex
+  condition_variable not_empty, not_full;
+  atomic<bool> writer_idle{false};
+  atomic<int> producers_blocked{0};
+
+  atomic<uint64_t> enqueued{0}, dropped{0}, written{0}, write_fail{0}, batches{0};
+  atomic<uint64_t> max_depth{0}, block_waits{0};
+  atomic<uint64_t> push_max_us{0}, last_batch_us{0}, max_batch_us{0};
+
+  WriteQueue(size_t capacity, Policy p): q(capacity), policy(p) {}
+
+  static optional<Policy> parse_policy(const string& s){
+    if(s=="block") return Block;
+    if(s=="drop-oldest") return DropOldest;
+    if(s=="drop") return Drop;
+    return nullopt;
+  }
+
+  static void update_max(atomic<uint64_t>& a, uint64_t v){
+    uint64_t cur = a.load(memory_order_relaxed);
+    while(v > cur && !a.compare_exchange_weak(cur, v, memory_order_relaxed)) {}
+  }
+
+  // Положить измерение (вызывается из потоков-производителей)
+  bool push(const Db::Change& c){
+    auto t0 = chrono::steady_clock::now();
+    bool ok = q.try_push(c);
+    if(!ok){
+      if(policy == Drop){
+        dropped++;
+      } else if(policy == DropOldest){
+        Db::Change old;
+        while(!(ok = q.try_push(c))){
+          if(q.try_pop(old)) dropped++;
+        }
+      } else {
+        block_waits++;
+        unique_lock<mutex> lk(wait_mu);
+        producers_blocked++;
+        atomic_thread_fence(memory_order_seq_cst);
+        not_full.wait(lk, [&]{ return (ok = q.try_push(c)) || g_stop; });
+        producers_blocked--;
+        if(!ok) dropped++;
+      }
+    }
+    if(ok){
+      enqueued++;
+      update_max(max_depth, q.size());
+      atomic_thread_fence(memory_order_seq_cst);
+      if(writer_idle.load(memory_order_relaxed)){
+        lock_guard<mutex> lk(wait_mu);
+        not_empty.notify_one();
+      }
+    }
+    update_max(push_max_us, (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count());
+    return ok;
+  }
+
+  // Поток-писатель: забираем до max_batch измерений и пишем одной транзакцией
+  void writer_loop(Db& db, size_t max_batch){
+    vector<Db::Change> batch;
+    batch.reserve(max_batch);
+    while(true){
+      Db::Change c;
+      while(batch.size() < max_batch && q.try_pop(c)) batch.push_back(c);
+      if(batch.empty()){
+        if(stop) break;
+        unique_lock<mutex> lk(wait_mu);
+        writer_idle = true;
+        atomic_thread_fence(memory_order_seq_cst);
+        not_empty.wait(lk, [&]{ return q.size() > 0 || stop; });
+        writer_idle = false;
+        continue;
+      }
+      // место освободилось - будим ждущих производителей, пока пишем пачку
+      atomic_thread_fence(memory_order_seq_cst);
+      if(producers_blocked.load(memory_order_relaxed)){
+        lock_guard<mutex> lk(wait_mu);
+        not_full.notify_all();
+      }
+      auto t0 = chrono::steady_clock::now();
+      if(db.insert_batch(batch)) written += batch.size();
+      else { write_fail += batch.size(); log_line("WARN: DB batch insert failed"); }
+      uint64_t us = (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count();
+      batches++;
+      last_batch_us = us;
+      update_max(max_batch_us, us);
+      batch.clear();
+    }
+  }
+
+  // Разбудить всех спящих: после g_stop (производители) и stop (писатель)
+  void wake_all(){
+    lock_guard<mutex> lk(wait_mu);
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+
+  // Писатель дописывает остаток и выходит
+  void finish(){
+    stop = true;
+    wake_all();
+  }
+
+  string json() const {
+    static const char* names[] = {"block", "drop-oldest", "drop"};
+    ostringstream os;
+    os << "{\"policy\":\"" << names[policy] << "\",\"capacity\":" << q.capacity()
+       << ",\"depth\":" << q.size() << ",\"max_depth\":" << max_depth
+       << ",\"enqueued\":" << enqueued << ",\"dropped\":" << dropped
+       << ",\"written\":" << written << ",\"write_fail\":" << write_fail
+       << ",\"batches\":" << batches << ",\"block_waits\":" << block_waits
+       << ",\"push_max_us\":" << push_max_us << ",\"last_batch_us\":" << last_batch_us
+       << ",\"max_batch_us\":" << max_batch_us << "}";
+    return os.str();
+  }
+};
+
+// Счетчики UDP-приема (отдаются в /api/metrics)
+struct UdpStats {
+  atomic<uint64_t> datagrams{0};     // принято датаграмм
+  atomic<uint64_t> samples{0};       // измерений передано в очередь записи
+  atomic<uint64_t> bad{0};           // датаграммы/строки, которые не разобрались
+  atomic<uint64_t> truncated{0};     // датаграммы больше буфера (MSG_TRUNC)
+  atomic<uint64_t> kernel_drops{0};  // потери в буфере сокета (SO_RXQ_OVFL, только Linux)
+
+  string json() const {
+    ostringstream os;
+    os << "{\"datagrams\":" << datagrams << ",\"samples\":" << samples << ",\"bad\":" << bad
+       << ",\"truncated\":" << truncated << ",\"kernel_drops\":" << kernel_drops << "}";
+    return os.str();
+  }
+};
+
+// Общая проверка измерения из UDP (текст и бинарь): время после 1970, конечная температура
+static bool valid_udp_sample(const Db::Change& c){
+  return c.ts > 0 && isfinite(c.temp);
+}
+
+// Одна строка UDP: "ISOZ,temp" или "epoch,temp"
+static bool parse_udp_line(const char* p, size_t n, Db::Change& out){
+  const char* comma = (const char*)memchr(p, ',', n);
+  if(!comma || comma == p) return false;
+  string ts(p, comma);
+  string v(comma + 1, p + n);
+  if(is_isoz(ts)){
+    optional<int64_t> e;
+    try { e = parse_iso_utc_to_epoch(ts); } catch(...) { return false; }
+    if(!e) return false;
+    out.ts = *e;
+  } else {
+    char* end=nullptr;
+    out.ts = strtoll(ts.c_str(), &end, 10);
+    if(*end) return false;
+  }
+  char* end=nullptr;
+  out.temp = strtod(v.c_str(), &end);
+  if(end == v.c_str()) return false;
+  return valid_udp_sample(out);
+}
+
+static int64_t get_le(const unsigned char* p, int bytes){
+  uint64_t v = 0;
+  for(int i=bytes-1;i>=0;i--) v = (v << 8) | p[i];
+  if(bytes < 8 && (v >> (bytes*8 - 1))) v |= ~0ULL << (bytes*8); // знак
+  return (int64_t)v;
+}
+
+// Датаграмма -> измерения.
+// Текст: одна или несколько строк "ts,temp\n".
+// Бинарь: 'T','B',1,n, затем n записей {int64 LE epoch, int32 LE temp*1000} (4+12n байт)
+static bool parse_datagram(const unsigned char* p, size_t n, vector<Db::Change>& out, UdpStats& st){
+  if(n >= 4 && p[0]=='T' && p[1]=='B' && p[2]==1){
+    size_t cnt = p[3];
+    if(n != 4 + 12*cnt){ st.bad++; return false; }
+    bool any = false;
+    for(size_t i=0;i<cnt;i++){
+      const unsigned char* r = p + 4 + 12*i;
+      Db::Change c;
+      c.ts = get_le(r, 8);
+      c.temp = (double)get_le(r + 8, 4) / 1000.0;
+      if(valid_udp_sample(c)){ out.push_back(c); any = true; }
+      else st.bad++;
+    }
+    return any;
+  }
+
+  const char* s = (const char*)p;
+  size_t i = 0;
+  bool any = false;
+  while(i < n){
+    size_t e = i;
+    while(e < n && s[e] != '\n') e++;
+    size_t len = e - i;
+    if(len && s[i + len - 1] == '\r') len--;
+    if(len){
+      Db::Change c;
+      if(parse_udp_line(s + i, len, c)){ out.push_back(c); any = true; }
+      else st.bad++;
+    }
+    i = e + 1;
+  }
+  return any;
+}
+
+// Поток UDP-приема: пачками вычитываем датаграммы (recvmmsg на Linux)
+// и передаем измерения в очередь записи (в БД их пишет поток-писатель пачками)
+static void udp_ingest_loop(SOCKET u, WriteQueue& wq, UdpStats& st){
+  const size_t MAXDG = 64;      // датаграмм за один recvmmsg
+  const size_t DGSZ = 2048;     // буфер одной датаграммы
+  const size_t MAXBATCH = 4096; // измерений за один проход
+  vector<unsigned char> bufs(MAXDG * DGSZ);
+  vector<Db::Change> batch;
+  batch.reserve(MAXBATCH);
+
+#ifdef __linux__
+  vector<mmsghdr> msgs(MAXDG);
+  vector<iovec> iovs(MAXDG);
+  vector<char> ctl(MAXDG * CMSG_SPACE(sizeof(uint32_t)));
+#endif
+
+  while(!g_stop){
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(u, &rfds);
+    timeval tv{};
+    tv.tv_usec = 200*1000;
+    if(select((int)(u+1), &rfds, nullptr, nullptr, &tv) <= 0) continue;
+
+    // вычитываем все, что накопилось (но не больше MAXBATCH за раз в очередь записи)
+    while(batch.size() < MAXBATCH){
+#ifdef __linux__
+      for(size_t i=0;i<MAXDG;i++){
+        iovs[i].iov_base = &bufs[i*DGSZ];
+        iovs[i].iov_len = DGSZ;
+        msgs[i].msg_hdr = msghdr{};
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = &ctl[i*CMSG_SPACE(sizeof(uint32_t))];
+        msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+      }
+      int n = recvmmsg(u, msgs.data(), (unsigned)MAXDG, MSG_DONTWAIT, nullptr);
+      if(n <= 0) break;
+      for(int i=0;i<n;i++){
+        st.datagrams++;
+        if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC){ st.truncated++; continue; }
+        for(cmsghdr* cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)){
+          if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL){
+            uint32_t drops = 0;
+            memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+            if(drops > st.kernel_drops) st.kernel_drops = drops; // счетчик ядра накопительный
+          }
+        }
+        parse_datagram(&bufs[i*DGSZ], msgs[i].msg_len, batch, st);
+      }
+      if((size_t)n < MAXDG) break;
+#else
+      int n = ::recv(u, (char*)bufs.data(), (int)DGSZ, 0);
+      if(n <= 0) break;
+      st.datagrams++;
+      parse_datagram(bufs.data(), (size_t)n, batch, st);
+#endif
+    }
+
+    for(const auto& c: batch){
+      if(wq.push(c)) st.samples++;
+    }
+    batch.clear();
+  }
+}
+
 int main(int argc, char** argv){
   setvbuf(stderr, nullptr, _IONBF, 0);
 
@@ -348,6 +1198,17 @@ int main(int argc, char** argv){
   string bind_ip="127.0.0.1";
   int port=8080;
   string web_dir="./web";
+  string backup_file;            // --backup FILE: сделать бэкап и выйти
+  string backup_dir="./backups"; // куда пишет /api/admin/backup
+  int backup_pages=64;           // страниц за один шаг sqlite3_backup_step
+  int64_t backup_rate_kb=0;      // ограничение скорости бэкапа, КБ/с (0 - без ограничения)
+  string replica_of;             // --replica-of URL: читать ленту изменений primary
+  int replica_poll_ms=500;       // пауза между опросами primary, когда новых строк нет
+  int udp_port=0;                // --udp-port N: прием измерений по UDP (0 - выключен)
+  size_t queue_size=65536;       // емкость очереди записи
+  string queue_policy="block";   // block|drop-oldest|drop при переполнении очереди
+  size_t write_batch=1024;       // измерений в одной транзакции писателя
+  string admin_token;            // --admin-token T: /api/admin/* не с loopback - с X-Admin-Token: T
 
   auto fatal = [&](const string& msg)->int{
     log_line("FATAL: " + msg);
@@ -368,13 +1229,37 @@ int main(int argc, char** argv){
       else if(a=="--bind") bind_ip = need("--bind");
       else if(a=="--port") port = stoi(need("--port"));
       else if(a=="--web-dir") web_dir = need("--web-dir");
+      else if(a=="--backup") backup_file = need("--backup");
+      else if(a=="--backup-dir") backup_dir = need("--backup-dir");
+      else if(a=="--backup-pages") backup_pages = stoi(need("--backup-pages"));
+      else if(a=="--backup-rate-kb") backup_rate_kb = stoll(need("--backup-rate-kb"));
+      else if(a=="--replica-of") replica_of = need("--replica-of");
+      else if(a=="--replica-poll-ms") replica_poll_ms = stoi(need("--replica-poll-ms"));
+      else if(a=="--udp-port") udp_port = stoi(need("--udp-port"));
+      else if(a=="--queue-size") queue_size = (size_t)stoull(need("--queue-size"));
+      else if(a=="--queue-policy") queue_policy = need("--queue-policy");
+      else if(a=="--write-batch") write_batch = (size_t)stoull(need("--write-batch"));
+      else if(a=="--admin-token") admin_token = need("--admin-token");
       else if(a=="--help"){
         cout <<
           "Usage:\n"
           "  temp_logger --db temp.db --serve --bind 127.0.0.1 --port 8080 --simulate --web-dir ./web\n"
+          "  temp_logger --db temp.db --backup backup.db [--backup-pages 64] [--backup-rate-kb 0]\n"
+          "Options:\n"
+          "  --backup-dir DIR      directory for /api/admin/backup (default ./backups)\n"
+          "  --replica-of URL      read-only replica of http://host:port (tails /api/changes)\n"
+          "  --replica-poll-ms N   poll interval when replica is up to date (default 500)\n"
+          "  --udp-port N          accept samples over UDP on --bind ip (\"ts,temp\" lines or binary TB1)\n"
+          "  --queue-size N        write queue capacity (default 65536)\n"
+          "  --queue-policy P      when the queue is full: block|drop-oldest|drop (default block)\n"
+          "  --write-batch N       max samples per DB transaction (default 1024)\n"
+          "  --admin-token T       allow /api/admin/* from non-loopback clients with header X-Admin-Token: T\n"
           "Endpoints:\n"
           "  /api/current\n"
-          "  /api/stats?from=ISOZ&to=ISOZ\n";
+          "  /api/stats?from=ISOZ&to=ISOZ[&smooth=sma|ema|roc|min|max:SECONDS]\n"
+          "  /api/changes?since=SEQ|ISOZ[&limit=N]\n"
+          "  /api/metrics\n"
+          "  /api/admin/backup     GET - status, POST [?name=FILE] - start (loopback or --admin-token)\n";
         return 0;
       } else {
         throw runtime_error(string("unknown arg: ")+a);
@@ -384,6 +1269,19 @@ int main(int argc, char** argv){
     return fatal(e.what());
   }
 
+  auto policy = WriteQueue::parse_policy(queue_policy);
+  if(!policy) return fatal("bad --queue-policy: " + queue_policy);
+  if(queue_size < 2 || queue_size > (1u<<26)) return fatal("bad --queue-size");
+  if(write_batch < 1) write_batch = 1;
+
+  string primary_host;
+  int primary_port=0;
+  if(!replica_of.empty()){
+    if(!parse_http_url(replica_of, primary_host, primary_port)) return fatal("bad --replica-of url: " + replica_of);
+    if(simulate) return fatal("--replica-of is read-only, --simulate not allowed");
+    if(udp_port) return fatal("--replica-of is read-only, --udp-port not allowed");
+  }
+
 #ifdef _WIN32
   // Windows: инициализация Winsock обязательна перед socket()
   WSADATA wsa{};
@@ -402,13 +1300,44 @@ int main(int argc, char** argv){
     return fatal("DB open/init failed");
   }
 
+  // CLI: онлайн-бэкап в файл и выход (сервис при этом можно не останавливать)
+  if(!backup_file.empty()){
+    Db::BackupProgress prog;
+    string err;
+    log_line("Backup: " + db_path + " -> " + backup_file);
+    bool ok = db.backup_to(backup_file, backup_pages, backup_rate_kb*1024, prog, err);
+    if(ok) log_line("Backup done: " + to_string(prog.bytes_done) + " bytes");
+    db.close();
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return ok ? 0 : fatal("backup failed: " + err);
+  }
+
   // статика web/ не критична, но предупредим
   if(!filesystem::exists(web_dir)){
     log_line("WARN: web dir not found: " + web_dir + " (static UI will 404)");
   }
 
-  // поток симуляции: каждые 250мс в temp в SQLite
-  thread sim_thr;
+  // производители (симулятор, UDP) -> очередь записи -> один поток-писатель;
+  // реплика пишет в БД сама (у нее seq с primary)
+  WriteQueue wq(queue_size, *policy);
+  thread writer_thr, sim_thr, repl_thr, udp_thr;
+
+  // остановка: сначала производители, потом писатель дописывает остаток очереди
+  auto stop_threads = [&](){
+    g_stop = true;
+    wq.wake_all();
+    if(sim_thr.joinable()) sim_thr.join();
+    if(repl_thr.joinable()) repl_thr.join();
+    if(udp_thr.joinable()) udp_thr.join();
+    wq.finish();
+    if(writer_thr.joinable()) writer_thr.join();
+  };
+
+  writer_thr = thread([&](){ wq.writer_loop(db, write_batch); });
+
+  // поток симуляции: каждые 250мс temp в очередь записи
   if(simulate){
     sim_thr = thread([&](){
       mt19937_64 rng{1234567};
@@ -417,17 +1346,91 @@ int main(int argc, char** argv){
       while(!g_stop){
         int64_t ts = (int64_t)time(nullptr); // epoch seconds
         double temp = round((base(rng)+noise(rng))*1000.0)/1000.0;
-        if(!db.insert(ts, temp)) log_line("WARN: DB insert failed");
+        Db::Change c;
+        c.ts = ts;
+        c.temp = temp;
+        wq.push(c);
         this_thread::sleep_for(chrono::milliseconds(250));
       }
     });
   }
 
+  // поток реплики: тянем /api/changes с primary и применяем пачками,
+  // курсор = max(seq) в локальной базе, поэтому после рестарта продолжаем с того же места
+  if(!replica_of.empty()){
+    repl_thr = thread([&](){
+      int64_t cursor;
+      { lock_guard<mutex> lk(db.m); cursor = db.max_seq(); }
+      bool was_down = false;
+      while(!g_stop){
+        auto body = http_get(primary_host, primary_port, "/api/changes?since=" + to_string(cursor) + "&limit=5000");
+        vector<Db::Change> rows;
+        int64_t next = cursor;
+        bool more = false;
+        if(!body || !parse_changes_json(*body, rows, next, more)){
+          if(!was_down) log_line("WARN: replica: primary " + replica_of + " unavailable");
+          was_down = true;
+          for(int i=0;i<10 && !g_stop;i++) this_thread::sleep_for(chrono::milliseconds(100));
+          continue;
+        }
+        if(was_down) log_line("Replica: primary is back");
+        was_down = false;
+        if(!db.apply(rows)){
+          log_line("WARN: replica: apply failed");
+          this_thread::sleep_for(chrono::seconds(1));
+          continue;
+        }
+        cursor = next;
+        if(!more){
+          for(int ms=0; ms<replica_poll_ms && !g_stop; ms+=50) this_thread::sleep_for(chrono::milliseconds(50));
+        }
+      }
+    });
+  }
+
+  // UDP-прием: неблокирующий сокет, большой буфер приема, счетчик потерь ядра
+  UdpStats udp_stats;
+  if(udp_port){
+    SOCKET u = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in ua{};
+    ua.sin_family = AF_INET;
+    ua.sin_port = htons((uint16_t)udp_port);
+    int rcvbuf = 4*1024*1024;
+    bool ok = u != (SOCKET)INVALID_SOCKET && inet_pton(AF_INET, bind_ip.c_str(), &ua.sin_addr) == 1;
+    if(ok){
+      setsockopt(u, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf));
+#ifdef __linux__
+      int one_ovfl = 1;
+      setsockopt(u, SOL_SOCKET, SO_RXQ_OVFL, &one_ovfl, sizeof(one_ovfl));
+#endif
+#ifdef _WIN32
+      u_long nb = 1;
+      ioctlsocket(u, FIONBIO, &nb);
+#else
+      fcntl(u, F_SETFL, fcntl(u, F_GETFL, 0) | O_NONBLOCK);
+#endif
+      ok = ::bind(u, (sockaddr*)&ua, sizeof(ua)) != SOCKET_ERROR;
+    }
+    if(!ok){
+      if(u != (SOCKET)INVALID_SOCKET) closesock(u);
+      stop_threads();
+      db.close();
+#ifdef _WIN32
+      WSACleanup();
+#endif
+      return fatal("UDP bind failed on " + bind_ip + ":" + to_string(udp_port));
+    }
+    log_line("UDP ingest: " + bind_ip + ":" + to_string(udp_port));
+    udp_thr = thread([&, u](){
+      udp_ingest_loop(u, wq, udp_stats);
+      closesock(u);
+    });
+  }
+
   // если не попросили --serve, то делать нечего
   if(!serve){
     log_line("Nothing to do: use --serve (and optionally --simulate). Try --help");
-    g_stop = true;
-    if(sim_thr.joinable()) sim_thr.join();
+    stop_threads();
     db.close();
 #ifdef _WIN32
     WSACleanup();
@@ -438,8 +1441,7 @@ int main(int argc, char** argv){
   // создать TCP сокет
   SOCKET s = ::socket(AF_INET, SOCK_STREAM, 0);
   if(s == (SOCKET)INVALID_SOCKET){
-    g_stop = true;
-    if(sim_thr.joinable()) sim_thr.join();
+    stop_threads();
     db.close();
 #ifdef _WIN32
     WSACleanup();
@@ -463,11 +1465,15 @@ int main(int argc, char** argv){
 #ifdef _WIN32
   if(inet_pton(AF_INET, bind_ip.c_str(), &addr.sin_addr) != 1){
     closesock(s);
+    stop_threads();
+    db.close();
     return fatal("bad --bind ip");
   }
 #else
   if(inet_aton(bind_ip.c_str(), &addr.sin_addr) == 0){
     closesock(s);
+    stop_threads();
+    db.close();
     return fatal("bad --bind ip");
   }
 #endif
@@ -475,8 +1481,7 @@ int main(int argc, char** argv){
   if(::bind(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR){
     string msg = "bind() failed on " + bind_ip + ":" + to_string(port) + " (порт занят?)";
     closesock(s);
-    g_stop = true;
-    if(sim_thr.joinable()) sim_thr.join();
+    stop_threads();
     db.close();
 #ifdef _WIN32
     WSACleanup();
@@ -486,8 +1491,7 @@ int main(int argc, char** argv){
 
   if(::listen(s, 64) == SOCKET_ERROR){
     closesock(s);
-    g_stop = true;
-    if(sim_thr.joinable()) sim_thr.join();
+    stop_threads();
     db.close();
 #ifdef _WIN32
     WSACleanup();
@@ -497,8 +1501,11 @@ int main(int argc, char** argv){
 
   log_line("OK: listening on http://" + bind_ip + ":" + to_string(port));
   log_line("DB: " + db_path);
+  if(!replica_of.empty()) log_line("Replica of: " + replica_of + " (read-only)");
   log_line("Web dir: " + web_dir);
 
+  BackupJob backup_job;
+
   // основной цикл: принятие соединения, чиитаем request, роутим по path
   while(!g_stop){
     fd_set rfds;
@@ -537,8 +1544,9 @@ int main(int argc, char** argv){
       query = target.substr(qpos+1);
     }
 
-    // поддерживаем только GET
-    if(method != "GET"){
+    // поддерживаем только GET (и POST для /api/admin/*)
+    bool admin = path.compare(0, 11, "/api/admin/") == 0;
+    if(method != "GET" && !(admin && method == "POST")){
       send_all(c, http_response(404, "text/plain; charset=utf-8", "Not Found"));
       closesock(c);
       continue;
@@ -576,7 +1584,17 @@ int main(int argc, char** argv){
         continue;
       }
 
-      auto st = db.stats(*fromE, *toE);
+      optional<Smoother> smooth;
+      if(m.count("smooth") && !m["smooth"].empty()){
+        smooth = Smoother::parse(m["smooth"]);
+        if(!smooth){
+          send_all(c, http_response(404, "text/plain; charset=utf-8", "bad smooth (sma|ema|roc|min|max[:seconds])"));
+          closesock(c);
+          continue;
+        }
+      }
+
+      auto st = db.stats(*fromE, *toE, 300, smooth ? &*smooth : nullptr);
       if(!st){
         send_all(c, http_response(404, "text/plain; charset=utf-8", "bad range"));
         closesock(c);
@@ -593,6 +1611,7 @@ int main(int argc, char** argv){
       body << "\"avg\":" << (isnan(st->avg)? string("null") : to_string(st->avg)) << ",";
       body << "\"min\":" << (isnan(st->mn)?  string("null") : to_string(st->mn))  << ",";
       body << "\"max\":" << (isnan(st->mx)?  string("null") : to_string(st->mx))  << ",";
+      if(smooth) body << "\"smooth\":\"" << smooth->spec << "\",";
       body << "\"series\":[";
       for(size_t i=0;i<st->series.size();i++){
         if(i) body << ",";
@@ -605,6 +1624,94 @@ int main(int argc, char** argv){
       continue;
     }
 
+    // API: лента изменений для реплик (в порядке вставки, включая замененные строки)
+    if(path == "/api/changes"){
+      auto m = parse_query(query);
+      int64_t since_seq = 0;
+      optional<int64_t> since_ts;
+      bool bad_since = false;
+      if(m.count("since") && !m["since"].empty()){
+        // since: ISOZ - с момента времени, число - после seq
+        const string& v = m["since"];
+        if(is_isoz(v)){
+          since_ts = parse_iso_utc_to_epoch(v);
+          bad_since = !since_ts;
+        } else if(v.size() <= 18 && v.find_first_not_of("0123456789") == string::npos){
+          since_seq = stoll(v);
+        } else {
+          bad_since = true;
+        }
+      }
+      if(bad_since){
+        send_all(c, http_response(404, "text/plain; charset=utf-8", "bad since"));
+        closesock(c);
+        continue;
+      }
+      int limit = m.count("limit") ? atoi(m["limit"].c_str()) : 1000;
+      if(limit < 1) limit = 1;
+      if(limit > 10000) limit = 10000;
+
+      vector<Db::Change> rows;
+      int64_t next = 0;
+      bool more = false;
+      if(!db.changes(since_seq, since_ts, limit, rows, next, more)){
+        send_all(c, http_response(500, "text/plain; charset=utf-8", "db error"));
+        closesock(c);
+        continue;
+      }
+      send_all(c, http_response(200, "application/json; charset=utf-8", changes_json(rows, next, more)));
+      closesock(c);
+      continue;
+    }
+
+    // API: метрики приема
+    if(path == "/api/metrics"){
+      string body = "{\"queue\":" + wq.json() + ",\"udp\":" + udp_stats.json() + "}";
+      send_all(c, http_response(200, "application/json; charset=utf-8", body));
+      closesock(c);
+      continue;
+    }
+
+    // API admin: только с loopback или с верным X-Admin-Token (если задан --admin-token)
+    if(admin){
+      bool loopback = (ntohl(caddr.sin_addr.s_addr) >> 24) == 127;
+      if(!loopback && (admin_token.empty() || !same_token(header_value(req, "X-Admin-Token"), admin_token))){
+        send_all(c, http_response(403, "text/plain; charset=utf-8", "Forbidden"));
+        closesock(c);
+        continue;
+      }
+    }
+
+    // API: admin backup (GET - статус; POST - запустить в фоне)
+    if(path == "/api/admin/backup"){
+      auto m = parse_query(query);
+      if(method == "GET" && m.count("start")){
+        send_all(c, http_response(405, "text/plain; charset=utf-8", "use POST to start a backup"));
+        closesock(c);
+        continue;
+      }
+      if(method == "POST"){
+        string name = m.count("name") ? m["name"] : default_backup_name();
+        if(!is_safe_file_name(name)){
+          send_all(c, http_response(404, "text/plain; charset=utf-8", "bad name"));
+          closesock(c);
+          continue;
+        }
+        error_code ec;
+        filesystem::create_directories(backup_dir, ec);
+        string dest = (filesystem::path(backup_dir) / name).string();
+        if(backup_job.start(db, dest, backup_pages, backup_rate_kb*1024)) log_line("Backup started: " + dest);
+      }
+      send_all(c, http_response(200, "application/json; charset=utf-8", backup_job.status_json()));
+      closesock(c);
+      continue;
+    }
+    if(admin){
+      send_all(c, http_response(404, "text/plain; charset=utf-8", "Not Found"));
+      closesock(c);
+      continue;
+    }
+
     // статика: "/" -> "/index.html"
     if(path == "/") path = "/index.html";
 
@@ -629,8 +1736,8 @@ int main(int argc, char** argv){
   // graceful shutdown
   log_line("Stopping...");
   closesock(s);
-  g_stop = true;
-  if(sim_thr.joinable()) sim_thr.join();
+  stop_threads();
+  backup_job.join();
   db.close();
 
 #ifdef _WIN32
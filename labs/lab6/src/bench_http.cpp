@@ -0,0 +1,89 @@
+// bench_http: нагрузка на temp_server для сравнения сетевых режимов (--io threads|uring).
+// conns потоков, каждый в цикле открывает соединение, шлет GET path и читает ответ
+// до закрытия (сервер отвечает Connection: close). Итог: запросов в секунду и задержки.
+//
+//   bench_http [--host 127.0.0.1] [--port 8080] [--path /api/current]
+//              [--conns 32] [--requests 20000]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Один запрос; false - ошибка соединения или ответ не 200
+static bool one_request(const sockaddr_in& addr, const std::string& req, size_t& bytes){
+  int s = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (s < 0) return false;
+  bool ok = ::connect(s, (const sockaddr*)&addr, sizeof(addr)) == 0 &&
+            ::send(s, req.data(), req.size(), MSG_NOSIGNAL) == (ssize_t)req.size();
+  std::string resp;
+  char buf[16384];
+  while (ok){
+    ssize_t n = ::recv(s, buf, sizeof(buf), 0);
+    if (n < 0) ok = false;
+    if (n <= 0) break;
+    resp.append(buf, (size_t)n);
+  }
+  ::close(s);
+  bytes += resp.size();
+  return ok && resp.compare(0, 12, "HTTP/1.1 200") == 0;
+}
+
+int main(int argc, char** argv){
+  std::string host = "127.0.0.1", path = "/api/current";
+  int port = 8080;
+  size_t conns = 32, requests = 20000;
+  for (int i=1;i<argc;i++){
+    std::string a = argv[i];
+    if (a=="--host" && i+1<argc) host = argv[++i];
+    else if (a=="--port" && i+1<argc) port = std::atoi(argv[++i]);
+    else if (a=="--path" && i+1<argc) path = argv[++i];
+    else if (a=="--conns" && i+1<argc) conns = (size_t)std::max(1, std::atoi(argv[++i]));
+    else if (a=="--requests" && i+1<argc) requests = (size_t)std::max(1, std::atoi(argv[++i]));
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1){
+    std::fprintf(stderr, "bad host: %s\n", host.c_str());
+    return 2;
+  }
+  std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+
+  std::atomic<size_t> next{0}, errors{0}, bytes{0};
+  std::vector<std::vector<uint32_t>> lat(conns);   // мкс
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<std::thread> thr;
+  for (size_t t=0;t<conns;t++){
+    thr.emplace_back([&, t]{
+      size_t b = 0;
+      while (next++ < requests){
+        auto a = std::chrono::steady_clock::now();
+        if (!one_request(addr, req, b)) errors++;
+        lat[t].push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - a).count());
+      }
+      bytes += b;
+    });
+  }
+  for (auto& th : thr) th.join();
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  std::vector<uint32_t> all;
+  for (auto& v : lat) all.insert(all.end(), v.begin(), v.end());
+  std::sort(all.begin(), all.end());
+  auto pct = [&](double p){ return all.empty() ? 0u : all[std::min(all.size() - 1, (size_t)(p * (double)all.size()))]; };
+  std::printf("%s%s: %zu requests, %zu conns, %.2f s, %.0f req/s, %.1f MB, errors %zu\n",
+              host.c_str(), path.c_str(), all.size(), conns, sec, (double)all.size() / sec,
+              (double)bytes.load() / 1e6, errors.load());
+  std::printf("latency us: p50 %u, p90 %u, p99 %u, max %u\n", pct(0.5), pct(0.9), pct(0.99), all.empty() ? 0u : all.back());
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+// bench_parse: сравнение разбора CSV (src/csv_parse.h) на большом файле.
+// Три способа, как в истории temp_server:
+//   getline  - std::getline + parse_csv_line (substr/stoi/timegm/strtod)
+//   memchr   - mmap + memchr + parse_csv_line
+//   fast     - mmap + find_newline (SSE2/AVX2) + parse_csv_fast
+// Для каждого: время, МБ/с и контрольная сумма разобранных измерений - у всех
+// способов она должна совпасть. --generate N сначала пишет в FILE N строк.
+//
+//   bench_parse FILE [--generate 80000000] [--only getline|memchr|fast]
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "csv_parse.h"
+
+// Итог одного прохода: число измерений и свертка их битов
+struct Result {
+  uint64_t ok = 0, bad = 0, hash = 0;
+  void add(const Sample& s){
+    uint64_t bits;
+    std::memcpy(&bits, &s.temp, sizeof(bits));
+    hash = (hash ^ (uint64_t)s.tt ^ (bits * 0x9E3779B97F4A7C15ull)) * 0x100000001B3ull;
+    ok++;
+  }
+};
+
+// Тестовый файл: каноническая строка раз в секунду, изредка нестандартные и битые
+static bool generate(const std::string& path, uint64_t lines){
+  FILE* f = std::fopen(path.c_str(), "wb");
+  if (!f) return false;
+  time_t t = 1735689600;   // 2025-01-01T00:00:00Z
+  uint32_t rnd = 12345;
+  char iso[21] = {};
+  for (uint64_t i=0;i<lines;i++, t++){
+    rnd = rnd * 1103515245u + 12345u;
+    format_iso_utc(t, iso);
+    int milli = (int)(rnd >> 8) % 60000 - 20000;
+    if (i % 100000 == 99999) std::fprintf(f, "%s,%.3e\n", iso, milli / 1000.0);   // через strtod
+    else if (i % 100000 == 49999) std::fprintf(f, "%s;broken\n", iso);
+    else std::fprintf(f, "%s,%s%d.%03d\n", iso, milli < 0 ? "-" : "", std::abs(milli) / 1000, std::abs(milli) % 1000);
+  }
+  return std::fclose(f) == 0;
+}
+
+static Result run_getline(const std::string& path){
+  Result r;
+  std::ifstream f(path, std::ios::binary);
+  std::string line;
+  Sample s;
+  while (std::getline(f, line)){
+    if (parse_csv_line(line, s)) r.add(s); else r.bad++;
+  }
+  return r;
+}
+
+// Файл целиком в память только для чтения; nullptr - ошибка
+static const char* map_file(const std::string& path, size_t& n){
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat st{};
+  if (::fstat(fd, &st) != 0 || st.st_size == 0){ ::close(fd); return nullptr; }
+  n = (size_t)st.st_size;
+  void* p = ::mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return nullptr;
+  ::madvise(p, n, MADV_SEQUENTIAL);
+  return (const char*)p;
+}
+
+static Result run_memchr(const char* d, size_t n){
+  Result r;
+  Sample s;
+  const char* p = d;
+  const char* end = d + n;
+  while (p < end){
+    const char* nl = (const char*)std::memchr(p, '\n', (size_t)(end - p));
+    if (!nl) nl = end;
+    if (parse_csv_line(std::string(p, (size_t)(nl - p)), s)) r.add(s); else r.bad++;
+    p = nl + 1;
+  }
+  return r;
+}
+
+static Result run_fast(const char* d, size_t n){
+  Result r;
+  Sample s;
+  const char* p = d;
+  const char* end = d + n;
+  while (p < end){
+    const char* nl = find_newline(p, end);
+    if (!nl) nl = end;
+    if (parse_csv_fast(p, (size_t)(nl - p), s)) r.add(s); else r.bad++;
+    p = nl + 1;
+  }
+  return r;
+}
+
+int main(int argc, char** argv){
+  std::string path, only;
+  uint64_t gen = 0;
+  for (int i=1;i<argc;i++){
+    std::string a = argv[i];
+    if (a=="--generate" && i+1<argc) gen = std::strtoull(argv[++i], nullptr, 10);
+    else if (a=="--only" && i+1<argc) only = argv[++i];
+    else path = a;
+  }
+  if (path.empty()){
+    std::fprintf(stderr, "usage: bench_parse FILE [--generate LINES] [--only getline|memchr|fast]\n");
+    return 2;
+  }
+  if (gen && !generate(path, gen)){
+    std::fprintf(stderr, "cannot write %s\n", path.c_str());
+    return 2;
+  }
+  size_t n = 0;
+  const char* d = map_file(path, n);
+  if (!d){
+    std::fprintf(stderr, "cannot map %s\n", path.c_str());
+    return 2;
+  }
+  // первый проход прогревает страничный кэш, чтобы способы сравнивались на равных
+  volatile uint64_t warm = 0;
+  for (size_t i=0;i<n;i+=4096) warm = warm + (unsigned char)d[i];
+
+  const char* names[] = {"getline", "memchr", "fast"};
+  Result res[3];
+  bool ran[3] = {};
+  for (int k=0;k<3;k++){
+    if (!only.empty() && only != names[k]) continue;
+    auto t0 = std::chrono::steady_clock::now();
+    res[k] = k == 0 ? run_getline(path) : k == 1 ? run_memchr(d, n) : run_fast(d, n);
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    ran[k] = true;
+    std::printf("%-8s %8.2f s %8.0f MB/s  ok %" PRIu64 ", bad %" PRIu64 ", hash %016" PRIx64 "\n",
+                names[k], sec, (double)n / 1e6 / sec, res[k].ok, res[k].bad, res[k].hash);
+  }
+  ::munmap((void*)d, n);
+
+  int first = -1;
+  bool same = true;
+  for (int k=0;k<3;k++){
+    if (!ran[k]) continue;
+    if (first < 0) first = k;
+    else same = same && res[k].ok == res[first].ok && res[k].bad == res[first].bad && res[k].hash == res[first].hash;
+  }
+  std::printf("%s\n", same ? "results identical" : "RESULTS DIFFER");
+  return same ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+#pragma once
+// Разбор строк CSV "YYYY-MM-DDTHH:MM:SSZ,temp" - общий для temp_server и temp_compact
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #endif
+  #define TS_HAVE_SSE2 1
+#endif
+
+// Перевод tm(UTC) -> time_t (кроссплатформенно)
+inline time_t timegm_portable(std::tm* t){
+#ifdef _WIN32
+  return _mkgmtime(t);
+#else
+  return timegm(t);
+#endif
+}
+
+// Дни от 1970-01-01 до даты (days_from_civil); день/месяц вне диапазона
+// переносятся линейно, как в timegm
+inline int64_t days_from_civil(int64_t y, int64_t m, int64_t d){
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// CRC32C (Castagnoli): инструкция crc32 при сборке с SSE4.2 (-msse4.2 / -march=native),
+// иначе по таблице
+inline uint32_t crc32c(const char* p, size_t n, uint32_t crc = 0){
+  crc = ~crc;
+#if defined(__SSE4_2__) && (defined(__x86_64__) || defined(_M_X64))
+  uint64_t c = crc;
+  for (; n >= 8; p += 8, n -= 8){
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  crc = (uint32_t)c;
+  for (; n; p++, n--) crc = _mm_crc32_u8(crc, (unsigned char)*p);
+#else
+  // slicing-by-8: восемь таблиц, по 8 байт за шаг (разбор --framed считает сумму каждой строки)
+  static const std::array<std::array<uint32_t, 256>, 8> t = []{
+    std::array<std::array<uint32_t, 256>, 8> t{};
+    for (uint32_t i=0;i<256;i++){
+      uint32_t c = i;
+      for (int k=0;k<8;k++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+      t[0][i] = c;
+    }
+    for (int k=1;k<8;k++)
+      for (uint32_t i=0;i<256;i++) t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xff];
+    return t;
+  }();
+  auto u = [&](int i){ return (uint32_t)(unsigned char)p[i]; };
+  for (; n >= 8; p += 8, n -= 8){
+    uint32_t lo = crc ^ (u(0) | u(1) << 8 | u(2) << 16 | u(3) << 24);
+    uint32_t hi = u(4) | u(5) << 8 | u(6) << 16 | u(7) << 24;
+    crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+          t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+  }
+  for (; n; p++, n--) crc = t[0][(crc ^ (unsigned char)*p) & 0xff] ^ (crc >> 8);
+#endif
+  return ~crc;
+}
+
+// Формат записи --framed: "ISOZ,temp*xxxxxxxx" - CRC32C байт до '*' восемью hex-цифрами.
+// Строки-метки "#ckpt,<смещение>*xxxxxxxx" и прочие строки с '#' разбор пропускает как
+// битые; суффикс у измерения разбору не мешает (число заканчивается на '*'), но запись с
+// неверной суммой тоже битая - ее не читает никто, файл при этом не правится
+inline constexpr size_t CSV_FRAME_SUFFIX = 9;
+
+// Дописать "*xxxxxxxx" за len байтами line (места должно хватать); новая длина
+inline size_t csv_frame(char* line, size_t len){
+  static const char HEX[] = "0123456789abcdef";
+  uint32_t c = crc32c(line, len);
+  line[len] = '*';
+  for (int i=0;i<8;i++) line[len + 1 + i] = HEX[(c >> (28 - 4*i)) & 0xf];
+  return len + CSV_FRAME_SUFFIX;
+}
+
+// Проверка строки без '\n': 1 - суффикс есть и сумма сходится, 0 - суффикса нет, -1 - не сходится
+inline int csv_frame_check(const char* p, size_t len){
+  if (len < CSV_FRAME_SUFFIX || p[len - CSV_FRAME_SUFFIX] != '*') return 0;
+  uint32_t v = 0;
+  for (size_t i=len-8;i<len;i++){
+    unsigned char ch = (unsigned char)p[i];
+    unsigned d = ch >= '0' && ch <= '9' ? ch - '0' : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10 : 16;
+    if (d > 15) return -1;
+    v = v << 4 | d;
+  }
+  return crc32c(p, len - CSV_FRAME_SUFFIX) == v ? 1 : -1;
+}
+
+// Быстрый разбор канонического "YYYY-MM-DDTHH:MM:SSZ" (первые 20 символов p) без
+// stoi/timegm. false - формат другой, тогда разбирает parse_iso_utc
+inline bool parse_iso_fast(const char* p, time_t& out){
+  if (p[4]!='-' || p[7]!='-' || p[10]!='T' || p[13]!=':' || p[16]!=':' || p[19]!='Z') return false;
+  unsigned bad = 0;
+  auto dg = [&](int i){ unsigned v = (unsigned)(unsigned char)p[i] - '0'; bad |= (v > 9); return (int64_t)v; };
+  int64_t y  = dg(0)*1000 + dg(1)*100 + dg(2)*10 + dg(3);
+  int64_t mo = dg(5)*10 + dg(6);
+  int64_t d  = dg(8)*10 + dg(9);
+  int64_t h  = dg(11)*10 + dg(12);
+  int64_t mi = dg(14)*10 + dg(15);
+  int64_t se = dg(17)*10 + dg(18);
+  if (bad || mo < 1 || mo > 12) return false;
+  int64_t t = days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + se;
+  if (t == -1) return false;
+  out = (time_t)t;
+  return true;
+}
+
+// Парсинг строгого ISO UTC: YYYY-MM-DDTHH:MM:SSZ
+inline time_t parse_iso_utc(const std::string& iso){
+  time_t fast;
+  if (iso.size() == 20 && parse_iso_fast(iso.data(), fast)) return fast;
+  if (iso.size() < 20) return (time_t)-1;
+  if (!(iso[4]=='-' && iso[7]=='-' && iso[10]=='T' && iso[13]==':' && iso[16]==':' && iso.back()=='Z')) return (time_t)-1;
+
+  std::tm t{};
+  try{
+    t.tm_year = std::stoi(iso.substr(0,4)) - 1900;
+    t.tm_mon  = std::stoi(iso.substr(5,2)) - 1;
+    t.tm_mday = std::stoi(iso.substr(8,2));
+    t.tm_hour = std::stoi(iso.substr(11,2));
+    t.tm_min  = std::stoi(iso.substr(14,2));
+    t.tm_sec  = std::stoi(iso.substr(17,2));
+    t.tm_isdst = 0;
+  } catch(...) { return (time_t)-1; }
+
+  return timegm_portable(&t);
+}
+
+// Быстрое форматирование time_t -> "YYYY-MM-DDTHH:MM:SSZ" (ровно 20 символов в out),
+// без gmtime/put_time: дата считается арифметически (civil_from_days)
+inline void format_iso_utc(time_t tt, char* out){
+  int64_t t = (int64_t)tt;
+  int64_t days = t / 86400, sec = t % 86400;
+  if (sec < 0){ sec += 86400; days--; }
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  unsigned doe = (unsigned)(days - era*146097);
+  unsigned yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  unsigned doy = doe - (365*yoe + yoe/4 - yoe/100);
+  unsigned mp = (5*doy + 2) / 153;
+  unsigned d = doy - (153*mp + 2)/5 + 1;
+  unsigned m = mp < 10 ? mp + 3 : mp - 9;
+  int64_t y = (int64_t)yoe + era*400 + (m <= 2);
+  auto put2 = [](char* p, unsigned v){ p[0] = char('0' + v/10); p[1] = char('0' + v%10); };
+  unsigned yy = (unsigned)(y < 0 ? 0 : y > 9999 ? 9999 : y);
+  put2(out, yy/100); put2(out+2, yy%100); out[4] = '-';
+  put2(out+5, m); out[7] = '-';
+  put2(out+8, d); out[10] = 'T';
+  put2(out+11, (unsigned)(sec/3600)); out[13] = ':';
+  put2(out+14, (unsigned)(sec/60%60)); out[16] = ':';
+  put2(out+17, (unsigned)(sec%60)); out[19] = 'Z';
+}
+
+// Одна запись измерения
+struct Sample { time_t tt{}; double temp{}; };
+
+// Парсинг CSV строки "ISO,temp" (с суффиксом --framed - только при верной сумме)
+inline bool parse_csv_line(const std::string& line, Sample& s){
+  if (csv_frame_check(line.data(), line.size()) < 0) return false;
+  auto p = line.find(',');
+  if (p==std::string::npos) return false;
+  std::string ts = line.substr(0,p);
+  std::string vs = line.substr(p+1);
+
+  time_t tt = parse_iso_utc(ts);
+  if (tt==(time_t)-1) return false;
+
+  char* end=nullptr;
+  double v = std::strtod(vs.c_str(), &end);
+  if (end==vs.c_str()) return false;
+
+  s.tt = tt;
+  s.temp = v;
+  return true;
+}
+
+// Быстрый разбор температуры "[-]123.456" без strtod (и без зависимости от локали).
+// Целое число из цифр делится на точную степень 10 - IEEE деление округляет так же,
+// как strtod. false - другой формат (экспонента, hex, inf, пробелы...), тогда strtod
+inline bool parse_temp_fast(const char* p, const char* end, double& out){
+  static const double POW10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15};
+  bool neg = false;
+  if (p < end && (*p == '-' || *p == '+')){ neg = (*p == '-'); p++; }
+  int64_t v = 0;
+  int digits = 0, frac = 0;
+  while (p < end && (unsigned)(*p - '0') <= 9 && digits < 15){ v = v*10 + (*p - '0'); p++; digits++; }
+  if (p < end && *p == '.'){
+    p++;
+    while (p < end && (unsigned)(*p - '0') <= 9 && digits < 15){ v = v*10 + (*p - '0'); p++; digits++; frac++; }
+  }
+  if (!digits) return false;
+  if (p < end && ((unsigned)(*p - '0') <= 9 || *p == 'e' || *p == 'E' || *p == 'x' || *p == 'X')) return false;
+  double r = (double)v / POW10[frac];
+  out = neg ? -r : r;
+  return true;
+}
+
+// Строка CSV без копирования: каноническая "YYYY-MM-DDTHH:MM:SSZ,temp" разбирается
+// быстрым путем, остальное - прежним parse_csv_line (результат тот же)
+inline bool parse_csv_fast(const char* p, size_t len, Sample& s){
+  if (len > CSV_FRAME_SUFFIX && p[len - CSV_FRAME_SUFFIX] == '*' && csv_frame_check(p, len) < 0) return false;
+  if (len > 21 && p[20] == ',' && parse_iso_fast(p, s.tt) && parse_temp_fast(p + 21, p + len, s.temp)) return true;
+  return parse_csv_line(std::string(p, len), s);
+}
+
+// Первый '\n' в [p, end) или nullptr: SSE2/AVX2 по 16/32 байт, хвост - побайтно
+inline const char* find_newline(const char* p, const char* end){
+#ifdef TS_HAVE_SSE2
+  auto ctz = [](unsigned m){
+#ifdef _MSC_VER
+    unsigned long i; _BitScanForward(&i, m); return (unsigned)i;
+#else
+    return (unsigned)__builtin_ctz(m);
+#endif
+  };
+#ifdef __AVX2__
+  const __m256i nl32 = _mm256_set1_epi8('\n');
+  while (end - p >= 32){
+    unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), nl32));
+    if (m) return p + ctz(m);
+    p += 32;
+  }
+#endif
+  const __m128i nl = _mm_set1_epi8('\n');
+  while (end - p >= 16){
+    unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+    if (m) return p + ctz(m);
+    p += 16;
+  }
+#endif
+  for (; p < end; p++) if (*p == '\n') return p;
+  return nullptr;
+}
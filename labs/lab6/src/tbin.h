@@ -0,0 +1,265 @@
+#pragma once
+// Бинарный формат сегмента измерений TBIN (measurements-*.tbin) - общий для
+// temp_server и temp_compact:
+//   "TBIN0001"
+//   блоки по TBIN_BLOCK измерений: int64 ts и int32 температура в тысячных первого
+//   измерения, дальше на каждое - zigzag-varint разности ts и температуры с предыдущим
+//   каталог: TbinBlock на каждый блок (где лежит, сколько измерений, первый/последний ts,
+//   сумма/мин/макс в тысячных) - по нему считаются итоги и ищется нужный блок
+//   хвост: uint64 смещение каталога, uint64 число блоков, "TBINEND1"
+// Числа пишутся в порядке байт машины (как и .idx). При 1 Гц измерение занимает 2-3 байта
+// вместо ~28 в CSV. Температура хранится точно: CSV, где значение не равно
+// целым тысячным, не сжимается.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "csv_parse.h"
+
+inline constexpr char TBIN_MAGIC[] = "TBIN0001";
+inline constexpr char TBIN_END[] = "TBINEND1";
+inline constexpr uint32_t TBIN_BLOCK = 4096;
+
+struct TbinBlock {
+  uint64_t off = 0;      // смещение блока в файле
+  uint32_t bytes = 0;    // размер блока
+  uint32_t count = 0;    // измерений в блоке
+  int64_t first = 0, last = 0;
+  int64_t sum = 0;       // в тысячных
+  int32_t mn = 0, mx = 0;
+};
+static_assert(sizeof(TbinBlock) == 48, "TbinBlock layout");
+
+inline uint64_t tbin_zigzag(int64_t v){ return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t tbin_unzigzag(uint64_t u){ return (int64_t)(u >> 1) ^ -(int64_t)(u & 1); }
+
+inline void tbin_put_varint(std::string& b, uint64_t v){
+  while (v >= 0x80){ b.push_back(char(v | 0x80)); v >>= 7; }
+  b.push_back(char(v));
+}
+
+inline bool tbin_get_varint(const char*& p, const char* end, uint64_t& v){
+  v = 0;
+  for (int sh = 0; sh < 64 && p < end; sh += 7){
+    uint8_t c = (uint8_t)*p++;
+    v |= (uint64_t)(c & 0x7f) << sh;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+// Температура -> тысячные; false - значение не равно m / 1000.0 ни для какого int32 m
+inline bool tbin_milli(double t, int32_t& m){
+  double r = std::nearbyint(t * 1000.0);
+  if (!(std::fabs(r) < 2e9) || r / 1000.0 != t) return false;
+  m = (int32_t)r;
+  return true;
+}
+
+// Измерение TBIN строкой CSV "ISOZ,temp\n" (как их пишет сервер); line - не меньше 64 байт
+inline size_t tbin_csv_line(char* line, int64_t ts, int32_t m){
+  format_iso_utc((time_t)ts, line);
+  int n = std::snprintf(line + 20, 44, ",%.3f\n", m / 1000.0);
+  return 20 + (size_t)std::max(n, 0);
+}
+
+// Запись TBIN: add() по возрастанию времени, затем finish()
+class TbinWriter {
+public:
+  bool open(const std::filesystem::path& p){
+    f_.open(p, std::ios::binary | std::ios::trunc);
+    f_.write(TBIN_MAGIC, 8);
+    off_ = 8;
+    dir_.clear();
+    buf_.clear();
+    cur_ = TbinBlock{};
+    return bool(f_);
+  }
+
+  void add(int64_t ts, int32_t m){
+    if (!cur_.count){
+      cur_.off = off_;
+      cur_.first = ts;
+      cur_.mn = cur_.mx = m;
+      buf_.append((const char*)&ts, 8);
+      buf_.append((const char*)&m, 4);
+    } else {
+      tbin_put_varint(buf_, tbin_zigzag(ts - cur_.last));
+      tbin_put_varint(buf_, tbin_zigzag((int64_t)m - prev_m_));
+      cur_.mn = std::min(cur_.mn, m);
+      cur_.mx = std::max(cur_.mx, m);
+    }
+    cur_.last = ts;
+    cur_.sum += m;
+    prev_m_ = m;
+    if (++cur_.count == TBIN_BLOCK) flush_block();
+  }
+
+  bool finish(){
+    flush_block();
+    uint64_t dir_off = off_, nb = dir_.size();
+    f_.write((const char*)dir_.data(), (std::streamsize)(dir_.size() * sizeof(TbinBlock)));
+    f_.write((const char*)&dir_off, 8);
+    f_.write((const char*)&nb, 8);
+    f_.write(TBIN_END, 8);
+    f_.flush();
+    bool ok = bool(f_);
+    f_.close();
+    return ok;
+  }
+
+  uint64_t samples() const {
+    uint64_t n = cur_.count;
+    for (auto& b : dir_) n += b.count;
+    return n;
+  }
+
+private:
+  void flush_block(){
+    if (!cur_.count) return;
+    cur_.bytes = (uint32_t)buf_.size();
+    f_.write(buf_.data(), (std::streamsize)buf_.size());
+    off_ += buf_.size();
+    dir_.push_back(cur_);
+    cur_ = TbinBlock{};
+    buf_.clear();
+  }
+
+  std::ofstream f_;
+  uint64_t off_ = 0;
+  std::string buf_;
+  TbinBlock cur_;
+  int32_t prev_m_ = 0;
+  std::vector<TbinBlock> dir_;
+};
+
+// Чтение TBIN из памяти (mmap всего файла): каталог разбирается в open(),
+// блоки декодируются по запросу
+class TbinReader {
+public:
+  bool open(const char* d, size_t n){
+    d_ = d;
+    dir_.clear();
+    cum_.assign(1, 0);
+    if (n < 8 + 24 || std::memcmp(d, TBIN_MAGIC, 8) != 0 || std::memcmp(d + n - 8, TBIN_END, 8) != 0) return false;
+    uint64_t dir_off = 0, nb = 0;
+    std::memcpy(&dir_off, d + n - 24, 8);
+    std::memcpy(&nb, d + n - 16, 8);
+    if (dir_off < 8 || dir_off > n - 24 || (n - 24 - dir_off) / sizeof(TbinBlock) != nb ||
+        (n - 24 - dir_off) % sizeof(TbinBlock)) return false;
+    dir_.resize((size_t)nb);
+    std::memcpy(dir_.data(), d + dir_off, (size_t)nb * sizeof(TbinBlock));
+    cum_.reserve(dir_.size() + 1);
+    for (auto& b : dir_){
+      if (b.off < 8 || b.bytes < 12 || b.off + b.bytes > dir_off || !b.count) return false;
+      cum_.push_back(cum_.back() + b.count);
+    }
+    return true;
+  }
+
+  size_t blocks() const { return dir_.size(); }
+  const TbinBlock& block(size_t i) const { return dir_[i]; }
+  uint64_t count() const { return cum_.back(); }
+  // Номер первого измерения блока i
+  uint64_t block_start(size_t i) const { return cum_[i]; }
+  // Блок, в котором k-е измерение
+  size_t block_of(uint64_t k) const {
+    return (size_t)(std::upper_bound(cum_.begin(), cum_.end(), k) - cum_.begin()) - 1;
+  }
+  // Первый блок, где есть ts >= from
+  size_t lower_block(int64_t from) const {
+    return (size_t)(std::partition_point(dir_.begin(), dir_.end(), [&](const TbinBlock& b){ return b.last < from; }) - dir_.begin());
+  }
+
+  // fn(ts, milli) для первых limit измерений блока i; false - блок поврежден
+  template <class F>
+  bool decode(size_t i, F&& fn, uint32_t limit = UINT32_MAX) const {
+    const TbinBlock& b = dir_[i];
+    const char* p = d_ + b.off;
+    const char* end = p + b.bytes;
+    int64_t ts;
+    int32_t m;
+    std::memcpy(&ts, p, 8);
+    std::memcpy(&m, p + 8, 4);
+    p += 12;
+    fn(ts, m);
+    for (uint32_t k = 1, n = std::min(b.count, limit); k < n; k++){
+      uint64_t dt, dm;
+      if (!tbin_get_varint(p, end, dt) || !tbin_get_varint(p, end, dm)) return false;
+      ts += tbin_unzigzag(dt);
+      m = (int32_t)(m + tbin_unzigzag(dm));
+      fn(ts, m);
+    }
+    return true;
+  }
+
+private:
+  const char* d_ = nullptr;
+  std::vector<TbinBlock> dir_;
+  std::vector<uint64_t> cum_{0};
+};
+
+// CSV -> TBIN. Берутся те же строки, что читает сервер: битые пропускаются, недописанная
+// последняя (без '\n') - тоже. Пишется во временный out.part, который переименовывается в
+// out только при успехе. false (причина в err) - время идет назад, температура не
+// представима в тысячных или у строки --framed не сходится CRC: такой CSV остается как есть.
+inline bool tbin_compact_csv(const std::filesystem::path& csv, const std::filesystem::path& out,
+                             std::string& err, uint64_t* samples = nullptr){
+  std::ifstream in(csv, std::ios::binary);
+  if (!in){ err = "cannot open " + csv.string(); return false; }
+  std::filesystem::path part = out;
+  part += ".part";
+  TbinWriter w;
+  if (!w.open(part)){ err = "cannot create " + part.string(); return false; }
+
+  std::vector<char> buf(1 << 20);
+  size_t have = 0;
+  int64_t prev = std::numeric_limits<int64_t>::min();
+  bool ok = true;
+  while (ok){
+    in.read(buf.data() + have, (std::streamsize)(buf.size() - have));
+    size_t got = (size_t)in.gcount();
+    have += got;
+    const char* p = buf.data();
+    const char* end = p + have;
+    while (const char* nl = find_newline(p, end)){
+      size_t len = (size_t)(nl - p);
+      if (len && p[len-1] == '\r') len--;
+      Sample s{};
+      int32_t m = 0;
+      if (len && p[0] != '#' && csv_frame_check(p, len) < 0){ err = "checksum mismatch: " + std::string(p, len); ok = false; break; }
+      if (len && parse_csv_fast(p, len, s)){
+        if ((int64_t)s.tt < prev){ err = "timestamps go backwards"; ok = false; break; }
+        if (!tbin_milli(s.temp, m)){ err = "value does not fit milli-degrees: " + std::string(p, len); ok = false; break; }
+        w.add((int64_t)s.tt, m);
+        prev = (int64_t)s.tt;
+      }
+      p = nl + 1;
+    }
+    size_t rest = (size_t)(end - p);
+    std::memmove(buf.data(), p, rest);
+    have = rest;
+    if (!got) break;   // конец файла; хвост без '\n' не берем
+    if (have == buf.size()) buf.resize(buf.size() * 2);
+  }
+
+  std::error_code ec;
+  if (ok && !w.finish()){ err = "write failed: " + part.string(); ok = false; }
+  if (ok) std::filesystem::rename(part, out, ec);
+  if (ok && ec){ err = "rename failed: " + ec.message(); ok = false; }
+  if (!ok){
+    w.finish();
+    std::filesystem::remove(part, ec);
+    return false;
+  }
+  if (samples) *samples = w.samples();
+  return true;
+}
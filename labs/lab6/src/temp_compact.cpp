@@ -0,0 +1,118 @@
+// temp_compact: сжатие закрытых сегментов measurements-*.csv в TBIN (см. tbin.h)
+// и обратный вывод TBIN в CSV.
+//
+//   temp_compact [--remove] FILE.csv...   -> FILE.tbin рядом с каждым CSV
+//   temp_compact --to-csv FILE.tbin       -> CSV в stdout
+//
+// --remove - после проверки удалить CSV и его .idx/.sum (иначе сервер увидит оба
+// файла и посчитает измерения дважды). Активный сегмент сжимать нельзя: сервер
+// дописывает его. temp_server умеет делать то же сам (--compact-after-days).
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "tbin.h"
+
+// Файл целиком в память (для TBIN это десятки МБ)
+static bool read_file(const std::filesystem::path& p, std::string& out){
+  std::ifstream f(p, std::ios::binary);
+  if (!f) return false;
+  out.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  return true;
+}
+
+// Проверка: каталог читается, все блоки декодируются, число измерений сходится
+static bool verify_tbin(const std::filesystem::path& p, uint64_t expect){
+  std::string d;
+  TbinReader r;
+  if (!read_file(p, d) || !r.open(d.data(), d.size()) || r.count() != expect) return false;
+  uint64_t n = 0;
+  for (size_t i=0;i<r.blocks();i++){
+    int64_t prev = r.block(i).first;
+    bool sorted = true;
+    if (!r.decode(i, [&](int64_t ts, int32_t){ sorted = sorted && ts >= prev; prev = ts; n++; })) return false;
+    if (!sorted || prev != r.block(i).last) return false;
+  }
+  return n == expect;
+}
+
+static int to_csv(const std::filesystem::path& p){
+  std::string d;
+  TbinReader r;
+  if (!read_file(p, d) || !r.open(d.data(), d.size())){
+    std::cerr << "not a TBIN file: " << p.string() << "\n";
+    return 1;
+  }
+  std::string out;
+  char line[64];
+  for (size_t i=0;i<r.blocks();i++){
+    bool ok = r.decode(i, [&](int64_t ts, int32_t m){ out.append(line, tbin_csv_line(line, ts, m)); });
+    if (!ok){
+      std::cerr << "corrupted block " << i << " in " << p.string() << "\n";
+      return 1;
+    }
+    if (out.size() > (1u << 20)){ std::cout.write(out.data(), (std::streamsize)out.size()); out.clear(); }
+  }
+  std::cout.write(out.data(), (std::streamsize)out.size());
+  return std::cout ? 0 : 1;
+}
+
+static bool compact(const std::filesystem::path& csv, bool remove_csv){
+  std::filesystem::path out = csv;
+  out.replace_extension(".tbin");
+  auto t0 = std::chrono::steady_clock::now();
+  std::string err;
+  uint64_t samples = 0;
+  if (!tbin_compact_csv(csv, out, err, &samples)){
+    std::cerr << csv.string() << ": " << err << "\n";
+    return false;
+  }
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+  if (!verify_tbin(out, samples)){
+    std::cerr << out.string() << ": verification failed\n";
+    std::error_code ec;
+    std::filesystem::remove(out, ec);
+    return false;
+  }
+  std::error_code ec;
+  uint64_t in_sz = std::filesystem::file_size(csv, ec);
+  uint64_t out_sz = std::filesystem::file_size(out, ec);
+  std::cout << csv.filename().string() << " -> " << out.filename().string() << ": " << samples << " samples, "
+            << in_sz << " -> " << out_sz << " bytes";
+  if (out_sz) std::cout << " (x" << (in_sz / std::max<uint64_t>(out_sz, 1)) << ")";
+  std::cout << ", " << ms << " ms\n";
+  if (remove_csv){
+    for (const char* ext : {"", ".idx", ".sum"}){
+      std::filesystem::path p = csv;
+      p += ext;
+      std::filesystem::remove(p, ec);
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv){
+  bool remove_csv = false, decode = false;
+  std::vector<std::filesystem::path> files;
+  for (int i=1;i<argc;i++){
+    std::string a = argv[i];
+    if (a == "--remove") remove_csv = true;
+    else if (a == "--to-csv") decode = true;
+    else files.push_back(a);
+  }
+  if (files.empty()){
+    std::cerr << "usage: temp_compact [--remove] FILE.csv...\n"
+                 "       temp_compact --to-csv FILE.tbin\n";
+    return 2;
+  }
+  if (decode) return files.size() == 1 ? to_csv(files[0]) : 2;
+
+  int failed = 0;
+  for (auto& f : files) if (!compact(f, remove_csv)) failed++;
+  return failed ? 1 : 0;
+}
@@ -1,16 +1,31 @@
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
+#include <cctype>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <csignal>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <list>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <random>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -18,6 +33,9 @@
 #ifdef _WIN32
   #include <winsock2.h>
   #include <ws2tcpip.h>
+  #include <windows.h>
+  #include <fcntl.h>
+  #include <io.h>
   #pragma comment(lib, "Ws2_32.lib")
   using socket_t = SOCKET;
   static bool sock_init(){ WSADATA w{}; return WSAStartup(MAKEWORD(2,2), &w) == 0; }
@@ -25,15 +43,44 @@
   static void sock_close(socket_t s){ closesocket(s); }
 #else
   #include <arpa/inet.h>
+  #include <fcntl.h>
   #include <netinet/in.h>
+  #include <poll.h>
+  #include <sys/mman.h>
+  #include <sys/select.h>
   #include <sys/socket.h>
+  #include <sys/stat.h>
   #include <unistd.h>
+  #ifdef __linux__
+    #include <sys/inotify.h>
+    #include <sys/sendfile.h>
+    #if __has_include(<linux/io_uring.h>)
+      #include <linux/io_uring.h>
+      #include <sys/syscall.h>
+      #include <sys/uio.h>
+      #define TS_HAVE_URING 1
+      #ifndef IORING_ACCEPT_MULTISHOT
+        #define IORING_ACCEPT_MULTISHOT (1U << 0)
+      #endif
+    #endif
+  #endif
   using socket_t = int;
   static bool sock_init(){ return true; }
   static void sock_cleanup(){}
   static void sock_close(socket_t s){ close(s); }
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  #define TS_HAVE_RDTSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+  #include <intrin.h>
+  #define TS_HAVE_RDTSC 1
+#endif
+
+#include "csv_parse.h"
+#include "tbin.h"
+
 // Мини-логгер в stderr (UTC время + уровень)
 enum class LogLevel { Info, Warn, Err };
 static std::mutex g_log_mtx;
@@ -63,187 +110,3459 @@ static void log(LogLevel lvl, const std::string& msg){
 static std::atomic<bool> g_stop{false};
 static void on_signal(int){ g_stop = true; }
 
-// Перевод tm(UTC) -> time_t (кроссплатформенно)
-static time_t timegm_portable(std::tm* t){
+// Перевод time_t -> tm(UTC) (кроссплатформенно, потокобезопасно)
+static bool gmtime_r_portable(const time_t* tt, std::tm* out){
 #ifdef _WIN32
-  return _mkgmtime(t);
+  return gmtime_s(out, tt) == 0;
 #else
-  return timegm(t);
+  return gmtime_r(tt, out) != nullptr;
 #endif
 }
 
-// Перевод time_t -> tm(UTC) (кроссплатформенно, потокобезопасно)
-static bool gmtime_r_portable(const time_t* tt, std::tm* out){
+// Форматирование time_t -> ISO UTC
+static std::string iso_utc_from(time_t tt){
+  std::tm t{};
+  if(!gmtime_r_portable(&tt, &t)) return "1970-01-01T00:00:00Z";
+  std::ostringstream os;
+  os << std::put_time(&t, "%Y-%m-%dT%H:%M:%SZ");
+  return os.str();
+}
+
+// Hex символ -> число 0..15
+static int hexval(char c){
+  if (c>='0' && c<='9') return c - '0';
+  if (c>='a' && c<='f') return 10 + (c - 'a');
+  if (c>='A' && c<='F') return 10 + (c - 'A');
+  return -1;
+}
+
+// Декодирование URL query (percent-encoding +), дописывает в out
+template <class Str>
+static void url_decode_to(std::string_view s, Str& out){
+  out.reserve(out.size() + s.size());
+  for (size_t i=0;i<s.size();i++){
+    if (s[i]=='%' && i+2<s.size()){
+      int a=hexval(s[i+1]), b=hexval(s[i+2]);
+      if (a>=0 && b>=0){
+        out.push_back(char((a<<4)|b));
+        i+=2;
+        continue;
+      }
+    }
+    if (s[i]=='+'){ out.push_back(' '); continue; }
+    out.push_back(s[i]);
+  }
+}
+
+// Значение заголовка name (строчными буквами) в тексте запроса; пустое - нет такого
+static std::string_view header_value(std::string_view req, std::string_view name){
+  size_t p = req.find("\r\n");
+  while (p != std::string_view::npos && p + 2 < req.size()){
+    size_t b = p + 2, e = req.find("\r\n", b);
+    std::string_view line = req.substr(b, e == std::string_view::npos ? std::string_view::npos : e - b);
+    if (line.empty()) break;   // конец заголовков
+    if (line.size() > name.size() && line[name.size()] == ':'){
+      bool same = true;
+      for (size_t i=0;i<name.size() && same;i++) same = std::tolower((unsigned char)line[i]) == name[i];
+      if (same){
+        std::string_view v = line.substr(name.size() + 1);
+        while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+        while (!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.remove_suffix(1);
+        return v;
+      }
+    }
+    p = e;
+  }
+  return {};
+}
+
+// Параметр key из строки "a=1&b=2" (декодированный; при повторе - последний).
+// Строки out и ключей берут память у out (в запросе - арена)
+static bool query_param(std::string_view q, std::string_view key, std::pmr::string& out){
+  std::pmr::string k(out.get_allocator());
+  bool found = false;
+  size_t i=0;
+  while(i<q.size()){
+    size_t amp = q.find('&', i);
+    if (amp==std::string_view::npos) amp=q.size();
+    size_t eq = q.find('=', i);
+    if (eq==std::string_view::npos || eq>amp) eq = amp;
+    k.clear();
+    url_decode_to(q.substr(i, eq-i), k);
+    if (!k.empty() && k == key){
+      out.clear();
+      if (eq < amp) url_decode_to(q.substr(eq+1, amp-(eq+1)), out);
+      found = true;
+    }
+    i = amp + 1;
+  }
+  return found;
+}
+
+// Экранирование строки для JSON
+static std::string json_escape(const std::string& s){
+  std::ostringstream os;
+  for(char c: s){
+    switch(c){
+      case '\\': os<<"\\\\"; break;
+      case '"':  os<<"\\\""; break;
+      case '\n': os<<"\\n"; break;
+      case '\r': os<<"\\r"; break;
+      case '\t': os<<"\\t"; break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          os<<"\\u"<<std::hex<<std::setw(4)<<std::setfill('0')<<(int)(unsigned char)c<<std::dec;
+        } else os<<c;
+    }
+  }
+  return os.str();
+}
+
+// Строка ровно в том виде, как ее пишет CsvAppender: "YYYY-MM-DDTHH:MM:SSZ,[-]D.DDD" и, в
+// режиме framed обязательно, суффикс с верной суммой. Обрывок записи ("...Z,23" от
+// "...Z,23.456") такой проверки не проходит, хотя и разбирается
+static bool appender_format(const std::string& line, bool framed){
+  int r = csv_frame_check(line.data(), line.size());
+  if (r < 0 || (framed && r == 0)) return false;
+  size_t len = r > 0 ? line.size() - CSV_FRAME_SUFFIX : line.size();
+  time_t t;
+  if (len < 26 || line[20] != ',' || !parse_iso_fast(line.data(), t)) return false;
+  size_t i = 21 + (line[21] == '-'), dot = line.find('.', i);
+  if (dot == std::string::npos || dot == i || dot + 4 != len) return false;
+  for (size_t k=i;k<len;k++) if (k != dot && (unsigned)(line[k] - '0') > 9) return false;
+  return true;
+}
+
+// Восстановление последнего измерения при старте: CSV читается с конца блоками по 64 КБ,
+// поэтому время не зависит от размера файла. Последняя строка без '\n' - остаток записи при
+// падении, она отрезается от файла. Остается (с дописанным '\n') только строка, целиком
+// совпадающая с форматом писателя (appender_format; framed - с верной суммой). Берется
+// последняя разбираемая строка, но не дальше 1 МБ от конца.
+static bool recover_last_sample(const std::filesystem::path& file, Sample& out, bool framed){
+  std::error_code ec;
+  uint64_t size = std::filesystem::file_size(file, ec);
+  if (ec || size == 0) return false;
+  std::ifstream f(file, std::ios::binary);
+  if(!f) return false;
+
+  const uint64_t BLOCK = 64*1024, LIMIT = 1024*1024;
+  std::string buf;     // байты файла [pos, pos+buf.size())
+  uint64_t pos = size;
+  auto read_more = [&]() -> bool {
+    if (pos == 0 || size - pos >= LIMIT) return false;
+    uint64_t n = std::min(BLOCK, pos);
+    std::string blk((size_t)n, '\0');
+    f.seekg((std::streamoff)(pos - n));
+    if (!f.read(&blk[0], (std::streamsize)n)) return false;
+    pos -= n;
+    buf.insert(0, blk);
+    return true;
+  };
+  if (!read_more()) return false;
+
+  // Строка без '\n' в конце: целую запись писателя дополняем '\n', остальное обрезаем по последнему '\n'
+  if (buf.back() != '\n'){
+    size_t nl;
+    while ((nl = buf.rfind('\n')) == std::string::npos && read_more()) {}
+    std::string tail = buf.substr(nl == std::string::npos ? 0 : nl + 1);
+    if (!tail.empty() && tail.back() == '\r') tail.pop_back();
+    if ((nl != std::string::npos || pos == 0) && appender_format(tail, framed)){
+      f.close();
+      std::ofstream app(file, std::ios::binary | std::ios::app);
+      if (!(app << '\n' << std::flush)){
+        log(LogLevel::Warn, "cannot add newline after last line in " + file.string());
+        return false;
+      }
+      app.close();
+      log(LogLevel::Warn, "added missing newline after last line in " + file.string());
+      buf.push_back('\n');
+      f.open(file, std::ios::binary);
+    } else if (nl != std::string::npos || pos == 0){
+      uint64_t good = (nl == std::string::npos) ? 0 : pos + nl + 1;
+      f.close();
+      std::filesystem::resize_file(file, good, ec);
+      if (ec){
+        log(LogLevel::Warn, "cannot truncate torn line in " + file.string() + ": " + ec.message());
+        return false;
+      }
+      log(LogLevel::Warn, "truncated torn last line (" + std::to_string(size - good) + " bytes) in " + file.string());
+      buf.resize((size_t)(good - pos));
+      f.open(file, std::ios::binary);
+    }
+  }
+
+  // Идем по строкам назад до первой разбираемой
+  uint64_t line_end = pos + buf.size();   // позиция сразу после '\n' текущей строки
+  while (line_end > 0){
+    uint64_t nl_pos = line_end - 1;
+    size_t p;
+    while (true){
+      size_t rel = (size_t)(nl_pos - pos);
+      p = rel == 0 ? std::string::npos : buf.rfind('\n', rel - 1);
+      if (p != std::string::npos || pos == 0) break;
+      if (!read_more()) return false;
+    }
+    uint64_t start = (p == std::string::npos) ? 0 : pos + p + 1;
+    std::string line = buf.substr((size_t)(start - pos), (size_t)(nl_pos - start));
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (!line.empty() && parse_csv_line(line, out)) return true;
+    line_end = start;
+  }
+  return false;
+}
+
+// Проверка CSV формата --framed при старте. Метка "#ckpt,N" ищется с конца блоками по 64 КБ
+// (верная - сумма сходится и N равно ее смещению), дальше нее проверяются все полные строки:
+// нужна запись с верной суммой или строка '#'. Без метки файл проверяется с начала, и строки
+// без суммы допускаются (файл начат без --framed). Плохие строки после последней верной
+// записи и последняя строка без '\n', если у нее нет верной суммы, - оборванная при падении
+// запись, файл обрезается по первой из них. Плохие строки посреди хвоста в файле остаются
+// как есть (он может быть жесткой ссылкой на копию): записи с неверной суммой отбрасывает
+// сам разбор (parse_csv_fast), а здесь их смещения только пишутся в лог.
+// true - файл обрезан
+static bool verify_framed_tail(const std::filesystem::path& file){
+  std::error_code ec;
+  uint64_t size = std::filesystem::file_size(file, ec);
+  if (ec || size == 0) return false;
+  std::ifstream f(file, std::ios::binary);
+  if (!f) return false;
+  auto t0 = std::chrono::steady_clock::now();
+  auto read_at = [&](uint64_t off, size_t n, std::string& buf){
+    buf.resize(n);
+    f.seekg((std::streamoff)off);
+    f.read(&buf[0], (std::streamsize)n);
+    buf.resize((size_t)f.gcount());
+    f.clear();
+  };
+
+  const uint64_t BLOCK = 64*1024;
+  uint64_t start = 0;
+  bool have_ckpt = false;
+  std::string buf;
+  for (uint64_t hi = size; hi > 0 && !have_ckpt;){   // метка начинается в [lo, hi)
+    uint64_t lo = hi > BLOCK ? hi - BLOCK : 0;
+    uint64_t rd = lo ? lo - 1 : 0;                   // байт перед ней - '\n'
+    read_at(rd, (size_t)(std::min(size, hi + 64) - rd), buf);
+    for (size_t at = buf.rfind("#ckpt,", (size_t)(hi - 1 - rd)); at != std::string::npos && rd + at >= lo;
+         at = at ? buf.rfind("#ckpt,", at - 1) : std::string::npos){
+      if (rd + at > 0 && buf[at-1] != '\n') continue;
+      size_t nl = buf.find('\n', at);
+      if (nl == std::string::npos || csv_frame_check(buf.data() + at, nl - at) != 1) continue;
+      if (std::strtoull(buf.c_str() + at + 6, nullptr, 10) != rd + at) continue;
+      start = rd + at;
+      have_ckpt = true;
+      break;
+    }
+    hi = lo;
+  }
+
+  // Полные строки от метки: плохие запоминаем, good_end - конец последней верной записи
+  std::vector<uint64_t> bad;
+  uint64_t good_end = start, pos = start;
+  std::string carry;
+  while (pos < size){
+    read_at(pos, (size_t)std::min<uint64_t>(size - pos, 1 << 20), buf);
+    if (buf.empty()) break;
+    uint64_t base = pos - carry.size();
+    pos += buf.size();
+    buf.insert(0, carry);
+    const char* d = buf.data();
+    const char* end = d + buf.size();
+    const char* p = d;
+    while (const char* nl = find_newline(p, end)){
+      size_t len = (size_t)(nl - p);
+      uint64_t off = base + (uint64_t)(p - d);
+      if (len && p[0] == '#'){
+        if (len > 6 && std::memcmp(p, "#ckpt,", 6) == 0 && csv_frame_check(p, len) == 1) have_ckpt = true;
+      } else if (len){
+        int r = csv_frame_check(p, len);
+        if (r > 0) good_end = off + len + 1;
+        else if (r < 0 || have_ckpt) bad.push_back(off);
+        else good_end = off + len + 1;   // строка без суммы до первой метки
+      }
+      p = nl + 1;
+    }
+    carry.assign(p, end);
+  }
+  // последняя строка без '\n': остается, только если это целая запись с верной суммой
+  // (или строка без суммы до первой метки - как и для полных строк), иначе - оборванная запись
+  if (!carry.empty()){
+    int r = carry[0] == '#' ? -1 : csv_frame_check(carry.data(), carry.size());
+    if (r > 0 || (r == 0 && !have_ckpt)) good_end = pos;
+    else bad.push_back(pos - carry.size());
+  }
+
+  uint64_t cut = size;
+  size_t skipped = 0;
+  std::string where;
+  for (uint64_t off : bad){
+    if (off >= good_end){ cut = off; break; }
+    if (skipped++ < 32) where += (where.empty() ? " at " : ", ") + std::to_string(off);
+  }
+  f.close();
+  if (cut < size){
+    std::filesystem::resize_file(file, cut, ec);
+    if (ec) log(LogLevel::Warn, "cannot truncate bad framed tail in " + file.string() + ": " + ec.message());
+  }
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+  log(LogLevel::Info, "framed check " + file.filename().string() + ": " + std::to_string(size - start) + " bytes after " +
+      (start ? "checkpoint " + std::to_string(start) : std::string("file start")) + " in " + std::to_string(ms) + " ms");
+  if (skipped) log(LogLevel::Warn, std::to_string(skipped) + " corrupt records in " + file.string() +
+                   " are skipped when reading" + where + (skipped > 32 ? ", ..." : ""));
+  if (cut < size && !ec) log(LogLevel::Warn, "truncated corrupt tail (" + std::to_string(size - cut) + " bytes) in " + file.string());
+  return cut < size && !ec;
+}
+
+// Файл, отображенный в память только для чтения (mmap / MapViewOfFile).
+// Размер фиксируется в момент open(): строки, дописанные позже, не видны.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile(){ close(); }
+
+  bool open(const std::filesystem::path& p){
+    close();
 #ifdef _WIN32
-  return gmtime_s(out, tt) == 0;
+    HANDLE f = CreateFileW(p.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER sz{};
+    if (!GetFileSizeEx(f, &sz)){ CloseHandle(f); return false; }
+    size_ = (size_t)sz.QuadPart;
+    if (size_ == 0){ CloseHandle(f); return true; }
+    HANDLE m = CreateFileMappingW(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(f);
+    if (!m){ size_ = 0; return false; }
+    data_ = (const char*)MapViewOfFile(m, FILE_MAP_READ, 0, 0, size_);
+    CloseHandle(m);
+    if (!data_){ size_ = 0; return false; }
 #else
-  return gmtime_r(tt, out) != nullptr;
+    int fd = ::open(p.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (fstat(fd, &st) != 0){ ::close(fd); return false; }
+    size_ = (size_t)st.st_size;
+    if (size_ == 0){ ::close(fd); return true; }
+    void* m = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED){ size_ = 0; return false; }
+    data_ = (const char*)m;
+#endif
+    return true;
+  }
+
+  void close(){
+    if (data_){
+#ifdef _WIN32
+      UnmapViewOfFile(data_);
+#else
+      munmap((void*)data_, size_);
+#endif
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Начало первой строки, которая начинается в позиции >= pos
+static size_t line_start_at_or_after(const char* d, size_t n, size_t pos){
+  if (pos == 0 || pos >= n) return pos >= n ? n : 0;
+  if (d[pos-1] == '\n') return pos;
+  const char* nl = (const char*)std::memchr(d + pos, '\n', n - pos);
+  return nl ? (size_t)(nl - d) + 1 : n;
+}
+
+// Разбор полной строки (с '\n') по смещению off; next - начало следующей строки
+static bool parse_line_at(const char* d, size_t n, size_t off, Sample& s, size_t& next){
+  const char* nl = find_newline(d + off, d + n);
+  if (!nl){ next = n; return false; } // недописанная строка в конце файла
+  next = (size_t)(nl - d) + 1;
+  size_t len = (size_t)(nl - d) - off;
+  if (len && d[off+len-1] == '\r') len--;
+  return len && parse_csv_fast(d + off, len, s);
+}
+
+// Смещение первой строки с ts >= from в отсортированном по времени CSV.
+// Бинарный поиск по байтам [lo, hi): середина выравнивается на начало строки,
+// битые строки пропускаются. Когда окно сузилось до пары строк - досматриваем линейно.
+static size_t lower_bound_offset(const char* d, size_t n, time_t from, size_t lo = 0, size_t hi = std::string::npos){
+  if (hi > n) hi = n;
+  lo = line_start_at_or_after(d, n, lo);
+  while (hi > lo && hi - lo > 256){
+    size_t mid = lo + (hi - lo) / 2;
+    size_t ls = line_start_at_or_after(d, n, mid);
+    size_t p = ls, next = ls;
+    Sample s{};
+    bool ok = false;
+    while (p < hi && !(ok = parse_line_at(d, n, p, s, next))) p = next;
+    if (!ok){
+      if (ls >= hi) break; // в [mid, hi) нет целой строки - дальше линейно
+      hi = ls;             // до hi только битые строки, их все равно пропустим
+      continue;
+    }
+    if (s.tt < from) lo = next;
+    else hi = p;
+  }
+  // линейный досмотр
+  size_t p = lo, next = lo;
+  while (p < n){
+    Sample s{};
+    if (parse_line_at(d, n, p, s, next) && s.tt >= from) return p;
+    if (next <= p) break;
+    p = next;
+  }
+  return n;
+}
+
+// Разреженный индекс времени рядом с CSV (measurements.csv.idx):
+// заголовок IDX_MAGIC и бинарные записи {int64 ts, uint64 offset, uint64 ordinal}
+// для строки раз в every_lines строк или раз в every_sec секунд (ordinal - номер
+// измерения в файле, битые строки не считаются). Индекс дописывается по мере роста CSV (catch_up читает
+// только новый хвост, поэтому работает и для внешнего писателя), при старте
+// проверяется по CSV и перестраивается, если не сходится.
+static const char IDX_MAGIC[8] = {'T','I','D','X','0','0','0','2'};
+
+class TimeIndex {
+public:
+  struct Entry { int64_t ts; uint64_t off; uint64_t ord; };
+
+  // epoch - эпоха хранилища: растет, если дописана строка старше уже разобранной
+  // (такое измерение меняет итоги диапазонов, которые уже могли попасть в кэш)
+  void configure(size_t every_lines, int every_sec, std::atomic<uint64_t>* epoch = nullptr){
+    every_lines_ = every_lines ? every_lines : 1;
+    every_sec_ = every_sec > 0 ? every_sec : 60;
+    epoch_ = epoch;
+  }
+
+  // Загрузить индекс, проверить по CSV (иначе перестроить) и догнать хвост
+  void open(const std::filesystem::path& csv){
+    std::lock_guard<std::mutex> lk(m_);
+    csv_ = csv;
+    idx_ = csv;
+    idx_ += ".idx";
+    entries_.clear();
+
+    std::ifstream f(idx_, std::ios::binary);
+    char magic[sizeof(IDX_MAGIC)] = {};
+    bool have_file = (bool)f;
+    if (f.read(magic, sizeof(magic)) && std::memcmp(magic, IDX_MAGIC, sizeof(magic)) == 0){
+      Entry e{};
+      while (f.read((char*)&e, sizeof(e))) entries_.push_back(e);
+    } else if (have_file && f.gcount()){
+      log(LogLevel::Warn, "index " + idx_.string() + " has old format, rebuilding");
+    }
+    f.close();
+
+    if (!entries_.empty() && !valid_locked()){
+      log(LogLevel::Warn, "index " + idx_.string() + " is stale, rebuilding");
+      entries_.clear();
+    }
+    // переписываем файл целиком: отрезаем хвост от недописанной записи или старый индекс
+    rewrite_locked();
+
+    covered_ = entries_.empty() ? 0 : entries_.back().off;
+    ord_ = entries_.empty() ? 0 : entries_.back().ord;
+    lines_since_ = 0;
+    last_ts_ = std::numeric_limits<int64_t>::min();
+    catch_up_locked();
+  }
+
+  // Дочитать новые полные строки CSV и добавить записи индекса
+  void catch_up(){
+    std::lock_guard<std::mutex> lk(m_);
+    catch_up_locked();
+  }
+
+  // Окно байт [lo, hi] CSV, в котором начинается первая строка с ts >= from
+  std::pair<uint64_t,uint64_t> bracket(time_t from) const {
+    std::lock_guard<std::mutex> lk(m_);
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), (int64_t)from,
+                               [](const Entry& a, int64_t t){ return a.ts < t; });
+    uint64_t hi = (it == entries_.end()) ? covered_ : it->off;
+    uint64_t lo = (it == entries_.begin()) ? 0 : std::prev(it)->off;
+    return {lo, hi};
+  }
+
+  // Ближайшая запись с ordinal <= k: с нее можно дойти до k-го измерения
+  Entry locate(uint64_t k) const {
+    std::lock_guard<std::mutex> lk(m_);
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), k,
+                               [](uint64_t v, const Entry& a){ return v < a.ord; });
+    return (it == entries_.begin()) ? Entry{0, 0, 0} : *std::prev(it);
+  }
+
+  // Время первого измерения файла (INT64_MAX, если файл пуст)
+  int64_t first_ts() const {
+    std::lock_guard<std::mutex> lk(m_);
+    return entries_.empty() ? std::numeric_limits<int64_t>::max() : entries_.front().ts;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lk(m_);
+    return entries_.size();
+  }
+
+  // Время последнего разобранного измерения (INT64_MIN, если их нет)
+  int64_t last_ts() const {
+    std::lock_guard<std::mutex> lk(m_);
+    return last_ts_;
+  }
+
+private:
+  // Проверка: смещения растут, и строки CSV по первой/последней записи имеют те же ts
+  bool valid_locked() const {
+    std::error_code ec;
+    uint64_t sz = std::filesystem::file_size(csv_, ec);
+    if (ec) return false;
+    for (size_t i=1;i<entries_.size();i++)
+      if (entries_[i].off <= entries_[i-1].off || entries_[i].ts < entries_[i-1].ts ||
+          entries_[i].ord <= entries_[i-1].ord) return false;
+    if (entries_.back().off >= sz) return false;
+    std::ifstream f(csv_, std::ios::binary);
+    for (const Entry* e : {&entries_.front(), &entries_.back()}){
+      f.seekg((std::streamoff)e->off);
+      std::string line;
+      Sample s{};
+      if (!std::getline(f, line) || !parse_csv_line(line, s) || (int64_t)s.tt != e->ts) return false;
+    }
+    return true;
+  }
+
+  void catch_up_locked(){
+    std::error_code ec;
+    uint64_t sz = std::filesystem::file_size(csv_, ec);
+    if (ec) return;
+    if (sz < covered_){
+      // CSV обрезали или подменили - индекс строим заново
+      entries_.clear();
+      covered_ = 0;
+      ord_ = 0;
+      lines_since_ = 0;
+      last_ts_ = std::numeric_limits<int64_t>::min();
+      rewrite_locked();
+    }
+    if (sz == covered_) return;
+
+    std::ifstream f(csv_, std::ios::binary);
+    if (!f) return;
+    f.seekg((std::streamoff)covered_);
+
+    std::vector<Entry> added;
+    bool late = false;
+    std::string buf, carry;
+    buf.resize(1 << 16);
+    uint64_t off = covered_;  // смещение начала carry
+    uint64_t left = sz - covered_;
+    while (left){
+      size_t want = (size_t)std::min<uint64_t>(left, buf.size());
+      if (!f.read(&buf[0], (std::streamsize)want)) break;
+      left -= want;
+      carry.append(buf.data(), want);
+
+      size_t pos = 0;
+      while (true){
+        size_t nl = carry.find('\n', pos);
+        if (nl == std::string::npos) break;
+        uint64_t line_off = off + pos;
+        size_t len = nl - pos;
+        if (len && carry[pos+len-1] == '\r') len--;
+        Sample s{};
+        if (len && parse_csv_fast(carry.data() + pos, len, s)){
+          if (!entries_.empty() && line_off == entries_.back().off){
+            lines_since_ = 0; // эта строка уже в индексе (продолжаем после рестарта)
+          } else if (entries_.empty() || lines_since_ + 1 >= every_lines_ ||
+                     (int64_t)s.tt - entries_.back().ts >= every_sec_){
+            Entry e{(int64_t)s.tt, line_off, ord_};
+            entries_.push_back(e);
+            added.push_back(e);
+            lines_since_ = 0;
+          } else {
+            lines_since_++;
+          }
+          ord_++;
+          late = late || (int64_t)s.tt < last_ts_;
+          last_ts_ = (int64_t)s.tt;
+        }
+        pos = nl + 1;
+      }
+      off += pos;
+      carry.erase(0, pos);
+    }
+    covered_ = off; // недописанная последняя строка будет разобрана в следующий раз
+    if (late && epoch_) (*epoch_)++;
+
+    if (!added.empty()){
+      std::ofstream w(idx_, std::ios::binary | std::ios::app);
+      w.write((const char*)added.data(), (std::streamsize)(added.size()*sizeof(Entry)));
+    }
+  }
+
+  void rewrite_locked(){
+    std::ofstream w(idx_, std::ios::binary | std::ios::trunc);
+    w.write(IDX_MAGIC, sizeof(IDX_MAGIC));
+    if (!entries_.empty()) w.write((const char*)entries_.data(), (std::streamsize)(entries_.size()*sizeof(Entry)));
+  }
+
+  mutable std::mutex m_;
+  std::filesystem::path csv_, idx_;
+  std::vector<Entry> entries_;
+  uint64_t covered_ = 0;     // сколько байт CSV уже разобрано (всегда граница строки)
+  uint64_t ord_ = 0;         // сколько измерений в разобранной части
+  size_t lines_since_ = 0;   // строк после последней записи индекса
+  int64_t last_ts_ = std::numeric_limits<int64_t>::min();
+  size_t every_lines_ = 1024;
+  int every_sec_ = 60;
+  std::atomic<uint64_t>* epoch_ = nullptr;
+};
+
+// Простая статистика по диапазону
+struct Stats {
+  size_t count=0;
+  double sum=0.0;
+  double minv= std::numeric_limits<double>::infinity();
+  double maxv=-std::numeric_limits<double>::infinity();
+  void add(double x){
+    count++; sum+=x;
+    if (x<minv) minv=x;
+    if (x>maxv) maxv=x;
+  }
+  void merge(const Stats& o){
+    count+=o.count; sum+=o.sum;
+    if (o.minv<minv) minv=o.minv;
+    if (o.maxv>maxv) maxv=o.maxv;
+  }
+  double avg() const { return count? (sum/double(count)) : std::numeric_limits<double>::quiet_NaN(); }
+};
+
+// Точки графика; в обработчике запроса память берется из арены запроса
+using SampleVec = std::pmr::vector<Sample>;
+
+// Долгоживущий писатель CSV: держит открытый дескриптор (O_APPEND), форматирует строки
+// в переиспользуемый буфер и сбрасывает его write()+fdatasync() раз в flush_every строк
+// или раз в flush_ms мс (что наступит раньше). Потокобезопасен.
+// framed: строки с CRC32C (csv_frame) и метка "#ckpt,<смещение>" в начале сброса раз в
+// CKPT_BYTES байт - все до метки уже сброшено (и fdatasync) и проверено, при старте
+// проверяется только хвост после последней метки (verify_framed_tail). Метка ставится только
+// после сброса без ошибок; после неудачного write оборванная строка отрезается (ftruncate),
+// а если не вышло - следующий сброс закрывает ее заведомо неверной суммой и '\n'
+class CsvAppender {
+public:
+  static const uint64_t CKPT_BYTES = 1 << 20;
+
+  ~CsvAppender(){ close(); }
+
+  void configure(size_t flush_every, int flush_ms, bool sync, bool framed){
+    std::lock_guard<std::mutex> lk(m_);
+    flush_every_ = flush_every ? flush_every : 1;
+    flush_ms_ = flush_ms;
+    sync_ = sync;
+    framed_ = framed;
+  }
+
+  bool open(const std::filesystem::path& file){
+    std::lock_guard<std::mutex> lk(m_);
+#ifdef _WIN32
+    fd_ = _wopen(file.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    fd_ = ::open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+#endif
+    buf_.reserve(64*1024);
+    if (fd_ < 0) return false;
+    // файл при открытии уже проверен: первая же запись ставит метку на его конец
+#ifdef _WIN32
+    size_ = (uint64_t)std::max<__int64>(0, _lseeki64(fd_, 0, SEEK_END));
+#else
+    size_ = (uint64_t)std::max<off_t>(0, ::lseek(fd_, 0, SEEK_END));
+#endif
+    ckpt_at_ = 0;
+    ckpt_open_ = size_ > 0;
+    ckpt_ok_ = true;
+    torn_ = false;
+    return true;
+  }
+
+  void close(){
+    std::lock_guard<std::mutex> lk(m_);
+    if (fd_ < 0) return;
+    flush_locked();
+#ifdef _WIN32
+    _close(fd_);
+#else
+    ::close(fd_);
+#endif
+    fd_ = -1;
+  }
+
+  // Добавить строку; true - если буфер был сброшен в файл (можно догонять индекс)
+  bool append(time_t tt, double temp){
+    std::lock_guard<std::mutex> lk(m_);
+    if (fd_ < 0) return false;
+    char line[80];
+    size_t n = format_line(line, tt, temp);
+    if (!n) return false;
+    if (buf_.empty()) first_pending_ = std::chrono::steady_clock::now();
+    buf_.append(line, n);
+    pending_++;
+    samples_++;
+    if (pending_ >= flush_every_ || due_locked()) return flush_locked();
+    return false;
+  }
+
+  // Пачка строк одним вызовом (прием потока): буфер сбрасывается один раз в конце,
+  // если набралось flush_every строк или истек flush_ms
+  bool append_batch(const Sample* s, size_t n){
+    std::lock_guard<std::mutex> lk(m_);
+    if (fd_ < 0 || !n) return false;
+    if (buf_.empty()) first_pending_ = std::chrono::steady_clock::now();
+    char line[80];
+    for (size_t i=0;i<n;i++){
+      size_t k = format_line(line, s[i].tt, s[i].temp);
+      if (!k) continue;
+      buf_.append(line, k);
+      pending_++;
+      samples_++;
+    }
+    if (pending_ >= flush_every_ || due_locked()) return flush_locked();
+    return false;
+  }
+
+  // Сбросить буфер, если истек flush_ms (вызывать периодически)
+  bool flush_if_due(){
+    std::lock_guard<std::mutex> lk(m_);
+    return due_locked() && flush_locked();
+  }
+
+  bool flush(){
+    std::lock_guard<std::mutex> lk(m_);
+    return flush_locked();
+  }
+
+  std::string stats_json() const {
+    std::lock_guard<std::mutex> lk(m_);
+    std::ostringstream os;
+    os<<"{\"samples\":"<<samples_<<",\"pending\":"<<pending_<<",\"bytes\":"<<bytes_
+      <<",\"flushes\":"<<flushes_<<",\"errors\":"<<errors_
+      <<",\"flush_every\":"<<flush_every_<<",\"flush_ms\":"<<flush_ms_<<",\"fsync\":"<<(sync_ ? "true" : "false")
+      <<",\"write_avg_us\":"<<(flushes_ ? write_total_us_/flushes_ : 0)<<",\"write_max_us\":"<<write_max_us_
+      <<",\"sync_avg_us\":"<<(flushes_ ? sync_total_us_/flushes_ : 0)<<",\"sync_max_us\":"<<sync_max_us_
+      <<",\"framed\":"<<(framed_ ? "true" : "false")<<",\"checkpoints\":"<<ckpts_<<"}";
+    return os.str();
+  }
+
+private:
+  // "ISOZ,temp\n" (с суммой в режиме framed); 0 - не вышло. line - не меньше 80 байт
+  size_t format_line(char* line, time_t tt, double temp) const {
+    format_iso_utc(tt, line);
+    int n = std::snprintf(line + 20, 44, ",%.3f\n", temp);
+    if (n <= 0 || n >= 44) return 0;
+    size_t len = 20 + (size_t)n;
+    if (!framed_) return len;
+    len = csv_frame(line, len - 1);
+    line[len] = '\n';
+    return len + 1;
+  }
+
+  bool due_locked() const {
+    return !buf_.empty() && flush_ms_ >= 0 &&
+           std::chrono::steady_clock::now() - first_pending_ >= std::chrono::milliseconds(flush_ms_);
+  }
+
+  bool flush_locked(){
+    if (buf_.empty() || fd_ < 0) return false;
+    if (torn_){
+      // оборванная строка прошлого сброса: сумма с одним неверным битом - разбор ее отбросит
+      char end[CSV_FRAME_SUFFIX + 1];
+      end[0] = '*';
+      uint32_t c = torn_crc_ ^ 1;
+      for (int i=0;i<8;i++) end[1 + i] = "0123456789abcdef"[(c >> (28 - 4*i)) & 0xf];
+      end[CSV_FRAME_SUFFIX] = '\n';
+      buf_.insert(0, end, sizeof(end));
+      torn_ = false;
+    }
+    // метка - только если прошлый сброс целиком записан и синхронизирован
+    if (framed_ && ckpt_ok_ && (ckpt_open_ || size_ - ckpt_at_ >= CKPT_BYTES)){
+      // метка в начале записи: предыдущий сброс уже на диске
+      char mark[64];
+      int n = std::snprintf(mark, 40, "#ckpt,%llu", (unsigned long long)size_);
+      size_t len = csv_frame(mark, (size_t)n);
+      mark[len++] = '\n';
+      buf_.insert(0, mark, len);
+      ckpt_at_ = size_;
+      ckpt_open_ = false;
+      ckpts_++;
+    }
+    using clk = std::chrono::steady_clock;
+    auto t0 = clk::now();
+    const char* p = buf_.data();
+    size_t left = buf_.size();
+    while (left > 0){
+#ifdef _WIN32
+      int n = _write(fd_, p, (unsigned)left);
+#else
+      ssize_t n = ::write(fd_, p, left);
+      if (n < 0 && errno == EINTR) continue;
+#endif
+      if (n <= 0){ errors_++; break; }
+      p += n; left -= (size_t)n;
+    }
+    bool ok = left == 0;
+    auto t1 = clk::now();
+    if (sync_){
+#ifdef _WIN32
+      if (_commit(fd_) != 0){ errors_++; ok = false; }
+#elif defined(__APPLE__)
+      if (::fsync(fd_) != 0){ errors_++; ok = false; }
+#else
+      if (::fdatasync(fd_) != 0){ errors_++; ok = false; }
+#endif
+    }
+    auto t2 = clk::now();
+    if (left){
+      // записана часть буфера: отрезаем недописанную строку по последнему '\n'
+      size_t done = buf_.size() - left, keep = buf_.rfind('\n', done ? done - 1 : 0);
+      keep = (keep == std::string::npos || keep >= done) ? 0 : keep + 1;
+      left = buf_.size() - keep;
+#ifdef _WIN32
+      torn_ = keep < done && _chsize_s(fd_, (__int64)(size_ + keep)) != 0;
+#else
+      torn_ = keep < done && ::ftruncate(fd_, (off_t)(size_ + keep)) != 0;
+#endif
+      if (torn_) torn_crc_ = crc32c(buf_.data() + keep, done - keep);
+    }
+    if (!ok){
+      ckpt_ok_ = false;     // до следующего удачного сброса меток нет
+      ckpt_open_ = true;    // а после него - сразу
+    } else {
+      ckpt_ok_ = true;
+    }
+
+    uint64_t wus = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+    uint64_t sus = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+    write_total_us_ += wus; write_max_us_ = std::max(write_max_us_, wus);
+    sync_total_us_ += sus;  sync_max_us_ = std::max(sync_max_us_, sus);
+    bytes_ += buf_.size() - left;
+    size_ += buf_.size() - left;
+    if (!ok){
+      // размер берем у файла: после ошибок счет байт мог разойтись с ним
+#ifdef _WIN32
+      __int64 end = _lseeki64(fd_, 0, SEEK_END);
+#else
+      off_t end = ::lseek(fd_, 0, SEEK_END);
+#endif
+      if (end >= 0) size_ = (uint64_t)end;
+    }
+    flushes_++;
+    buf_.clear(); // capacity остается
+    pending_ = 0;
+    return true;
+  }
+
+  mutable std::mutex m_;
+  int fd_ = -1;
+  std::string buf_;
+  size_t flush_every_ = 1;
+  int flush_ms_ = 1000;        // <0 - только по числу строк
+  bool sync_ = true;
+  bool framed_ = false;
+  uint64_t size_ = 0;          // размер файла
+  uint64_t ckpt_at_ = 0;       // где последняя метка
+  bool ckpt_open_ = false;     // метка на конец файла, открытого не пустым (или после ошибки)
+  bool ckpt_ok_ = true;        // прошлый сброс без ошибок: можно ставить метку
+  bool torn_ = false;          // в конце файла осталась оборванная строка
+  uint32_t torn_crc_ = 0;      // ее CRC32C
+  uint64_t ckpts_ = 0;
+  size_t pending_ = 0;
+  std::chrono::steady_clock::time_point first_pending_{};
+  uint64_t samples_ = 0, bytes_ = 0, flushes_ = 0, errors_ = 0;
+  uint64_t write_total_us_ = 0, write_max_us_ = 0, sync_total_us_ = 0, sync_max_us_ = 0;
+};
+
+// Итоги сегмента (measurements-*.csv.sum): считаются один раз, когда сегмент закрыт.
+// csv_size - размер CSV, по которому посчитано: если файл изменился, итоги пересчитываются
+struct SegmentSummary {
+  uint64_t csv_size = 0;
+  Stats st;
+  int64_t first = 0, last = 0;   // время первого и последнего измерения
+};
+
+static bool load_summary(const std::filesystem::path& file, SegmentSummary& out){
+  std::ifstream f(file);
+  uint64_t count = 0;
+  if (!(f >> out.csv_size >> count >> out.st.sum >> out.st.minv >> out.st.maxv >> out.first >> out.last)) return false;
+  if (!count) out.st = Stats{};   // пустой сегмент: min/max записаны нулями
+  out.st.count = (size_t)count;
+  return true;
+}
+
+// У пустого сегмента min/max - бесконечности, которые operator>> не читает: пишем нули
+static void save_summary(const std::filesystem::path& file, const SegmentSummary& s){
+  std::ofstream f(file, std::ios::trunc);
+  bool empty = !s.st.count;
+  f<<s.csv_size<<" "<<s.st.count<<" "<<std::setprecision(17)<<s.st.sum<<" "<<(empty ? 0.0 : s.st.minv)
+   <<" "<<(empty ? 0.0 : s.st.maxv)<<" "<<s.first<<" "<<s.last<<"\n";
+}
+
+// Полный проход по CSV (только полные строки, как и в индексе)
+static bool summarize_csv(const std::filesystem::path& csv, SegmentSummary& out){
+  MappedFile mf;
+  if (!mf.open(csv)) return false;
+  out = SegmentSummary{};
+  out.csv_size = mf.size();
+  const char* d = mf.data();
+  size_t n = mf.size(), p = 0, next = 0;
+  while (p < n){
+    Sample s{};
+    bool ok = parse_line_at(d, n, p, s, next);
+    if (next <= p) break;
+    p = next;
+    if (!ok) continue;
+    if (!out.st.count) out.first = (int64_t)s.tt;
+    out.last = (int64_t)s.tt;
+    out.st.add(s.temp);
+  }
+  return true;
+}
+
+// Пирамида агрегатов сегмента: рядом с ним файлы measurements-*.1m и measurements-*.1h
+// (по имени без расширения, поэтому переживают сжатие в TBIN) с записью на каждую минуту
+// и час, где были измерения: начало интервала, count, sum, min, max, первое и последнее
+// значение. Файл - "TPYR0001", ширина интервала (int64), записи PyrRec. Законченные
+// интервалы дописываются в файл по мере чтения CSV (как индекс: catch_up_csv читает только
+// новый хвост), текущий держится в памяти. Длинный диапазон /api/stats считается по
+// интервалам, а не по каждому измерению.
+struct PyrRec {
+  int64_t t = 0;                 // начало интервала
+  uint32_t count = 0, reserved = 0;
+  double sum = 0, mn = 0, mx = 0, first = 0, last = 0;
+};
+static_assert(sizeof(PyrRec) == 56, "PyrRec layout");
+
+static const char PYR_MAGIC[8] = {'T','P','Y','R','0','0','0','1'};
+
+class Pyramid {
+public:
+  static const size_t LEVELS = 2;
+  static int64_t width(size_t L){ return L == 0 ? 60 : 3600; }
+
+  static std::filesystem::path level_path(const std::filesystem::path& seg, size_t L){
+    std::filesystem::path p = seg;
+    p.replace_extension(L == 0 ? ".1m" : ".1h");
+    return p;
+  }
+
+  static void remove_files(const std::filesystem::path& seg){
+    std::error_code ec;
+    for (size_t L=0;L<LEVELS;L++) std::filesystem::remove(level_path(seg, L), ec);
+  }
+
+  // Готовые файлы закрытого сегмента; false - их нет, они повреждены или в них не count измерений
+  bool load(const std::filesystem::path& seg, uint64_t count){
+    std::lock_guard<std::mutex> lk(m_);
+    if (!load_locked(seg, count)){
+      clear_locked(seg);
+      return false;
+    }
+    ready_ = closed_ = true;
+    return true;
+  }
+
+  // Активный CSV после рестарта: записанные интервалы берутся до конца последнего часа в
+  // файле .1h (минутные после него отбрасываются), CSV дочитывается с первой строки после него.
+  // false - файлов нет или они повреждены (тогда reset и полный проход)
+  bool resume(const std::filesystem::path& seg){
+    std::lock_guard<std::mutex> lk(m_);
+    if (!load_locked(seg, UINT64_MAX) || recs_[1].empty()){
+      clear_locked(seg);
+      return false;
+    }
+    int64_t until = recs_[1].back().t + width(1);
+    auto& mins = recs_[0];
+    mins.erase(std::lower_bound(mins.begin(), mins.end(), until, [](const PyrRec& r, int64_t t){ return r.t < t; }), mins.end());
+    MappedFile mf;
+    if (!mf.open(seg)){
+      clear_locked(seg);
+      return false;
+    }
+    covered_ = lower_bound_offset(mf.data(), mf.size(), (time_t)until);
+    std::ofstream f(level_path(seg, 0), std::ios::binary | std::ios::trunc);
+    int64_t w = width(0);
+    f.write(PYR_MAGIC, 8);
+    f.write((const char*)&w, 8);
+    f.write((const char*)mins.data(), (std::streamsize)(mins.size() * sizeof(PyrRec)));
+    ready_ = true;
+    return true;
+  }
+
+  // Начать заново: файлы перезаписываются заголовками, измерения - через add или catch_up_csv
+  void reset(const std::filesystem::path& seg){
+    std::lock_guard<std::mutex> lk(m_);
+    reset_locked(seg);
+  }
+
+  // Измерение (по возрастанию времени); законченные интервалы попадут в файл при
+  // следующем catch_up_csv или finish
+  void add(int64_t ts, double v){
+    std::lock_guard<std::mutex> lk(m_);
+    add_locked(ts, v);
+  }
+
+  // Дочитать новые полные строки CSV (активный сегмент, в том числе внешнего писателя)
+  void catch_up_csv(){
+    std::lock_guard<std::mutex> lk(m_);
+    if (!ready_ || bad_ || closed_) return;
+    std::error_code ec;
+    uint64_t sz = std::filesystem::file_size(seg_, ec);
+    if (ec) return;
+    if (sz < covered_) reset_locked(seg_);   // CSV обрезали или подменили
+    if (sz == covered_) return;
+    MappedFile mf;
+    if (!mf.open(seg_)) return;
+    const char* d = mf.data();
+    size_t n = mf.size(), p = (size_t)covered_, next = p;
+    while (p < n){
+      Sample s{};
+      bool ok = parse_line_at(d, n, p, s, next);
+      if (next <= p || next > n || d[next-1] != '\n') break;
+      p = next;
+      if (ok) add_locked((int64_t)s.tt, s.temp);
+    }
+    covered_ = p;
+    flush_locked();
+  }
+
+  // Сегмент закрыт: текущие интервалы тоже в файл
+  void finish(){
+    std::lock_guard<std::mutex> lk(m_);
+    if (!ready_ || bad_) return;
+    for (size_t L=0;L<LEVELS;L++){
+      if (!open_[L].count) continue;
+      recs_[L].push_back(open_[L]);
+      pending_[L].push_back(open_[L]);
+      open_[L] = PyrRec{};
+    }
+    flush_locked();
+    closed_ = true;
+  }
+
+  // Сегмент изменен не дописыванием: до перестройки по нему считаем измерения
+  void invalidate(){
+    std::lock_guard<std::mutex> lk(m_);
+    bad_ = true;
+  }
+
+  bool usable() const {
+    std::lock_guard<std::mutex> lk(m_);
+    return ready_ && !bad_;
+  }
+
+  // Записи уровня L с началом в [lo, hi), включая текущий интервал
+  template <class Vec>
+  void collect(size_t L, int64_t lo, int64_t hi, Vec& out) const {
+    std::lock_guard<std::mutex> lk(m_);
+    const auto& v = recs_[L];
+    auto it = std::lower_bound(v.begin(), v.end(), lo, [](const PyrRec& r, int64_t t){ return r.t < t; });
+    for (; it != v.end() && it->t < hi; ++it) out.push_back(*it);
+    if (open_[L].count && open_[L].t >= lo && open_[L].t < hi) out.push_back(open_[L]);
+  }
+
+private:
+  // Записи обоих уровней из файлов; count - сколько в них должно быть измерений
+  // (UINT64_MAX - не проверять)
+  bool load_locked(const std::filesystem::path& seg, uint64_t count){
+    clear_locked(seg);
+    for (size_t L=0;L<LEVELS;L++){
+      std::ifstream f(level_path(seg, L), std::ios::binary);
+      char magic[8] = {};
+      int64_t w = 0;
+      if (!f.read(magic, 8) || std::memcmp(magic, PYR_MAGIC, 8) != 0 || !f.read((char*)&w, 8) || w != width(L)) return false;
+      PyrRec r;
+      uint64_t n = 0;
+      while (f.read((char*)&r, sizeof(r))){
+        if (!recs_[L].empty() && r.t <= recs_[L].back().t) return false;
+        recs_[L].push_back(r);
+        n += r.count;
+      }
+      if (f.gcount() != 0) return false;   // обрывок записи
+      if (count != UINT64_MAX && n != count) return false;
+    }
+    return true;
+  }
+
+  void clear_locked(const std::filesystem::path& seg){
+    seg_ = seg;
+    for (size_t L=0;L<LEVELS;L++){
+      recs_[L].clear();
+      pending_[L].clear();
+      open_[L] = PyrRec{};
+    }
+    covered_ = 0;
+    ready_ = bad_ = closed_ = false;
+  }
+
+  void reset_locked(const std::filesystem::path& seg){
+    clear_locked(seg);
+    for (size_t L=0;L<LEVELS;L++){
+      std::ofstream f(level_path(seg, L), std::ios::binary | std::ios::trunc);
+      int64_t w = width(L);
+      f.write(PYR_MAGIC, 8);
+      f.write((const char*)&w, 8);
+    }
+    ready_ = true;
+  }
+
+  void add_locked(int64_t ts, double v){
+    if (!ready_ || bad_) return;
+    for (size_t L=0;L<LEVELS;L++){
+      int64_t w = width(L), t = ts / w * w;
+      if (t > ts) t -= w;   // до 1970 - вниз
+      PyrRec& o = open_[L];
+      if (o.count && t != o.t){
+        if (t < o.t){ bad_ = true; return; }   // время пошло назад: интервал уже записан
+        recs_[L].push_back(o);
+        pending_[L].push_back(o);
+        o = PyrRec{};
+      }
+      if (!o.count){ o.t = t; o.mn = o.mx = o.first = v; }
+      o.count++;
+      o.sum += v;
+      o.mn = std::min(o.mn, v);
+      o.mx = std::max(o.mx, v);
+      o.last = v;
+    }
+  }
+
+  void flush_locked(){
+    for (size_t L=0;L<LEVELS;L++){
+      if (pending_[L].empty()) continue;
+      std::ofstream f(level_path(seg_, L), std::ios::binary | std::ios::app);
+      f.write((const char*)pending_[L].data(), (std::streamsize)(pending_[L].size() * sizeof(PyrRec)));
+      pending_[L].clear();
+    }
+  }
+
+  mutable std::mutex m_;
+  std::filesystem::path seg_;
+  std::vector<PyrRec> recs_[LEVELS];     // законченные интервалы
+  std::vector<PyrRec> pending_[LEVELS];  // законченные, но еще не в файле
+  PyrRec open_[LEVELS];                  // текущие
+  uint64_t covered_ = 0;                 // сколько байт CSV разобрано
+  bool ready_ = false;                   // файлы загружены или строятся
+  bool bad_ = false;                     // время шло назад или сегмент изменен
+  bool closed_ = false;                  // сегмент закрыт, дописываний не будет
+};
+
+// Колоночный кэш ряда в памяти: время (int64) и температура в тысячных долях градуса
+// (int32) в двух непрерывных массивах. Держит самый новый суффикс истории не больше
+// cap_bytes: запрос с from >= covered_from() отвечается из памяти бинарным поиском и
+// простыми циклами по массивам (компилятор их векторизует). Файл дочитывается с хвоста
+// (tail), поэтому видны и строки внешнего писателя. Если данные не укладываются в кэш
+// точно (больше 3 знаков после запятой, время идет назад) - кэш выключается.
+// count/sum/min/max по диапазону считаются по многоуровневым блокам (AGG_FAN измерений,
+// AGG_FAN блоков и т.д.): O(AGG_FAN * уровней) вместо прохода по всем измерениям.
+// Блок уровня появляется, когда он заполнен, так что добавление - амортизированно O(1).
+class SeriesCache {
+public:
+  void configure(size_t cap_bytes){
+    std::unique_lock<std::shared_mutex> lk(m_);
+    cap_ = cap_bytes / (sizeof(int64_t) + sizeof(int32_t));
+    enabled_ = cap_ > 0;
+  }
+
+  // Загрузка файлов по порядку (старые -> новые); читается только то, что влезет в cap.
+  // Сегменты TBIN декодируются целиком (их не дописывают)
+  void load(const std::vector<std::filesystem::path>& files){
+    std::unique_lock<std::shared_mutex> lk(m_);
+    if (!enabled_) return;
+    ts_.clear(); milli_.clear();
+    base_ = 0;
+    levels_.clear();
+    covered_from_ = std::numeric_limits<int64_t>::min();
+    tail_file_.clear();
+    tail_off_ = tail_seen_ = 0;
+
+    // с конца набираем файлы, пока оценка (28 байт на строку) не превысит cap;
+    // для TBIN - 28 байт на измерение из каталога
+    auto est_size = [](const std::filesystem::path& f) -> uint64_t {
+      if (f.extension() == ".tbin"){
+        MappedFile mf;
+        TbinReader r;
+        return mf.open(f) && r.open(mf.data(), mf.size()) ? r.count() * 28 : 0;
+      }
+      std::error_code ec;
+      uint64_t sz = std::filesystem::file_size(f, ec);
+      return ec ? 0 : sz;
+    };
+    uint64_t budget = (uint64_t)cap_ * 28;
+    size_t first = files.size();
+    uint64_t start_off = 0;
+    while (first > 0){
+      uint64_t sz = est_size(files[first-1]);
+      first--;
+      if (sz >= budget){ start_off = sz - budget; break; }
+      budget -= sz;
+    }
+    bool partial = first > 0 || start_off > 0;
+
+    for (size_t i=first;i<files.size() && enabled_;i++){
+      MappedFile mf;
+      if (!mf.open(files[i])) continue;
+      uint64_t skip = (i == first) ? start_off : 0;
+      size_t end = mf.size();
+      if (files[i].extension() == ".tbin"){
+        TbinReader r;
+        if (r.open(mf.data(), mf.size())) append_tbin_locked(r, skip / 28);
+      } else {
+        end = append_locked(mf.data(), mf.size(), line_start_at_or_after(mf.data(), mf.size(), (size_t)skip));
+      }
+      tail_file_ = files[i];
+      tail_off_ = end;
+      tail_seen_ = mf.size();
+    }
+    trim_locked(partial);
+  }
+
+  // Дочитать новые полные строки file; другой файл - значит сегмент сменился, читаем с начала
+  void tail(const std::filesystem::path& file){
+    std::error_code ec;
+    uint64_t sz = std::filesystem::file_size(file, ec);
+    {
+      // частый случай (вызов из каждого запроса): файл не вырос - хватает общей блокировки,
+      // и параллельные запросы не ждут друг друга. Размер сравниваем и с прочитанным в прошлый
+      // раз: хвост без '\n' (строку еще дописывают) не дочитан, но и повторно читать нечего
+      std::shared_lock<std::shared_mutex> lk(m_);
+      if (!enabled_ || (file == tail_file_ && (ec || sz == tail_off_ || sz == tail_seen_))) return;
+    }
+    std::unique_lock<std::shared_mutex> lk(m_);
+    if (!enabled_) return;
+    if (file != tail_file_){ tail_file_ = file; tail_off_ = tail_seen_ = 0; }
+    sz = std::filesystem::file_size(file, ec);   // заново: другой поток мог уже дочитать
+    if (ec || sz <= tail_off_ || sz == tail_seen_){
+      if (!ec && sz < tail_off_) disable_locked("file shrank: " + file.string());
+      return;
+    }
+    MappedFile mf;
+    if (!mf.open(file)) return;
+    tail_off_ = append_locked(mf.data(), mf.size(), (size_t)tail_off_);
+    tail_seen_ = mf.size();
+    trim_locked(false);
+  }
+
+  std::filesystem::path tail_file() const {
+    std::shared_lock<std::shared_mutex> lk(m_);
+    return tail_file_;
+  }
+
+  void invalidate(const std::string& why){
+    std::unique_lock<std::shared_mutex> lk(m_);
+    if (enabled_) disable_locked(why);
+  }
+
+  // Выбросить измерения старше ts (сегменты удалены по сроку хранения)
+  void trim_before(int64_t ts){
+    std::unique_lock<std::shared_mutex> lk(m_);
+    size_t k = (size_t)(std::lower_bound(ts_.begin(), ts_.end(), ts) - ts_.begin());
+    drop_front_locked(k);
+  }
+
+  // Ответ из памяти; false - диапазон не покрыт кэшем (идем на диск)
+  bool query(time_t from, time_t to, Stats& st, SampleVec& out, size_t max_points) const {
+    std::shared_lock<std::shared_mutex> lk(m_);
+    if (!enabled_ || ready_ == false || (int64_t)from < covered_from_){ misses_++; return false; }
+    hits_++;
+    size_t lo = (size_t)(std::lower_bound(ts_.begin(), ts_.end(), (int64_t)from) - ts_.begin());
+    size_t hi = (size_t)(std::upper_bound(ts_.begin() + (std::ptrdiff_t)lo, ts_.end(), (int64_t)to) - ts_.begin());
+    if (lo >= hi) return true;
+
+    Agg a = agg_range_locked(base_ + lo, base_ + hi);
+    Stats part;
+    part.count = hi - lo;
+    part.sum = (double)a.sum / 1000.0;
+    part.minv = a.mn / 1000.0;
+    part.maxv = a.mx / 1000.0;
+    st.merge(part);
+
+    const int32_t* v = milli_.data();
+    size_t step = (part.count > max_points) ? (part.count + max_points - 1) / max_points : 1;
+    out.reserve(out.size() + (part.count + step - 1) / step);
+    for (size_t i=lo;i<hi;i+=step) out.push_back(Sample{(time_t)ts_[i], v[i] / 1000.0});
+    return true;
+  }
+
+  void set_ready(){
+    std::unique_lock<std::shared_mutex> lk(m_);
+    ready_ = true;
+  }
+
+  std::string stats_json() const {
+    std::shared_lock<std::shared_mutex> lk(m_);
+    std::ostringstream os;
+    os<<"{\"enabled\":"<<(enabled_ ? "true" : "false")<<",\"ready\":"<<(ready_ ? "true" : "false")
+      <<",\"samples\":"<<ts_.size()<<",\"cap_samples\":"<<cap_
+      <<",\"bytes\":"<<(ts_.capacity()*sizeof(int64_t) + milli_.capacity()*sizeof(int32_t))
+      <<",\"covered_from\":";
+    if (covered_from_ == std::numeric_limits<int64_t>::min()) os<<"null";
+    else os<<"\""<<iso_utc_from((time_t)covered_from_)<<"\"";
+    os<<",\"hits\":"<<hits_.load()<<",\"misses\":"<<misses_.load()<<"}";
+    return os.str();
+  }
+
+private:
+  // Разбор полных строк [off, n); возвращает смещение после последней полной строки
+  size_t append_locked(const char* d, size_t n, size_t off){
+    size_t p = off, next = off;
+    while (p < n){
+      Sample s{};
+      bool ok = parse_line_at(d, n, p, s, next);
+      if (next <= p || next > n || d[next-1] != '\n') break;
+      p = next;
+      if (!ok) continue;
+      double m = std::round(s.temp * 1000.0);
+      if (std::fabs(s.temp * 1000.0 - m) > 1e-6 || std::fabs(m) > 2e9){
+        disable_locked("value does not fit milli-degrees: " + std::to_string(s.temp));
+        return p;
+      }
+      if (!push_locked((int64_t)s.tt, (int32_t)m)) return p;
+    }
+    return p;
+  }
+
+  // Измерения TBIN, начиная с skip-го
+  void append_tbin_locked(const TbinReader& r, uint64_t skip){
+    if (skip >= r.count()) return;
+    for (size_t b = r.block_of(skip); b < r.blocks() && enabled_; b++){
+      uint64_t k = r.block_start(b);
+      r.decode(b, [&](int64_t ts, int32_t m){ if (k++ >= skip && enabled_) push_locked(ts, m); });
+    }
+  }
+
+  // Измерение в конец массивов; false - время пошло назад (кэш выключен)
+  bool push_locked(int64_t ts, int32_t m){
+    if (!ts_.empty() && ts < ts_.back()){
+      disable_locked("timestamps go backwards");
+      return false;
+    }
+    if (ts_.size() >= cap_) trim_locked(false);
+    if (ts_.size() == ts_.capacity()){
+      // растем не дальше потолка, чтобы capacity не ушла за cap_
+      size_t nc = std::min(cap_, std::max<size_t>(4096, ts_.capacity() * 2));
+      ts_.reserve(nc);
+      milli_.reserve(nc);
+    }
+    ts_.push_back(ts);
+    milli_.push_back(m);
+    if ((base_ + ts_.size()) % AGG_FAN == 0) agg_block_done_locked();
+    return true;
+  }
+
+  struct Agg {
+    int64_t sum = 0;
+    int32_t mn = std::numeric_limits<int32_t>::max();
+    int32_t mx = std::numeric_limits<int32_t>::min();
+    void add(const Agg& o){ sum += o.sum; mn = std::min(mn, o.mn); mx = std::max(mx, o.mx); }
+  };
+  // Уровень L: блоки по AGG_FAN^(L+1) измерений; e[k] - блок с номером first + k
+  struct AggLevel { uint64_t first = 0; std::vector<Agg> e; };
+  static const size_t AGG_FAN = 64;
+
+  // Измерения [a, b) по глобальным номерам (номер ts_[i] = base_ + i)
+  Agg raw_agg_locked(uint64_t a, uint64_t b) const {
+    Agg r;
+    const int32_t* v = milli_.data() + (a - base_);
+    size_t n = (size_t)(b - a);
+    int64_t sum = 0;
+    int32_t mn = r.mn, mx = r.mx;
+    for (size_t i=0;i<n;i++){
+      sum += v[i];
+      mn = std::min(mn, v[i]);
+      mx = std::max(mx, v[i]);
+    }
+    r.sum = sum; r.mn = mn; r.mx = mx;
+    return r;
+  }
+
+  // Единицы уровня L (L = -1 - сами измерения) [a, b)
+  Agg scan_level_locked(int L, uint64_t a, uint64_t b) const {
+    if (L < 0) return raw_agg_locked(a, b);
+    Agg r;
+    const AggLevel& lv = levels_[(size_t)L];
+    for (uint64_t k=a;k<b;k++) r.add(lv.e[(size_t)(k - lv.first)]);
+    return r;
+  }
+
+  // Края диапазона - на текущем уровне, середина - готовыми блоками следующего
+  Agg agg_level_locked(int L, uint64_t a, uint64_t b) const {
+    if ((size_t)(L + 1) < levels_.size()){
+      const AggLevel& up = levels_[(size_t)(L + 1)];
+      uint64_t ja = std::max<uint64_t>((a + AGG_FAN - 1) / AGG_FAN, up.first);
+      uint64_t jb = std::min<uint64_t>(b / AGG_FAN, up.first + up.e.size());
+      if (ja < jb){
+        Agg r = scan_level_locked(L, a, ja * AGG_FAN);
+        r.add(agg_level_locked(L + 1, ja, jb));
+        r.add(scan_level_locked(L, jb * AGG_FAN, b));
+        return r;
+      }
+    }
+    return scan_level_locked(L, a, b);
+  }
+
+  Agg agg_range_locked(uint64_t a, uint64_t b) const { return agg_level_locked(-1, a, b); }
+
+  // Заполнился блок из AGG_FAN последних измерений: добавить его на уровень 0
+  void agg_block_done_locked(){
+    uint64_t n = base_ + ts_.size();
+    if (n - AGG_FAN < base_) return;   // начало блока уже срезано
+    agg_push_locked(0, n / AGG_FAN - 1, raw_agg_locked(n - AGG_FAN, n));
+  }
+
+  void agg_push_locked(size_t L, uint64_t idx, const Agg& a){
+    if (levels_.size() <= L) levels_.push_back(AggLevel{});
+    AggLevel& lv = levels_[L];
+    if (lv.e.empty()) lv.first = idx;
+    lv.e.push_back(a);
+    if ((idx + 1) % AGG_FAN || idx + 1 - AGG_FAN < lv.first) return;
+    Agg up;
+    for (size_t k = lv.e.size() - AGG_FAN; k < lv.e.size(); k++) up.add(lv.e[k]);
+    agg_push_locked(L + 1, (idx + 1) / AGG_FAN - 1, up);
+  }
+
+  // Срезать k самых старых измерений и блоки, в которые они входили
+  void drop_front_locked(size_t k){
+    ts_.erase(ts_.begin(), ts_.begin() + (std::ptrdiff_t)k);
+    milli_.erase(milli_.begin(), milli_.begin() + (std::ptrdiff_t)k);
+    base_ += k;
+    uint64_t unit = AGG_FAN;
+    for (auto& lv : levels_){
+      uint64_t keep_from = (base_ + unit - 1) / unit;   // первый блок, целиком оставшийся
+      if (keep_from > lv.first){
+        size_t d = (size_t)std::min<uint64_t>(keep_from - lv.first, lv.e.size());
+        lv.e.erase(lv.e.begin(), lv.e.begin() + (std::ptrdiff_t)d);
+        lv.first += d;
+      }
+      unit *= AGG_FAN;
+    }
+  }
+
+  // Держим не больше cap_ измерений: срезаем четверть самых старых за раз.
+  // После среза начало кэша сдвигается за группу одинаковых ts, чтобы
+  // все измерения с ts >= covered_from_ были в памяти.
+  void trim_locked(bool partial){
+    size_t drop = 0;
+    if (ts_.size() >= cap_) drop = ts_.size() - cap_ + cap_ / 4;
+    if (!partial && drop == 0) return;
+    if (drop > ts_.size()) drop = ts_.size();
+    int64_t cut = drop ? ts_[drop-1] : (ts_.empty() ? 0 : ts_.front());
+    while (drop < ts_.size() && ts_[drop] <= cut) drop++;
+    drop_front_locked(drop);
+    covered_from_ = ts_.empty() ? std::numeric_limits<int64_t>::max() : ts_.front();
+  }
+
+  void disable_locked(const std::string& why){
+    log(LogLevel::Warn, "series cache disabled: " + why);
+    enabled_ = false;
+    std::vector<int64_t>().swap(ts_);
+    std::vector<int32_t>().swap(milli_);
+    levels_.clear();
+  }
+
+  mutable std::shared_mutex m_;
+  bool enabled_ = false;
+  bool ready_ = false;           // загрузка закончена
+  size_t cap_ = 0;               // максимум измерений
+  std::vector<int64_t> ts_;
+  std::vector<int32_t> milli_;
+  uint64_t base_ = 0;            // глобальный номер ts_[0] (растет при срезе старых)
+  std::vector<AggLevel> levels_; // блочные агрегаты
+  int64_t covered_from_ = std::numeric_limits<int64_t>::min();
+  std::filesystem::path tail_file_;
+  uint64_t tail_off_ = 0;        // конец последней полной строки tail_file_
+  uint64_t tail_seen_ = 0;       // размер tail_file_ при последнем чтении
+  mutable std::atomic<uint64_t> hits_{0}, misses_{0};
+};
+
+// Сбросить файл (и запись о нем в каталоге) на диск: перед удалением исходного CSV
+static bool sync_file(const std::filesystem::path& p){
+#ifdef _WIN32
+  int fd = _wopen(p.c_str(), _O_RDWR | _O_BINARY);
+  if (fd < 0) return false;
+  bool ok = _commit(fd) == 0;
+  _close(fd);
+  return ok;
+#else
+  int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  bool ok = ::fsync(fd) == 0;
+  ::close(fd);
+  std::filesystem::path dir = p.has_parent_path() ? p.parent_path() : std::filesystem::path(".");
+  int dfd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+  if (dfd >= 0){ ::fsync(dfd); ::close(dfd); }
+  return ok;
+#endif
+}
+
+// Строки [p, end) без разметки --framed: строки '#' (метки) и записи с неверной суммой
+// пропускаются, суффикс "*xxxxxxxx" отрезается. out == nullptr - только длина результата
+static size_t strip_framing(const char* p, const char* end, std::string* out){
+  size_t n = 0;
+  while (p < end){
+    const char* nl = find_newline(p, end);
+    const char* e = nl ? nl : end;
+    size_t len = (size_t)(e - p);
+    if (!len || (p[0] != '#' && csv_frame_check(p, len) >= 0)){
+      if (len >= CSV_FRAME_SUFFIX && p[len - CSV_FRAME_SUFFIX] == '*') len -= CSV_FRAME_SUFFIX;
+      n += len + (nl ? 1 : 0);
+      if (out){
+        out->append(p, len);
+        if (nl) out->push_back('\n');
+      }
+    }
+    p = nl ? nl + 1 : end;
+  }
+  return n;
+}
+
+// Тело ответа /api/raw: куски CSV-сегментов (отдаются из файла как есть, sendfile/splice),
+// измерения TBIN-сегментов, которые печатаются в CSV по ходу отправки поблочно, и куски CSV
+// --framed, из которых по ходу отправки убирается разметка. Размер известен заранее (для TBIN
+// и --framed - проход по нужным данным при построении), память не зависит от длины диапазона.
+// Файлы открыты до конца отправки: удаление сегмента ей не мешает.
+class RawBody {
+public:
+  // Кусок тела: из файла (fd >= 0, смещение off) или уже в памяти (data)
+  struct Chunk {
+    int fd = -1;
+    uint64_t off = 0;
+    const char* data = nullptr;
+    size_t len = 0;
+  };
+
+  RawBody() = default;
+  RawBody(const RawBody&) = delete;
+  RawBody& operator=(const RawBody&) = delete;
+  ~RawBody(){
+    for (auto& p : parts_){
+      if (p.fd < 0) continue;
+#ifdef _WIN32
+      _close(p.fd);
+#else
+      ::close(p.fd);
+#endif
+    }
+  }
+
+  uint64_t size() const { return total_; }
+
+  // Отпечаток тела для ETag: из чего оно собрано (файлы, их inode и границы, блоки TBIN)
+  // и что добавил вызывающий (эпоха хранилища). Сами байты не читаются
+  uint64_t tag() const { return tag_; }
+  void mix(uint64_t v){
+    for (int i=0;i<8;i++, v >>= 8) tag_ = (tag_ ^ (v & 0xff)) * 0x100000001B3ull;   // FNV-1a
+  }
+
+  // Байты [off, off+len) файла; false - файл не открылся
+  bool add_file(const std::filesystem::path& file, uint64_t off, uint64_t len){
+    if (!len) return true;
+#ifdef _WIN32
+    int fd = _wopen(file.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd < 0) return false;
+    mix('c');
+    for (char c : file.filename().string()) mix((unsigned char)c);
+#ifndef _WIN32
+    struct stat st{};
+    if (::fstat(fd, &st) == 0) mix((uint64_t)st.st_ino);   // файл подменили (переписали, сжали)
+#endif
+    mix(off);
+    mix(len);
+    Part p;
+    p.start = total_;
+    p.len = len;
+    p.fd = fd;
+    p.off = off;
+    parts_.push_back(std::move(p));
+    total_ += len;
+    return true;
+  }
+
+  // Измерения TBIN с ts в [from, to] из блоков [b0, b1); keep держит отображение файла
+  void add_tbin(std::shared_ptr<const void> keep, const TbinReader& r, size_t b0, size_t b1, int64_t from, int64_t to){
+    Part p;
+    p.start = total_;
+    p.keep = std::move(keep);
+    p.rd = &r;
+    p.b0 = b0;
+    p.from = from;
+    p.to = to;
+    p.cum.push_back(0);
+    char line[64];
+    for (size_t b=b0;b<b1;b++){
+      uint64_t n = 0;
+      r.decode(b, [&](int64_t ts, int32_t m){ if (ts >= from && ts <= to) n += tbin_csv_line(line, ts, m); });
+      p.cum.push_back(p.cum.back() + n);
+    }
+    p.len = p.cum.back();
+    if (!p.len) return;
+    mix('t');
+    for (uint64_t v : {(uint64_t)b0, (uint64_t)b1, (uint64_t)from, (uint64_t)to, p.len,
+                       (uint64_t)r.block(b0).first, (uint64_t)r.block(b1 - 1).last}) mix(v);
+    total_ += p.len;
+    parts_.push_back(std::move(p));
+  }
+
+  // Байты [off, off+len) отображения mf (целые строки CSV --framed) без разметки: режутся на
+  // куски около 64 КБ по границам строк, для каждого считается длина после strip_framing
+  void add_framed(const std::filesystem::path& file, std::shared_ptr<const MappedFile> mf, uint64_t off, uint64_t len){
+    const uint64_t CHUNK = 64*1024;
+    const char* d = mf->data();
+    Part p;
+    p.start = total_;
+    p.text = d;
+    p.src.push_back(off);
+    p.cum.push_back(0);
+    for (uint64_t pos = off, end = off + len; pos < end;){
+      uint64_t stop = std::min(end, pos + CHUNK);
+      if (stop < end){
+        const char* nl = find_newline(d + stop - 1, d + end);
+        stop = nl ? (uint64_t)(nl - d) + 1 : end;
+      }
+      p.cum.push_back(p.cum.back() + strip_framing(d + pos, d + stop, nullptr));
+      p.src.push_back(stop);
+      pos = stop;
+    }
+    p.len = p.cum.back();
+    if (!p.len) return;
+    p.keep = std::move(mf);
+    mix('f');
+    for (char c : file.filename().string()) mix((unsigned char)c);
+#ifndef _WIN32
+    struct stat st{};
+    if (::stat(file.c_str(), &st) == 0) mix((uint64_t)st.st_ino);
+#endif
+    mix(off);
+    mix(len);
+    total_ += p.len;
+    parts_.push_back(std::move(p));
+  }
+
+  // Кусок тела с позиции pos < size(): из файла - не длиннее max, из TBIN - остаток блока,
+  // из --framed - остаток куска (печатаются в buf)
+  Chunk chunk(uint64_t pos, size_t max, std::string& buf) const {
+    auto it = std::upper_bound(parts_.begin(), parts_.end(), pos, [](uint64_t v, const Part& p){ return v < p.start; });
+    const Part& p = *(it - 1);
+    uint64_t in = pos - p.start;
+    Chunk c;
+    if (p.fd >= 0){
+      c.fd = p.fd;
+      c.off = p.off + in;
+      c.len = (size_t)std::min<uint64_t>(max, p.len - in);
+      return c;
+    }
+    size_t k = (size_t)(std::upper_bound(p.cum.begin(), p.cum.end(), in) - p.cum.begin()) - 1;
+    buf.clear();
+    if (p.text){
+      strip_framing(p.text + p.src[k], p.text + p.src[k+1], &buf);
+    } else {
+      char line[64];
+      p.rd->decode(p.b0 + k, [&](int64_t ts, int32_t m){ if (ts >= p.from && ts <= p.to) buf.append(line, tbin_csv_line(line, ts, m)); });
+    }
+    size_t skip = (size_t)(in - p.cum[k]);
+    c.data = buf.data() + skip;
+    c.len = buf.size() - skip;
+    return c;
+  }
+
+private:
+  struct Part {
+    uint64_t start = 0, len = 0;   // место в теле
+    int fd = -1;                   // CSV: файл и смещение
+    uint64_t off = 0;
+    std::shared_ptr<const void> keep;   // TBIN: отображение, блоки с b0, границы ts
+    const TbinReader* rd = nullptr;
+    size_t b0 = 0;
+    int64_t from = 0, to = 0;
+    std::vector<uint64_t> cum;     // байт CSV до начала каждого блока (куска --framed)
+    const char* text = nullptr;    // --framed: отображение (держит keep) и границы кусков в нем
+    std::vector<uint64_t> src;
+  };
+  std::vector<Part> parts_;
+  uint64_t total_ = 0;
+  uint64_t tag_ = 14695981039346656037ull;
+};
+
+// Общий пул разбора больших диапазонов: --scan-threads - 1 потоков на весь сервер, а не на
+// каждый запрос. run() отдает куски в очередь, первый разбирает сам, а пока ждет - берет из
+// очереди и другие куски (в том числе чужих запросов). Поэтому параллельных разборов не больше,
+// чем потоков пула плюс запросов в работе, и потоки не создаются на каждый запрос.
+class ScanPool {
+public:
+  ~ScanPool(){ stop(); }
+
+  void start(size_t threads){
+    for (size_t i=0;i<threads;i++) thr_.emplace_back([this]{ loop(); });
+  }
+
+  void stop(){
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : thr_) t.join();
+    thr_.clear();
+  }
+
+  size_t threads() const { return thr_.size(); }
+
+  // fn(i) для i в [0, n); возврат - когда все готовы
+  void run(size_t n, const std::function<void(size_t)>& fn){
+    Batch b;
+    b.fn = &fn;
+    b.left = n;
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      for (size_t i=1;i<n;i++) q_.push_back(Task{&b, i});
+    }
+    cv_.notify_all();
+    exec(Task{&b, 0});
+    while (true){
+      Task t{};
+      {
+        std::lock_guard<std::mutex> lk(m_);
+        if (q_.empty()) break;
+        t = q_.front();
+        q_.pop_front();
+      }
+      exec(t);
+    }
+    std::unique_lock<std::mutex> lk(b.m);
+    b.cv.wait(lk, [&]{ return b.left == 0; });
+  }
+
+private:
+  struct Batch {
+    const std::function<void(size_t)>* fn = nullptr;
+    size_t left = 0;
+    std::mutex m;
+    std::condition_variable cv;
+  };
+  struct Task { Batch* b = nullptr; size_t i = 0; };
+
+  static void exec(Task t){
+    (*t.b->fn)(t.i);
+    std::lock_guard<std::mutex> lk(t.b->m);   // после этого b не трогаем: run() может выйти
+    if (--t.b->left == 0) t.b->cv.notify_all();
+  }
+
+  void loop(){
+    while (true){
+      Task t{};
+      {
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait(lk, [&]{ return stopping_ || !q_.empty(); });
+        if (q_.empty()) return;
+        t = q_.front();
+        q_.pop_front();
+      }
+      exec(t);
+    }
+  }
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::deque<Task> q_;
+  std::vector<std::thread> thr_;
+  bool stopping_ = false;
+};
+
+// Нарезка данных на сегменты по времени
+enum class SegmentMode { None, Hour, Day };
+
+// Хранилище измерений из сегментов measurements-YYYY-MM-DD.csv (или -YYYY-MM-DDTHH.csv).
+// Пишется только активный сегмент (период текущего измерения); при смене периода старый
+// сегмент закрывается и для него сохраняются итоги. Старый measurements.csv читается как
+// обычный закрытый сегмент (в режиме none он же и активный).
+// /api/stats берет полностью покрытые закрытые сегменты из итогов, а сканирует только
+// крайние. Хранение ограничивается удалением целых сегментов (--retain-days).
+// Поверх сегментов - колоночный кэш в памяти; фоновый поток держит его в актуальном
+// состоянии по событиям inotify (в других ОС - опросом раз в 500 мс).
+// Закрытые сегменты старше compact_after_days тот же поток сжимает в TBIN (tbin.h):
+// measurements-*.tbin читается наравне с CSV, итоги берутся из каталога блоков.
+class SegmentStore {
+public:
+  // Сжатый сегмент: файл отображен в память, каталог блоков разобран
+  struct TbinFile {
+    MappedFile mf;
+    TbinReader rd;
+  };
+  struct Segment {
+    std::filesystem::path file;  // measurements-*.csv или measurements-*.tbin
+    bool active = false;
+    bool has_sum = false;        // итоги актуальны (закрытый сегмент)
+    SegmentSummary sum;
+    TimeIndex index;             // только для CSV
+    std::shared_ptr<const TbinFile> tbin;
+    Pyramid pyr;                 // агрегаты по минутам и часам
+  };
+  using SegPtr = std::shared_ptr<Segment>;
+
+  void configure(const std::filesystem::path& dir, SegmentMode mode, int retain_days,
+                 size_t index_every, int index_sec, size_t scan_threads, size_t cache_mb,
+                 int compact_after_days, bool pyramid, bool rebuild_pyramid, bool framed){
+    dir_ = dir;
+    framed_ = framed;
+    pyramid_ = pyramid;
+    rebuild_pyr_ = rebuild_pyramid;
+    compact_after_days_ = compact_after_days;
+    cache_.configure(cache_mb << 20);
+    scan_threads_ = scan_threads ? scan_threads : 1;
+    scan_pool_.start(scan_threads_ - 1);
+    mode_ = mode;
+    retain_days_ = retain_days;
+    index_every_ = index_every;
+    index_sec_ = index_sec;
+  }
+
+  CsvAppender& appender(){ return app_; }
+
+  // Найти сегменты, восстановить последнее измерение, открыть индексы и итоги
+  bool open(Sample& last){
+    std::lock_guard<std::mutex> lk(m_);
+    segs_.clear();
+    std::string active_name = segment_name(std::time(nullptr));
+    std::error_code ec;
+    for (auto& de : std::filesystem::directory_iterator(dir_, ec)){
+      std::string name = de.path().filename().string();
+      bool bin = de.path().extension() == ".tbin";
+      std::string stem = de.path().stem().string();
+      bool legacy = (stem == "measurements");
+      bool dated = stem.size() > 13 && stem.compare(0, 13, "measurements-") == 0;
+      if (!de.is_regular_file() || !(legacy || dated) || !(bin || de.path().extension() == ".csv")) continue;
+      if (bin){
+        SegPtr seg = open_tbin(de.path());
+        if (seg) segs_.push_back(seg);
+        else log(LogLevel::Warn, "bad tbin segment skipped: " + name);
+        continue;
+      }
+      auto seg = std::make_shared<Segment>();
+      seg->file = de.path();
+      seg->active = (name == active_name);
+      segs_.push_back(seg);
+    }
+
+    // Оборванные строки отрезаем (recover_last_sample) там, где итоги еще не посчитаны
+    bool have_last = false;
+    for (auto& seg : segs_){
+      if (seg->tbin) continue;
+      SegmentSummary sm;
+      uint64_t size = std::filesystem::file_size(seg->file, ec);
+      bool fresh = !seg->active && load_summary(sum_path(seg->file), sm) && sm.csv_size == size;
+      if (!fresh){
+        // обрезанный файл: агрегаты могли захватить отрезанные строки, их строим заново
+        if (framed_ && verify_framed_tail(seg->file)) Pyramid::remove_files(seg->file);
+        Sample tail{};
+        if (recover_last_sample(seg->file, tail, framed_) && (!have_last || tail.tt >= last.tt)){ last = tail; have_last = true; }
+      }
+      if (!seg->active){
+        if (!fresh){
+          summarize_csv(seg->file, sm);
+          save_summary(sum_path(seg->file), sm);
+        }
+        seg->sum = sm;
+        seg->has_sum = true;
+      }
+      seg->index.configure(index_every_, index_sec_, &epoch_);
+      seg->index.open(seg->file);
+    }
+    drop_compacted_csv_locked();
+    for (auto& seg : segs_) open_pyramid(*seg);
+    sort_locked();
+    // активный сегмент уже есть: писатель открывается сразу, roll_locked для него не будет
+    if (active_ && !app_.open(active_->file)) log(LogLevel::Warn, "cannot open csv for append: " + active_->file.string());
+
+    // Последнее измерение может быть и в закрытом сегменте (активный еще пуст)
+    SegPtr newest;
+    for (auto& seg : segs_)
+      if (seg->has_sum && seg->sum.st.count && (!newest || seg->sum.last > newest->sum.last)) newest = seg;
+    if (newest && (!have_last || newest->sum.last > (int64_t)last.tt)){
+      Sample tail{};
+      bool ok = newest->tbin ? tbin_last_sample(newest->tbin->rd, tail) : recover_last_sample(newest->file, tail, framed_);
+      if (ok){ last = tail; have_last = true; }
+    }
+    retain_locked();
+    return have_last;
+  }
+
+  // Записать измерение в сегмент его периода; true - если буфер сброшен в файл
+  bool append(time_t tt, double temp){
+    SegPtr seg;
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      std::string name = segment_name(tt);
+      if (!active_ || active_->file.filename().string() != name) roll_locked(name);
+      seg = active_;
+    }
+    if (!seg) return false;
+    bool flushed = app_.append(tt, temp);
+    if (flushed){
+      seg->index.catch_up();
+      seg->pyr.catch_up_csv();
+    }
+    return flushed;
+  }
+
+  // Пачка измерений: подряд идущие из одного периода сегмента уходят в писатель одним
+  // вызовом; true - если буфер сбрасывался
+  bool append_batch(const Sample* s, size_t n){
+    bool flushed = false;
+    for (size_t i=0;i<n;){
+      size_t j = i + 1;
+      while (j < n && period_of(s[j].tt) == period_of(s[i].tt)) j++;
+      SegPtr seg;
+      {
+        std::lock_guard<std::mutex> lk(m_);
+        std::string name = segment_name(s[i].tt);
+        if (!active_ || active_->file.filename().string() != name) roll_locked(name);
+        seg = active_;
+      }
+      if (!seg) return flushed;
+      if (app_.append_batch(s + i, j - i)){
+        seg->index.catch_up();
+        seg->pyr.catch_up_csv();
+        flushed = true;
+      }
+      i = j;
+    }
+    return flushed;
+  }
+
+  void flush_if_due(){
+    SegPtr seg = active();
+    if (app_.flush_if_due() && seg){
+      seg->index.catch_up();
+      seg->pyr.catch_up_csv();
+    }
+  }
+
+  // Фоновый поток: загрузить кэш и дальше дочитывать изменения файлов
+  void start_watch(){
+    watch_thr_ = std::thread([this]{ watch_loop(); });
+  }
+
+  void close(){
+    watch_stop_ = true;
+    if (watch_thr_.joinable()) watch_thr_.join();
+    app_.close();
+  }
+
+  // Статистика и точки графика по диапазону [from, to] (не больше max_points точек)
+  void query(time_t from, time_t to, Stats& st, SampleVec& samples, size_t max_points){
+    sync_cache("");
+    if (query_pyramid(from, to, st, samples, max_points)) return;
+    query_raw(from, to, st, samples, max_points);
+  }
+
+  // Уровень пирамиды для диапазона: самый грубый, где интервалов с данными хватает на
+  // max_points точек; -1 - диапазон короткий, считаем по измерениям
+  int pyramid_level(time_t from, time_t to, size_t max_points) const {
+    if (!pyramid_) return -1;
+    int64_t lo = std::max<int64_t>((int64_t)from, oldest_ts()), hi = std::min<int64_t>((int64_t)to, newest_ts());
+    if (hi < lo) return -1;
+    int64_t span = hi - lo + 1;
+    for (int L = (int)Pyramid::LEVELS - 1; L >= 0; L--)
+      if (span / Pyramid::width((size_t)L) >= (int64_t)max_points + 2) return L;
+    return -1;
+  }
+
+  // По каждому измерению: кэш ряда, иначе итоги сегментов и разбор файлов
+  void query_raw(time_t from, time_t to, Stats& st, SampleVec& samples, size_t max_points){
+    if (cache_.query(from, to, st, samples, max_points)) return;
+
+    struct Part { SegPtr seg; bool covered; size_t count; SampleVec samples; };
+    std::vector<Part> parts;
+    for (auto& it : snapshot()){
+      const SegPtr& seg = it.first;
+      const SegmentSummary* sm = it.second ? &seg->sum : nullptr;
+      if (sm){
+        if (!sm->st.count || sm->last < (int64_t)from || sm->first > (int64_t)to) continue;
+        if ((int64_t)from <= sm->first && sm->last <= (int64_t)to){
+          st.merge(sm->st);
+          parts.push_back(Part{seg, true, sm->st.count, {}});
+          continue;
+        }
+      }
+      Part p{seg, false, 0, {}};
+      scan_range(*seg, from, to, st, p.samples);
+      p.count = p.samples.size();
+      if (p.count) parts.push_back(std::move(p));
+    }
+
+    size_t total = 0;
+    for (auto& p : parts) total += p.count;
+    samples.clear();
+    samples.reserve(std::min(total, max_points));
+
+    // Точек немного: берем все (покрытые сегменты дочитываем целиком)
+    if (total <= max_points){
+      for (auto& p : parts){
+        if (p.covered){
+          Stats unused;
+          scan_range(*p.seg, from, to, unused, samples);
+        } else {
+          samples.insert(samples.end(), p.samples.begin(), p.samples.end());
+        }
+      }
+      return;
+    }
+
+    // Иначе каждое step-е измерение по сквозной нумерации; в покрытом сегменте k-е
+    // измерение находится через ordinal индекса (в TBIN - через каталог блоков)
+    size_t step = (total + max_points - 1) / max_points;
+    size_t base = 0, g = 0;
+    for (auto& p : parts){
+      MappedFile mf;
+      bool mapped = !p.covered || p.seg->tbin || mf.open(p.seg->file);
+      for (; g < base + p.count; g += step){
+        size_t k = g - base;
+        Sample s{};
+        if (!p.covered) samples.push_back(p.samples[k]);
+        else if (mapped && nth_sample(*p.seg, mf, k, s)) samples.push_back(s);
+      }
+      base += p.count;
+    }
+  }
+
+  SegPtr active() const {
+    std::lock_guard<std::mutex> lk(m_);
+    return active_;
+  }
+
+  std::string stats_json() const {
+    std::lock_guard<std::mutex> lk(m_);
+    std::ostringstream os;
+    size_t sealed = 0, tbin = 0, pyr = 0;
+    for (auto& s : segs_){
+      if (s->has_sum) sealed++;
+      if (s->tbin) tbin++;
+      if (s->pyr.usable()) pyr++;
+    }
+    os<<"{\"mode\":\""<<(mode_==SegmentMode::Day ? "day" : mode_==SegmentMode::Hour ? "hour" : "none")
+      <<"\",\"segments\":"<<segs_.size()<<",\"sealed\":"<<sealed<<",\"tbin\":"<<tbin
+      <<",\"active\":\""<<(active_ ? json_escape(active_->file.filename().string()) : std::string())
+      <<"\",\"removed\":"<<removed_<<",\"compacted\":"<<compacted_<<",\"pyramid\":"<<pyr<<"}";
+    return os.str();
+  }
+
+  std::string cache_json() const { return cache_.stats_json(); }
+
+  // Эпоха данных: растет, когда меняется уже записанное (сегменты удалены по сроку,
+  // закрытый сегмент изменен, дописано измерение старше последнего). Дописывание в конец
+  // эпоху не меняет
+  uint64_t epoch() const { return epoch_.load(std::memory_order_acquire); }
+
+  // Время последнего измерения в файлах (INT64_MIN - данных нет): хвост активного
+  // сегмента дочитывается индексом, у закрытых берется из итогов или каталога TBIN
+  int64_t newest_ts() const {
+    auto segs = snapshot();
+    for (auto it = segs.rbegin(); it != segs.rend(); ++it){
+      Segment& seg = *it->first;
+      if (seg.tbin){
+        const TbinReader& r = seg.tbin->rd;
+        if (r.blocks()) return r.block(r.blocks() - 1).last;
+        continue;
+      }
+      if (it->second){
+        if (seg.sum.st.count) return seg.sum.last;
+        continue;
+      }
+      seg.index.catch_up();
+      int64_t t = seg.index.last_ts();
+      if (t != std::numeric_limits<int64_t>::min()) return t;
+    }
+    return std::numeric_limits<int64_t>::min();
+  }
+
+  // Сырые строки [from, to] для /api/raw: у CSV - границы байт по индексу и бинарному поиску
+  // (только полные строки, битые отдаются как есть, у --framed - без разметки), у TBIN - нужные блоки
+  void raw(time_t from, time_t to, RawBody& out) const {
+    out.mix(epoch());   // закрытый сегмент изменен на месте, опоздавшие строки
+    for (auto& it : snapshot()){
+      Segment& seg = *it.first;
+      if (seg.tbin){
+        const TbinReader& r = seg.tbin->rd;
+        size_t b0 = r.lower_block((int64_t)from), b1 = b0;
+        while (b1 < r.blocks() && r.block(b1).first <= (int64_t)to) b1++;
+        if (b0 < b1) out.add_tbin(seg.tbin, r, b0, b1, (int64_t)from, (int64_t)to);
+        continue;
+      }
+      if (it.second && (!seg.sum.st.count || seg.sum.last < (int64_t)from || seg.sum.first > (int64_t)to)) continue;
+      seg.index.catch_up();
+      auto mf = std::make_shared<MappedFile>();
+      if (!mf->open(seg.file) || !mf->size()) continue;
+      const char* d = mf->data();
+      size_t n = mf->size();
+      auto wf = seg.index.bracket(from), wt = seg.index.bracket(to + 1);
+      size_t begin = lower_bound_offset(d, n, from, (size_t)wf.first, (size_t)wf.second);
+      size_t end = lower_bound_offset(d, n, to + 1, std::max(begin, (size_t)wt.first), std::max(begin, (size_t)wt.second));
+      while (end > begin && d[end-1] != '\n') end--;   // недописанная последняя строка
+      if (end <= begin) continue;
+      // разметку --framed (суммы, метки) отдавать нельзя - такой кусок печатается без нее.
+      // Файл мог быть записан и без флага: смотрим первую и последнюю строку
+      auto framed_line = [&](size_t a, size_t b){
+        return (b > a && d[a] == '#') || (b - a >= CSV_FRAME_SUFFIX && d[b - CSV_FRAME_SUFFIX] == '*');
+      };
+      size_t first_end = (size_t)(find_newline(d + begin, d + end) - d), last_begin = end - 1;
+      while (last_begin > begin && d[last_begin-1] != '\n') last_begin--;
+      if (framed_ || framed_line(begin, first_end) || framed_line(last_begin, end - 1))
+        out.add_framed(seg.file, std::move(mf), begin, end - begin);
+      else if (!out.add_file(seg.file, begin, end - begin))
+        log(LogLevel::Warn, "raw: cannot open " + seg.file.string());
+    }
+  }
+
+  // Время самого старого измерения (INT64_MAX, если измерений нет)
+  int64_t oldest_ts() const {
+    for (auto& it : snapshot()){
+      Segment& seg = *it.first;
+      if (seg.tbin){
+        const TbinReader& r = seg.tbin->rd;
+        if (r.blocks()) return r.block(0).first;
+        continue;
+      }
+      if (it.second){
+        if (seg.sum.st.count) return seg.sum.first;
+        continue;
+      }
+      int64_t t = seg.index.first_ts();
+      if (t != std::numeric_limits<int64_t>::max()) return t;
+    }
+    return std::numeric_limits<int64_t>::max();
+  }
+
+private:
+  // Номер периода сегмента: у измерений с одним номером одно имя файла
+  int64_t period_of(time_t tt) const {
+    if (mode_ == SegmentMode::None) return 0;
+    int64_t w = mode_ == SegmentMode::Day ? 86400 : 3600, p = (int64_t)tt / w;
+    return p * w > (int64_t)tt ? p - 1 : p;
+  }
+
+  std::string segment_name(time_t tt) const {
+    if (mode_ == SegmentMode::None) return "measurements.csv";
+    char iso[20];
+    format_iso_utc(tt, iso);
+    return "measurements-" + std::string(iso, mode_ == SegmentMode::Day ? 10 : 13) + ".csv";
+  }
+
+  static std::filesystem::path sum_path(const std::filesystem::path& csv){
+    std::filesystem::path p = csv;
+    p += ".sum";
+    return p;
+  }
+
+  // Файл сегмента вместе с .idx и .sum
+  static void remove_segment_files(const std::filesystem::path& file){
+    std::error_code ec;
+    std::filesystem::path idx = file;
+    idx += ".idx";
+    std::filesystem::remove(file, ec);
+    std::filesystem::remove(idx, ec);
+    std::filesystem::remove(sum_path(file), ec);
+  }
+
+  // Закрытый сегмент TBIN; итоги - из каталога блоков. nullptr - файл поврежден
+  static SegPtr open_tbin(const std::filesystem::path& file){
+    auto tf = std::make_shared<TbinFile>();
+    if (!tf->mf.open(file) || !tf->rd.open(tf->mf.data(), tf->mf.size())) return nullptr;
+    auto seg = std::make_shared<Segment>();
+    seg->file = file;
+    seg->has_sum = true;
+    seg->sum.csv_size = tf->mf.size();
+    const TbinReader& r = tf->rd;
+    int64_t sum = 0;
+    int32_t mn = std::numeric_limits<int32_t>::max(), mx = std::numeric_limits<int32_t>::min();
+    for (size_t i=0;i<r.blocks();i++){
+      sum += r.block(i).sum;
+      mn = std::min(mn, r.block(i).mn);
+      mx = std::max(mx, r.block(i).mx);
+    }
+    if (r.blocks()){
+      seg->sum.st.count = (size_t)r.count();
+      seg->sum.st.sum = (double)sum / 1000.0;
+      seg->sum.st.minv = mn / 1000.0;
+      seg->sum.st.maxv = mx / 1000.0;
+      seg->sum.first = r.block(0).first;
+      seg->sum.last = r.block(r.blocks()-1).last;
+    }
+    seg->tbin = tf;
+    return seg;
+  }
+
+  // Пирамида сегмента: готовые файлы закрытого сегмента, продолжение активного CSV
+  // или построение заново (активный CSV дальше дочитывается catch_up_csv)
+  void open_pyramid(Segment& seg){
+    if (!pyramid_) return;
+    if (seg.has_sum && !rebuild_pyr_ && seg.pyr.load(seg.file, seg.sum.st.count)) return;
+    if (!seg.has_sum && !seg.tbin && !rebuild_pyr_ && seg.pyr.resume(seg.file)){
+      seg.pyr.catch_up_csv();
+      return;
+    }
+    seg.pyr.reset(seg.file);
+    if (seg.tbin){
+      const TbinReader& r = seg.tbin->rd;
+      for (size_t b=0;b<r.blocks();b++) r.decode(b, [&](int64_t ts, int32_t m){ seg.pyr.add(ts, m / 1000.0); });
+    } else {
+      seg.pyr.catch_up_csv();
+    }
+    if (seg.has_sum) seg.pyr.finish();
+  }
+
+  // Длинный диапазон по пирамиде: итоги - по целым интервалам внутри [from, to] плюс
+  // измерения неполных интервалов по краям, точки - средние по группам интервалов.
+  // false - диапазон короткий или у какого-то сегмента пирамиды нет (тогда по измерениям)
+  bool query_pyramid(time_t from, time_t to, Stats& st, SampleVec& samples, size_t max_points){
+    int L = pyramid_level(from, to, max_points);
+    if (L < 0) return false;
+    int64_t w = Pyramid::width((size_t)L);
+    auto floor_w = [w](int64_t t){ int64_t r = t / w * w; return r > t ? r - w : r; };
+    int64_t lo = floor_w((int64_t)from + w - 1), hi = floor_w((int64_t)to + 1);   // целые интервалы [lo, hi)
+
+    std::pmr::vector<PyrRec> recs(samples.get_allocator());
+    for (auto& it : snapshot()){
+      Segment& seg = *it.first;
+      if (it.second && (!seg.sum.st.count || seg.sum.last < lo || seg.sum.first >= hi)) continue;
+      if (!seg.pyr.usable()) return false;
+      if (!it.second && !seg.tbin) seg.pyr.catch_up_csv();
+      seg.pyr.collect((size_t)L, lo, hi, recs);
+    }
+    // интервал может встретиться в двух сегментах (измерение записано не в свой файл)
+    auto by_t = [](const PyrRec& a, const PyrRec& b){ return a.t < b.t; };
+    if (!std::is_sorted(recs.begin(), recs.end(), by_t)) std::stable_sort(recs.begin(), recs.end(), by_t);
+    size_t m = 0;
+    for (size_t i=0;i<recs.size();i++){
+      if (m && recs[m-1].t == recs[i].t){
+        PyrRec& a = recs[m-1];
+        a.count += recs[i].count;
+        a.sum += recs[i].sum;
+        a.mn = std::min(a.mn, recs[i].mn);
+        a.mx = std::max(a.mx, recs[i].mx);
+        a.last = recs[i].last;
+      } else recs[m++] = recs[i];
+    }
+    recs.resize(m);
+
+    Stats left, inner, right;
+    SampleVec unused(samples.get_allocator());
+    if ((int64_t)from < lo) query_raw(from, (time_t)std::min<int64_t>(lo - 1, to), left, unused, 1);
+    for (auto& r : recs){
+      Stats b;
+      b.count = r.count;
+      b.sum = r.sum;
+      b.minv = r.mn;
+      b.maxv = r.mx;
+      inner.merge(b);
+    }
+    if (hi <= (int64_t)to) query_raw((time_t)std::max<int64_t>(hi, from), to, right, unused, 1);
+    st.merge(left);
+    st.merge(inner);
+    st.merge(right);
+
+    size_t step = recs.size() > max_points ? (recs.size() + max_points - 1) / max_points : 1;
+    samples.reserve(samples.size() + (recs.size() + step - 1) / step);
+    for (size_t i=0;i<recs.size();i+=step){
+      double sum = 0;
+      uint64_t cnt = 0;
+      for (size_t j=i;j<std::min(recs.size(), i+step);j++){ sum += recs[j].sum; cnt += recs[j].count; }
+      samples.push_back(Sample{(time_t)recs[i].t, sum / (double)cnt});
+    }
+    return true;
+  }
+
+  static bool tbin_last_sample(const TbinReader& r, Sample& out){
+    if (!r.blocks()) return false;
+    return r.decode(r.blocks()-1, [&](int64_t ts, int32_t m){ out = Sample{(time_t)ts, m / 1000.0}; });
+  }
+
+  // Сжатие прервалось между появлением .tbin и удалением CSV: CSV с теми же итогами лишний
+  void drop_compacted_csv_locked(){
+    for (auto it = segs_.begin(); it != segs_.end();){
+      const Segment& s = **it;
+      SegPtr twin;
+      if (!s.tbin && s.has_sum)
+        for (auto& o : segs_) if (o->tbin && o->file.stem() == s.file.stem()) twin = o;
+      if (!twin || twin->sum.st.count != s.sum.st.count || twin->sum.first != s.sum.first || twin->sum.last != s.sum.last){
+        ++it;
+        continue;
+      }
+      log(LogLevel::Warn, "csv of compacted segment removed: " + s.file.filename().string());
+      remove_segment_files(s.file);
+      it = segs_.erase(it);
+    }
+  }
+
+  // Сжать в TBIN один закрытый CSV-сегмент старше compact_after_days (по одному за вызов,
+  // чтобы не задерживать кэш). Хвост кэша не трогаем: кэш дочитывает его по смещению в CSV.
+  // Сегмент подменяется в списке под блокировкой, CSV удаляется после fsync TBIN.
+  void compact_step(){
+    if (compact_after_days_ <= 0) return;
+    int64_t cutoff = (int64_t)std::time(nullptr) - (int64_t)compact_after_days_ * 86400;
+    std::filesystem::path tail = cache_.tail_file();
+    SegPtr seg;
+    for (auto& it : snapshot()){
+      const Segment& s = *it.first;
+      if (!it.second || s.tbin || s.active || !s.sum.st.count || s.sum.last >= cutoff || s.file == tail) continue;
+      if (std::find(compact_skip_.begin(), compact_skip_.end(), s.file.filename().string()) != compact_skip_.end()) continue;
+      seg = it.first;
+      break;
+    }
+    if (!seg) return;
+
+    std::string name = seg->file.filename().string();
+    std::filesystem::path out = seg->file;
+    out.replace_extension(".tbin");
+    auto t0 = std::chrono::steady_clock::now();
+    std::error_code ec;
+    std::string err;
+    SegPtr bin;
+    bool created = false;
+    if (std::filesystem::exists(out, ec)) err = out.filename().string() + " already exists";
+    else if ((created = tbin_compact_csv(seg->file, out, err))){
+      if (!sync_file(out)) err = "fsync failed";
+      else if (!(bin = open_tbin(out)) || bin->sum.st.count != seg->sum.st.count) err = "sample count mismatch";
+      else open_pyramid(*bin);
+    }
+    if (err.empty()){
+      std::lock_guard<std::mutex> lk(m_);
+      auto it = std::find(segs_.begin(), segs_.end(), seg);
+      uint64_t sz = std::filesystem::file_size(seg->file, ec);
+      // пока сжимали, сегмент могли удалить по сроку хранения или дописать
+      if (it == segs_.end() || !seg->has_sum || ec || sz != seg->sum.csv_size) err = "segment changed";
+      else {
+        *it = bin;
+        compacted_++;
+      }
+    }
+    if (!err.empty()){
+      bin.reset();
+      if (created) std::filesystem::remove(out, ec);
+      compact_skip_.push_back(name);
+      log(LogLevel::Warn, "segment not compacted: " + name + ": " + err);
+      return;
+    }
+    remove_segment_files(seg->file);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    log(LogLevel::Info, "segment compacted: " + name + " -> " + out.filename().string() + " (" +
+                        std::to_string(seg->sum.csv_size) + " -> " + std::to_string(bin->sum.csv_size) +
+                        " bytes, " + std::to_string(ms) + " ms)");
+  }
+
+  // По времени первого измерения (пустой активный сегмент - в конце)
+  void sort_locked(){
+    auto first = [](const SegPtr& s){ return s->has_sum ? s->sum.first : s->index.first_ts(); };
+    std::stable_sort(segs_.begin(), segs_.end(), [&](const SegPtr& a, const SegPtr& b){ return first(a) < first(b); });
+    active_ = nullptr;
+    for (auto& s : segs_) if (s->active) active_ = s;
+  }
+
+  // Смена активного сегмента: старый закрываем с итогами, новый создаем (или снова
+  // открываем, если время ушло назад в период уже закрытого сегмента)
+  void roll_locked(const std::string& name){
+    app_.close();
+    if (active_){
+      active_->index.catch_up();
+      summarize_csv(active_->file, active_->sum);
+      save_summary(sum_path(active_->file), active_->sum);
+      active_->has_sum = true;
+      active_->active = false;
+      active_->pyr.catch_up_csv();
+      active_->pyr.finish();
+      log(LogLevel::Info, "segment closed: " + active_->file.filename().string() +
+                          " (" + std::to_string(active_->sum.st.count) + " samples)");
+    }
+    SegPtr seg;
+    for (auto& s : segs_) if (s->file.filename().string() == name) seg = s;
+    if (!seg){
+      seg = std::make_shared<Segment>();
+      seg->file = dir_ / name;
+      seg->index.configure(index_every_, index_sec_, &epoch_);
+      segs_.push_back(seg);
+    }
+    seg->active = true;
+    seg->has_sum = false;
+    std::error_code ec;
+    std::filesystem::remove(sum_path(seg->file), ec);
+    if (!app_.open(seg->file)) log(LogLevel::Warn, "cannot open csv for append: " + seg->file.string());
+    seg->index.open(seg->file);
+    open_pyramid(*seg);
+    sort_locked();
+    retain_locked();
+  }
+
+  // Удаление закрытых сегментов, последнее измерение которых старше retain_days
+  void retain_locked(){
+    if (retain_days_ <= 0) return;
+    int64_t cutoff = (int64_t)std::time(nullptr) - (int64_t)retain_days_ * 86400;
+    int64_t removed_last = std::numeric_limits<int64_t>::min();
+    for (auto it = segs_.begin(); it != segs_.end();){
+      const Segment& s = **it;
+      if (s.active || !s.has_sum || !s.sum.st.count || s.sum.last >= cutoff){ ++it; continue; }
+      remove_segment_files(s.file);
+      Pyramid::remove_files(s.file);
+      log(LogLevel::Info, "segment removed by retention: " + s.file.filename().string());
+      removed_++;
+      removed_last = std::max(removed_last, s.sum.last);
+      it = segs_.erase(it);
+    }
+    if (removed_last != std::numeric_limits<int64_t>::min()){
+      cache_.trim_before(removed_last + 1);
+      epoch_++;
+    }
+  }
+
+  // Кэш догоняет файлы: хвостовой сегмент и все, что появились после него.
+  // name - файл из события inotify: закрытый сегмент, который кто-то дописал, теряет итоги
+  // (его снова сканируют), а если он раньше хвоста кэша - кэш выключается.
+  void sync_cache(const std::string& name){
+    auto segs = snapshot();
+    std::filesystem::path tail = cache_.tail_file();
+    size_t ti = segs.size();
+    for (size_t i=0;i<segs.size();i++) if (segs[i].first->file == tail) ti = i;
+
+    if (!name.empty()){
+      SegPtr act = active();
+      for (size_t i=0;i<segs.size();i++){
+        Segment& s = *segs[i].first;
+        if (s.file.filename().string() != name) continue;
+        std::error_code ec;
+        uint64_t sz = std::filesystem::file_size(s.file, ec);
+        // изменилось не дописыванием активного. Последний сброс только что закрытого
+        // сегмента приходит уже после смены активного - его итоги учитывают
+        if (segs[i].first != act && (!segs[i].second || ec || sz != s.sum.csv_size)){
+          epoch_++;
+          s.pyr.invalidate();
+        }
+        if (segs[i].second && !ec && sz != s.sum.csv_size){
+          std::lock_guard<std::mutex> lk(m_);
+          s.has_sum = false;
+          log(LogLevel::Warn, "closed segment changed, summary dropped: " + name);
+        }
+        if (ti < segs.size() && i < ti) cache_.invalidate("older segment changed: " + name);
+      }
+    }
+
+    size_t i = tail.empty() ? 0 : (ti < segs.size() ? ti : segs.size() - 1);
+    for (; i < segs.size(); i++) if (!segs[i].first->tbin) cache_.tail(segs[i].first->file);
+  }
+
+  void watch_loop(){
+    {
+      std::vector<std::filesystem::path> files;
+      for (auto& it : snapshot()) files.push_back(it.first->file);
+      auto t0 = std::chrono::steady_clock::now();
+      cache_.load(files);
+      sync_cache("");
+      cache_.set_ready();
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+      log(LogLevel::Info, "series cache loaded in " + std::to_string(ms) + " ms: " + cache_.stats_json());
+    }
+    // сжатие старых сегментов - по одному раз в минуту, первый сразу после загрузки кэша
+    auto next_compact = std::chrono::steady_clock::now();
+    auto maybe_compact = [&]{
+      if (std::chrono::steady_clock::now() < next_compact) return;
+      compact_step();
+      next_compact = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    };
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, dir_.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0){
+      ::close(fd);
+      fd = -1;
+    }
+    if (fd < 0) log(LogLevel::Warn, "inotify unavailable, polling data dir");
+    alignas(inotify_event) char buf[4096];
+    while (!watch_stop_){
+      maybe_compact();
+      if (fd < 0){
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        sync_cache("");
+        continue;
+      }
+      pollfd pfd{fd, POLLIN, 0};
+      if (::poll(&pfd, 1, 200) <= 0) continue;
+      ssize_t n = ::read(fd, buf, sizeof(buf));
+      std::vector<std::string> names;
+      for (ssize_t q = 0; q < n; ){
+        const inotify_event* e = (const inotify_event*)(buf + q);
+        if (e->len){
+          std::string nm = e->name;
+          if (nm.size() > 4 && nm.compare(nm.size()-4, 4, ".csv") == 0 &&
+              std::find(names.begin(), names.end(), nm) == names.end()) names.push_back(nm);
+        }
+        q += (ssize_t)(sizeof(inotify_event) + e->len);
+      }
+      for (auto& nm : names) sync_cache(nm);
+    }
+    if (fd >= 0) ::close(fd);
+#else
+    while (!watch_stop_){
+      maybe_compact();
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      sync_cache("");
+    }
+#endif
+  }
+
+  // Копия списка сегментов с флагом "итоги актуальны" (запросы идут без блокировки)
+  std::vector<std::pair<SegPtr,bool>> snapshot() const {
+    std::lock_guard<std::mutex> lk(m_);
+    std::vector<std::pair<SegPtr,bool>> v;
+    v.reserve(segs_.size());
+    for (auto& s : segs_) v.emplace_back(s, s->has_sum);
+    return v;
+  }
+
+  // Строки сегмента в [from, to]: окно по индексу, бинарный поиск, разбор до ts > to.
+  // Большой диапазон (от PAR_MIN_BYTES) режется по границам строк на куски, которые
+  // разбираются параллельно; частичные Stats и точки склеиваются в порядке кусков
+  void scan_range(Segment& seg, time_t from, time_t to, Stats& st, SampleVec& out) const {
+    if (seg.tbin){
+      // TBIN: каталог дает первый нужный блок, блоки декодируются до first > to
+      const TbinReader& r = seg.tbin->rd;
+      for (size_t b = r.lower_block((int64_t)from); b < r.blocks() && r.block(b).first <= (int64_t)to; b++)
+        r.decode(b, [&](int64_t ts, int32_t m){
+          if (ts < (int64_t)from || ts > (int64_t)to) return;
+          double t = m / 1000.0;
+          st.add(t);
+          out.push_back(Sample{(time_t)ts, t});
+        });
+      return;
+    }
+    seg.index.catch_up();
+    auto win = seg.index.bracket(from);
+    MappedFile mf;
+    if (!mf.open(seg.file) || !mf.size()) return;
+    const char* d = mf.data();
+    size_t n = mf.size();
+    size_t begin = lower_bound_offset(d, n, from, (size_t)win.first, (size_t)win.second);
+
+    auto scan = [&](size_t p, size_t end, Stats& cst, SampleVec& acc){
+      size_t next = p;
+      while (p < end){
+        Sample s{};
+        bool ok = parse_line_at(d, n, p, s, next);
+        if (next <= p) break;
+        p = next;
+        if (!ok) continue;
+        if (s.tt > to) break;
+        cst.add(s.temp);
+        acc.push_back(s);
+      }
+    };
+
+    const size_t PAR_MIN_BYTES = 4u << 20;
+    size_t end = n;
+    if (scan_threads_ > 1 && n - begin >= PAR_MIN_BYTES){
+      auto wto = seg.index.bracket(to + 1);
+      end = lower_bound_offset(d, n, to + 1, std::max(begin, (size_t)wto.first), std::max(begin, (size_t)wto.second));
+    }
+    size_t chunks = std::min(scan_threads_, (end - begin) / (PAR_MIN_BYTES / 4) + 1);
+    if (end - begin < PAR_MIN_BYTES || chunks < 2){
+      scan(begin, n, st, out);
+      return;
+    }
+
+    std::vector<size_t> bounds(chunks + 1);
+    bounds[0] = begin;
+    bounds[chunks] = end;
+    for (size_t i=1;i<chunks;i++)
+      bounds[i] = std::min(end, line_start_at_or_after(d, n, begin + (end - begin) / chunks * i));
+    std::vector<Stats> cst(chunks);
+    std::vector<SampleVec> csamples(chunks);   // из обычной кучи: арена не потокобезопасна
+    scan_pool_.run(chunks, [&](size_t i){
+      csamples[i].reserve((bounds[i+1]-bounds[i])/24);
+      scan(bounds[i], bounds[i+1], cst[i], csamples[i]);
+    });
+
+    size_t total = out.size();
+    for (auto& v : csamples) total += v.size();
+    out.reserve(total);
+    for (size_t i=0;i<chunks;i++){
+      st.merge(cst[i]);
+      out.insert(out.end(), csamples[i].begin(), csamples[i].end());
+    }
+  }
+
+  // k-е измерение закрытого сегмента: от ближайшей записи индекса идем вперед
+  static bool nth_sample(const Segment& seg, const MappedFile& mf, size_t k, Sample& out){
+    if (seg.tbin){
+      const TbinReader& r = seg.tbin->rd;
+      if (k >= r.count()) return false;
+      size_t b = r.block_of(k);
+      return r.decode(b, [&](int64_t ts, int32_t m){ out = Sample{(time_t)ts, m / 1000.0}; },
+                      (uint32_t)(k - r.block_start(b) + 1));
+    }
+    TimeIndex::Entry e = seg.index.locate(k);
+    const char* d = mf.data();
+    size_t n = mf.size(), p = (size_t)e.off, next = p;
+    uint64_t ord = e.ord;
+    while (p < n){
+      bool ok = parse_line_at(d, n, p, out, next);
+      if (next <= p) break;
+      p = next;
+      if (!ok) continue;
+      if (ord++ == k) return true;
+    }
+    return false;
+  }
+
+  mutable std::mutex m_;
+  std::filesystem::path dir_;
+  SegmentMode mode_ = SegmentMode::Day;
+  int retain_days_ = 0;
+  size_t index_every_ = 1024;
+  int index_sec_ = 60;
+  size_t scan_threads_ = 1;    // потоков на разбор большого диапазона
+  mutable ScanPool scan_pool_; // их общий пул (scan_threads_ - 1 потоков, +1 - сам запрос)
+  int compact_after_days_ = 0; // сжимать в TBIN закрытые сегменты старше N дней (0 - нет)
+  std::vector<SegPtr> segs_;
+  SegPtr active_;
+  CsvAppender app_;
+  uint64_t removed_ = 0;
+  uint64_t compacted_ = 0;
+  std::atomic<uint64_t> epoch_{0};
+  bool pyramid_ = true;        // агрегаты по минутам и часам для длинных диапазонов
+  bool rebuild_pyr_ = false;   // перестроить файлы пирамиды при открытии
+  bool framed_ = false;        // CSV с CRC32C: при открытии проверить хвост (verify_framed_tail)
+  std::vector<std::string> compact_skip_;  // сегменты, которые сжать не удалось
+  SeriesCache cache_;
+  std::thread watch_thr_;
+  std::atomic<bool> watch_stop_{false};
+};
+
+// Пул обработчиков: фиксированное число потоков и ограниченная очередь соединений.
+// Если очередь полна - submit() возвращает false (вызывающий отвечает 503).
+// stop(): новые не принимаем, ждем очередь и текущие запросы до timeout,
+// оставшиеся соединения рвем через shutdown() и дожидаемся потоков.
+class WorkerPool {
+public:
+  using Handler = std::function<void(socket_t)>;
+
+  void start(size_t threads, size_t queue_cap, Handler h){
+    handler_ = std::move(h);
+    queue_cap_ = queue_cap ? queue_cap : 1;
+    for (size_t i=0;i<threads;i++) threads_.emplace_back([this]{ run(); });
+  }
+
+  bool submit(socket_t c){
+    std::lock_guard<std::mutex> lk(m_);
+    if (stopping_ || q_.size() >= queue_cap_){ rejected_++; return false; }
+    q_.push_back(Job{c, std::chrono::steady_clock::now()});
+    accepted_++;
+    if (q_.size() > max_depth_) max_depth_ = q_.size();
+    cv_.notify_one();
+    return true;
+  }
+
+  void stop(std::chrono::milliseconds timeout){
+    std::unique_lock<std::mutex> lk(m_);
+    stopping_ = true;
+    cv_.notify_all();
+    bool drained = idle_cv_.wait_for(lk, timeout, [this]{ return q_.empty() && active_.empty(); });
+    if (!drained){
+      // не успели: соединения из очереди закрываем, текущие будим shutdown()-ом
+      for (auto& j: q_) sock_close(j.c);
+      q_.clear();
+      for (socket_t c: active_){
+#ifdef _WIN32
+        ::shutdown(c, SD_BOTH);
+#else
+        ::shutdown(c, SHUT_RDWR);
+#endif
+      }
+    }
+    lk.unlock();
+    for (auto& t: threads_) if (t.joinable()) t.join();
+    threads_.clear();
+  }
+
+  // JSON со счетчиками и временем ожидания в очереди
+  std::string stats_json() const {
+    std::lock_guard<std::mutex> lk(m_);
+    std::ostringstream os;
+    os<<"{\"threads\":"<<threads_.size()<<",\"queue_cap\":"<<queue_cap_
+      <<",\"queued\":"<<q_.size()<<",\"active\":"<<active_.size()
+      <<",\"max_depth\":"<<max_depth_<<",\"accepted\":"<<accepted_
+      <<",\"rejected\":"<<rejected_<<",\"completed\":"<<completed_
+      <<",\"wait_avg_us\":"<<(completed_ ? wait_total_us_/completed_ : 0)
+      <<",\"wait_max_us\":"<<wait_max_us_<<",\"wait_hist_us\":{";
+    for (size_t i=0;i<WAIT_BUCKETS;i++){
+      if (i) os<<",";
+      os<<"\""<<(i+1<WAIT_BUCKETS ? "le_" + std::to_string(wait_bound_us(i)) : std::string("inf"))<<"\":"<<wait_hist_[i];
+    }
+    os<<"}}";
+    return os.str();
+  }
+
+private:
+  struct Job { socket_t c; std::chrono::steady_clock::time_point enq; };
+  static const size_t WAIT_BUCKETS = 6; // <=100us, <=1ms, <=10ms, <=100ms, <=1s, больше
+  static uint64_t wait_bound_us(size_t i){ uint64_t b = 100; while (i--) b *= 10; return b; }
+
+  void run(){
+    while (true){
+      Job j{};
+      {
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait(lk, [this]{ return stopping_ || !q_.empty(); });
+        if (q_.empty()) return; // stopping_ и очередь пуста
+        j = q_.front();
+        q_.pop_front();
+        active_.push_back(j.c);
+        uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - j.enq).count();
+        wait_total_us_ += us;
+        if (us > wait_max_us_) wait_max_us_ = us;
+        size_t b = 0;
+        while (b+1 < WAIT_BUCKETS && us > wait_bound_us(b)) b++;
+        wait_hist_[b]++;
+      }
+
+      handler_(j.c);
+
+      std::lock_guard<std::mutex> lk(m_);
+      active_.erase(std::find(active_.begin(), active_.end(), j.c));
+      sock_close(j.c);
+      completed_++;
+      if (q_.empty() && active_.empty()) idle_cv_.notify_all();
+    }
+  }
+
+  Handler handler_;
+  mutable std::mutex m_;
+  std::condition_variable cv_, idle_cv_;
+  std::deque<Job> q_;
+  std::vector<socket_t> active_;   // соединения в обработке (для shutdown по таймауту)
+  std::vector<std::thread> threads_;
+  size_t queue_cap_ = 256;
+  bool stopping_ = false;
+  size_t max_depth_ = 0;
+  uint64_t accepted_ = 0, rejected_ = 0, completed_ = 0;
+  uint64_t wait_total_us_ = 0, wait_max_us_ = 0;
+  uint64_t wait_hist_[WAIT_BUCKETS] = {};
+};
+
+// Последнее измерение и окно последних RECENT измерений для читателей без блокировок.
+// Последнее - под seqlock: писатель делает seq нечетным, пишет, делает четным;
+// читатель повторяет копию, если seq был нечетным или изменился.
+// Окно - кольцо слотов: перед записью слота писатель сдвигает claimed_, после - head_.
+// Читатель после копирования смотрит claimed_ и понимает, не затерт ли прочитанный слот
+// (самые старые GUARD слотов не читаются, чтобы запись во время чтения почти не мешала).
+// Окно отвечает на /api/stats, только если сервер сам пишет все измерения (симуляция),
+// и только на диапазон, целиком попавший в окно. Писатели упорядочены мьютексом.
+class LiveBoard {
+public:
+  static const size_t RECENT = 4096;
+  static const size_t GUARD = 64;
+
+  // Окно включается, когда все новые измерения идут через publish()
+  void enable_window(bool on){ window_ = on; }
+
+  // Только последнее (например, восстановленное при старте) - окно не трогаем
+  void set_latest(const Sample& s){
+    std::lock_guard<std::mutex> lk(wm_);
+    write_latest_locked(s);
+  }
+
+  // Новое измерение: окно, затем последнее (кто увидел последнее, найдет его и в окне).
+  // Время назад - окно начинается заново
+  void publish(const Sample& s){
+    std::lock_guard<std::mutex> lk(wm_);
+    uint64_t h = head_.load(std::memory_order_relaxed);
+    if (h > start_.load(std::memory_order_relaxed) &&
+        (int64_t)s.tt < ring_[(h - 1) % RECENT].ts.load(std::memory_order_relaxed))
+      start_.store(h, std::memory_order_release);
+    claimed_.store(h + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Slot& sl = ring_[h % RECENT];
+    sl.ts.store((int64_t)s.tt, std::memory_order_relaxed);
+    sl.temp.store(s.temp, std::memory_order_relaxed);
+    head_.store(h + 1, std::memory_order_release);
+    write_latest_locked(s);
+  }
+
+  Sample latest() const {
+    Sample s{};
+    for (;;){
+      uint64_t s1 = seq_.load(std::memory_order_acquire);
+      s.tt = (time_t)lt_.load(std::memory_order_relaxed);
+      s.temp = ltemp_.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!(s1 & 1) && seq_.load(std::memory_order_relaxed) == s1) return s;
+    }
+  }
+
+  // Ответ из окна; false - окна нет или [from, to] начинается раньше него (идем в хранилище)
+  bool query(time_t from, time_t to, Stats& st, SampleVec& out, size_t max_points) const {
+    if (!window_) return false;
+    for (int attempt = 0; attempt < 3; attempt++){
+      uint64_t h = head_.load(std::memory_order_acquire);
+      uint64_t lo = std::max(start_.load(std::memory_order_acquire), h > RECENT - GUARD ? h - (RECENT - GUARD) : 0);
+      if (lo >= h) break;
+      auto ts_at = [&](uint64_t i){ return ring_[i % RECENT].ts.load(std::memory_order_relaxed); };
+      // все измерения с ts >= from должны быть в окне: самое старое - строго раньше from
+      bool covered = ts_at(lo) < (int64_t)from;
+      uint64_t a = lo, b = h;
+      while (a < b){ uint64_t m = a + (b - a) / 2; if (ts_at(m) < (int64_t)from) a = m + 1; else b = m; }
+      uint64_t first = a;
+      b = h;
+      while (a < b){ uint64_t m = a + (b - a) / 2; if (ts_at(m) <= (int64_t)to) a = m + 1; else b = m; }
+      uint64_t last = a;
+      Stats part;
+      SampleVec pts(out.get_allocator());
+      size_t n = (size_t)(last - first);
+      size_t step = (n > max_points) ? (n + max_points - 1) / max_points : 1;
+      pts.reserve((n + step - 1) / step);
+      for (uint64_t i = first; i < last; i++){
+        const Slot& sl = ring_[i % RECENT];
+        Sample s{(time_t)sl.ts.load(std::memory_order_relaxed), sl.temp.load(std::memory_order_relaxed)};
+        part.add(s.temp);
+        if ((i - first) % step == 0) pts.push_back(s);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      uint64_t c = claimed_.load(std::memory_order_relaxed);
+      if (start_.load(std::memory_order_relaxed) > lo || (c > RECENT && lo < c - RECENT)) continue;  // затерли
+      if (!covered) break;
+      hits_++;
+      st.merge(part);
+      out.insert(out.end(), pts.begin(), pts.end());
+      return true;
+    }
+    misses_++;
+    return false;
+  }
+
+  std::string stats_json() const {
+    uint64_t h = head_.load(std::memory_order_acquire);
+    uint64_t lo = std::max(start_.load(std::memory_order_acquire), h > RECENT - GUARD ? h - (RECENT - GUARD) : 0);
+    std::ostringstream os;
+    os<<"{\"window\":"<<(window_ ? "true" : "false")<<",\"samples\":"<<(h - lo)
+      <<",\"published\":"<<h<<",\"hits\":"<<hits_.load()<<",\"misses\":"<<misses_.load()<<"}";
+    return os.str();
+  }
+
+private:
+  void write_latest_locked(const Sample& s){
+    uint64_t q = seq_.load(std::memory_order_relaxed);
+    seq_.store(q + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    lt_.store((int64_t)s.tt, std::memory_order_relaxed);
+    ltemp_.store(s.temp, std::memory_order_relaxed);
+    seq_.store(q + 2, std::memory_order_release);
+  }
+
+  struct Slot {
+    std::atomic<int64_t> ts{0};
+    std::atomic<double> temp{0.0};
+  };
+
+  std::atomic<bool> window_{false};
+  std::mutex wm_;                          // только между писателями
+  std::atomic<uint64_t> seq_{0};
+  std::atomic<int64_t> lt_{0};
+  std::atomic<double> ltemp_{0.0};
+  Slot ring_[RECENT];
+  std::atomic<uint64_t> claimed_{0};       // номер слота, запись в который начата, + 1
+  std::atomic<uint64_t> head_{0};          // записано измерений
+  std::atomic<uint64_t> start_{0};         // первый номер непрерывного окна
+  mutable std::atomic<uint64_t> hits_{0}, misses_{0};
+};
+
+// LRU результатов /api/stats: ключ - диапазон [from, to] уже после разбора времени.
+// Запись - итоги и точки графика по [from, edge] и эпоха хранилища. edge = min(to, последнее
+// измерение на момент расчета), а если это и есть последнее измерение - секундой раньше:
+// в его секунду еще дописываются измерения. Диапазон, закончившийся раньше последнего
+// измерения (edge == to), больше не меняется; остальные при следующем запросе достраиваются
+// хвостом (edge, новый край]. Смена эпохи делает записи устаревшими.
+class RangeCache {
+public:
+  void configure(size_t cap_entries){ cap_ = cap_entries; }
+  bool enabled() const { return cap_ > 0; }
+
+  // Запись по ключу: итоги, точки (дописываются в pts), край и эпоха; поднимает ее в начало LRU
+  bool get(time_t from, time_t to, Stats& st, SampleVec& pts, int64_t& edge, uint64_t& epoch){
+    std::lock_guard<std::mutex> lk(m_);
+    auto it = map_.find(Key{(int64_t)from, (int64_t)to});
+    if (it == map_.end()) return false;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    const Entry& e = it->second->second;
+    st = e.st;
+    pts.insert(pts.end(), e.pts.begin(), e.pts.end());
+    edge = e.edge;
+    epoch = e.epoch;
+    return true;
+  }
+
+  void put(time_t from, time_t to, const Stats& st, const SampleVec& pts, int64_t edge, uint64_t epoch){
+    if (!cap_) return;
+    std::lock_guard<std::mutex> lk(m_);
+    Key k{(int64_t)from, (int64_t)to};
+    auto it = map_.find(k);
+    if (it == map_.end()){
+      lru_.emplace_front();
+      it = map_.emplace(k, lru_.begin()).first;
+      lru_.front().first = k;
+    } else {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      bytes_ -= entry_bytes(it->second->second);
+    }
+    Entry& e = it->second->second;
+    e.st = st;
+    e.pts.assign(pts.begin(), pts.end());
+    e.edge = edge;
+    e.epoch = epoch;
+    bytes_ += entry_bytes(e);
+    while (lru_.size() > cap_){
+      bytes_ -= entry_bytes(lru_.back().second);
+      map_.erase(lru_.back().first);
+      lru_.pop_back();
+      evicted_++;
+    }
+  }
+
+  enum class Outcome { Hit, Extended, Miss };
+  void count(Outcome o){ (o == Outcome::Hit ? hits_ : o == Outcome::Extended ? extended_ : misses_)++; }
+
+  std::string stats_json() const {
+    std::lock_guard<std::mutex> lk(m_);
+    std::ostringstream os;
+    os<<"{\"cap\":"<<cap_<<",\"entries\":"<<lru_.size()<<",\"bytes\":"<<bytes_
+      <<",\"hits\":"<<hits_.load()<<",\"extended\":"<<extended_.load()<<",\"misses\":"<<misses_.load()
+      <<",\"evicted\":"<<evicted_<<"}";
+    return os.str();
+  }
+
+private:
+  struct Entry {
+    Stats st;
+    std::vector<Sample> pts;
+    int64_t edge = 0;
+    uint64_t epoch = 0;
+  };
+  using Key = std::pair<int64_t,int64_t>;
+  struct KeyHash {
+    size_t operator()(const Key& k) const { return std::hash<int64_t>()(k.first * 1000003 ^ k.second); }
+  };
+  // память записи: точки, сама запись и узлы списка/таблицы (примерно)
+  static size_t entry_bytes(const Entry& e){ return sizeof(Entry) + e.pts.capacity() * sizeof(Sample) + 64; }
+
+  size_t cap_ = 0;
+  mutable std::mutex m_;
+  std::list<std::pair<Key, Entry>> lru_;   // в начале - последние использованные
+  std::unordered_map<Key, std::list<std::pair<Key, Entry>>::iterator, KeyHash> map_;
+  size_t bytes_ = 0;
+  uint64_t evicted_ = 0;
+  std::atomic<uint64_t> hits_{0}, extended_{0}, misses_{0};
+};
+
+// Метка времени для фаз запроса: rdtsc (десятки тактов) там, где он есть, иначе steady_clock
+// в наносекундах. Перевод тактов в наносекунды - PerfStats::configure
+static inline uint64_t perf_ticks(){
+#ifdef TS_HAVE_RDTSC
+  return (uint64_t)__rdtsc();
+#else
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Время одного запроса по фазам: прием, разбор, выборка данных, сборка ответа, отправка.
+// mark(p) относит к фазе p все, что прошло с предыдущей метки
+struct ReqPerf {
+  enum Phase { Recv, Parse, Query, Render, Send, PHASES };
+  enum Route { Current, Stats, Raw, DebugStats, DebugPerf, Index, Other, ROUTES };
+  uint64_t start = perf_ticks(), last = start;
+  uint64_t t[PHASES] = {};
+  Route route = Other;
+
+  void mark(Phase p){
+    uint64_t n = perf_ticks();
+    t[p] += n - last;
+    last = n;
+  }
+};
+
+// Гистограммы времени фаз по маршрутам. Каждый поток пишет в свой набор счетчиков
+// (thread_local, без общих блокировок и без гонки за кэш-линии), /api/debug/perf
+// складывает наборы всех потоков. Корзины - степени двойки в микросекундах.
+// Запросы дольше slow_ms пишутся в лог с разбивкой по фазам.
+class PerfStats {
+public:
+  // Калибровка тактов по steady_clock (~20 мс) и порог медленного запроса (0 - не писать)
+  void configure(int slow_ms){
+    slow_ms_ = slow_ms;
+#ifdef TS_HAVE_RDTSC
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = perf_ticks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t c1 = perf_ticks();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+    if (c1 > c0) ns_per_tick_ = (double)ns / (double)(c1 - c0);
+#endif
+  }
+
+  // Запрос закончен (ответ отправлен): в гистограммы, медленный - в лог. req - текст запроса
+  void finish(const ReqPerf& r, std::string_view req){
+    uint64_t now = perf_ticks();
+    Shard& sh = shard();
+    RouteStats& rt = sh.routes[r.route];
+    rt.count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t total_ns = ns(now - r.start);
+    for (size_t p=0;p<=ReqPerf::PHASES;p++){
+      uint64_t v = p < ReqPerf::PHASES ? ns(r.t[p]) : total_ns;
+      Hist& h = rt.phase[p];
+      h.sum_ns.fetch_add(v, std::memory_order_relaxed);
+      if (v > h.max_ns.load(std::memory_order_relaxed)) h.max_ns.store(v, std::memory_order_relaxed);
+      h.bucket[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+    }
+    if (slow_ms_ <= 0 || total_ns < (uint64_t)slow_ms_ * 1000000) return;
+    slow_++;
+    std::ostringstream os;
+    os<<"slow request "<<std::fixed<<std::setprecision(2)<<total_ns / 1e6<<" ms: "
+      <<req.substr(0, std::min(req.find('\r'), (size_t)200))<<" (";
+    for (size_t p=0;p<ReqPerf::PHASES;p++) os<<(p ? ", " : "")<<PHASE_NAMES[p]<<" "<<ns(r.t[p]) / 1e6;
+    os<<")";
+    log(LogLevel::Warn, os.str());
+  }
+
+  // JSON: по каждому маршруту с запросами - число запросов и по фазам среднее и максимум,
+  // p50/p90/p99 (верхняя граница корзины) и непустые корзины; все в микросекундах
+  std::string stats_json() const {
+    std::vector<std::shared_ptr<Shard>> shards;
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      shards = shards_;
+    }
+    std::ostringstream os;
+    os<<"{\"clock\":\""<<CLOCK<<"\",\"ns_per_tick\":"<<std::setprecision(4)<<ns_per_tick_
+      <<",\"threads\":"<<shards.size()<<",\"slow_ms\":"<<slow_ms_<<",\"slow\":"<<slow_.load()<<",\"routes\":{";
+    bool first_route = true;
+    for (size_t ri=0;ri<ReqPerf::ROUTES;ri++){
+      uint64_t count = 0;
+      for (auto& sh : shards) count += sh->routes[ri].count.load(std::memory_order_relaxed);
+      if (!count) continue;
+      os<<(first_route ? "" : ",")<<"\""<<ROUTE_NAMES[ri]<<"\":{\"count\":"<<count;
+      first_route = false;
+      for (size_t p=0;p<=ReqPerf::PHASES;p++){
+        uint64_t sum = 0, mx = 0, b[BUCKETS] = {};
+        for (auto& sh : shards){
+          const Hist& h = sh->routes[ri].phase[p];
+          sum += h.sum_ns.load(std::memory_order_relaxed);
+          mx = std::max(mx, h.max_ns.load(std::memory_order_relaxed));
+          for (size_t i=0;i<BUCKETS;i++) b[i] += h.bucket[i].load(std::memory_order_relaxed);
+        }
+        os<<",\""<<(p < ReqPerf::PHASES ? PHASE_NAMES[p] : "total")<<"\":{\"avg_us\":"<<std::fixed<<std::setprecision(2)
+          <<(double)sum / (double)count / 1000.0<<",\"max_us\":"<<(double)mx / 1000.0
+          <<",\"p50_us\":"<<pct(b, count, 0.5)<<",\"p90_us\":"<<pct(b, count, 0.9)<<",\"p99_us\":"<<pct(b, count, 0.99)<<",\"hist_us\":{";
+        bool first = true;
+        for (size_t i=0;i<BUCKETS;i++){
+          if (!b[i]) continue;
+          os<<(first ? "" : ",")<<"\""<<(i+1<BUCKETS ? "le_" + std::to_string(bound_us(i)) : std::string("inf"))<<"\":"<<b[i];
+          first = false;
+        }
+        os<<"}}";
+      }
+      os<<"}";
+    }
+    os<<"}}";
+    return os.str();
+  }
+
+private:
+  static const size_t BUCKETS = 22;   // <=1us, <=2us, ... <=1048576us (~1 с), больше
+  static constexpr const char* PHASE_NAMES[ReqPerf::PHASES] = {"recv", "parse", "query", "render", "send"};
+  static constexpr const char* ROUTE_NAMES[ReqPerf::ROUTES] =
+    {"/api/current", "/api/stats", "/api/raw", "/api/debug/stats", "/api/debug/perf", "/", "other"};
+#ifdef TS_HAVE_RDTSC
+  static constexpr const char* CLOCK = "rdtsc";
+#else
+  static constexpr const char* CLOCK = "steady_clock";
+#endif
+
+  static uint64_t bound_us(size_t i){ return (uint64_t)1 << i; }
+  static size_t bucket_of(uint64_t v_ns){
+    size_t b = 0;
+    while (b+1 < BUCKETS && v_ns > bound_us(b) * 1000) b++;
+    return b;
+  }
+  static uint64_t pct(const uint64_t* b, uint64_t count, double q){
+    uint64_t need = (uint64_t)std::ceil(q * (double)count), acc = 0;
+    for (size_t i=0;i<BUCKETS;i++){
+      acc += b[i];
+      if (acc >= need) return i+1 < BUCKETS ? bound_us(i) : bound_us(BUCKETS - 2) * 2;
+    }
+    return 0;
+  }
+
+  struct Hist {
+    std::atomic<uint64_t> sum_ns{0}, max_ns{0};
+    std::atomic<uint64_t> bucket[BUCKETS] = {};
+  };
+  struct RouteStats {
+    std::atomic<uint64_t> count{0};
+    Hist phase[ReqPerf::PHASES + 1];   // последняя - весь запрос
+  };
+  struct Shard {
+    RouteStats routes[ReqPerf::ROUTES];
+  };
+
+  uint64_t ns(uint64_t ticks) const { return (uint64_t)((double)ticks * ns_per_tick_); }
+
+  // Набор счетчиков потока: создается при первом запросе в потоке и остается в shards_
+  // после его завершения (пул и циклы io_uring живут до конца работы сервера)
+  Shard& shard(){
+    thread_local const PerfStats* owner = nullptr;
+    thread_local Shard* mine = nullptr;
+    if (owner != this){
+      auto sh = std::make_shared<Shard>();
+      std::lock_guard<std::mutex> lk(m_);
+      shards_.push_back(sh);
+      owner = this;
+      mine = sh.get();
+    }
+    return *mine;
+  }
+
+  mutable std::mutex m_;
+  std::vector<std::shared_ptr<Shard>> shards_;
+  double ns_per_tick_ = 1.0;
+  int slow_ms_ = 0;
+  std::atomic<uint64_t> slow_{0};
+};
+
+#ifndef _WIN32
+// Прием измерений из потока: stdin (--ingest-stdin) или именованный канал (--ingest-fifo),
+// например от temp_sim из lab4. Строки "ISOZ,temp" читаются блоками до BLOCK байт, полные
+// строки разбираются пачкой, пачка одним вызовом уходит в писатель хранилища и затем в live.
+// Битые строки пропускаются и считаются. Канал сервер держит открытым и на запись, поэтому
+// уход производителя не дает EOF - можно подключать следующего. Конец stdin - конец приема
+// (сервер продолжает отвечать).
+class StreamIngest {
+public:
+  ~StreamIngest(){ stop(); }
+
+  bool start_stdin(SegmentStore& store, LiveBoard& live){
+    source_ = "stdin";
+    return start(STDIN_FILENO, store, live);
+  }
+
+  bool start_fifo(const std::filesystem::path& path, SegmentStore& store, LiveBoard& live){
+    source_ = "fifo:" + path.string();
+    struct stat st{};
+    if (::stat(path.c_str(), &st) != 0){
+      if (::mkfifo(path.c_str(), 0644) != 0){
+        log(LogLevel::Err, "mkfifo failed: " + path.string() + ": " + std::strerror(errno));
+        return false;
+      }
+    } else if (!S_ISFIFO(st.st_mode)){
+      log(LogLevel::Err, "not a fifo: " + path.string());
+      return false;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0) hold_fd_ = ::open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0 || hold_fd_ < 0){
+      log(LogLevel::Err, "cannot open fifo: " + path.string() + ": " + std::strerror(errno));
+      if (fd >= 0) ::close(fd);
+      return false;
+    }
+    own_fd_ = true;
+    return start(fd, store, live);
+  }
+
+  void stop(){
+    stop_ = true;
+    if (thr_.joinable()) thr_.join();
+    if (own_fd_ && fd_ >= 0) ::close(fd_);
+    if (hold_fd_ >= 0) ::close(hold_fd_);
+    fd_ = hold_fd_ = -1;
+    own_fd_ = false;
+  }
+
+  std::string stats_json() const {
+    std::ostringstream os;
+    os<<"{\"source\":\""<<source_<<"\",\"running\":"<<(running_ ? "true" : "false")
+      <<",\"bytes\":"<<bytes_.load()<<",\"lines\":"<<lines_.load()<<",\"bad\":"<<bad_.load()
+      <<",\"batches\":"<<batches_.load()<<",\"max_batch\":"<<max_batch_.load()<<"}";
+    return os.str();
+  }
+
+private:
+  static const size_t BLOCK = 1 << 20;
+
+  bool start(int fd, SegmentStore& store, LiveBoard& live){
+    fd_ = fd;
+    store_ = &store;
+    live_ = &live;
+    running_ = true;
+    thr_ = std::thread([this]{ run(); });
+    log(LogLevel::Info, "ingest from " + source_);
+    return true;
+  }
+
+  void run(){
+    std::vector<char> buf(BLOCK);
+    std::vector<Sample> batch;
+    size_t have = 0;
+    while (!stop_ && !g_stop){
+      pollfd p{fd_, POLLIN, 0};
+      int r = ::poll(&p, 1, 100);
+      store_->flush_if_due();   // без новых данных буфер писателя сбрасывается по flush_ms
+      if (r < 0 && errno != EINTR) break;
+      if (r <= 0) continue;
+      ssize_t n = ::read(fd_, buf.data() + have, buf.size() - have);
+      if (n < 0){
+        if (errno == EINTR || errno == EAGAIN) continue;
+        log(LogLevel::Err, std::string("ingest read failed: ") + std::strerror(errno));
+        break;
+      }
+      bool eof = n == 0;
+      have += (size_t)n;
+      bytes_ += (uint64_t)n;
+      const char* b = buf.data();
+      const char* end = b + have;
+      batch.clear();
+      while (const char* nl = find_newline(b, end)){
+        take_line(b, (size_t)(nl - b), batch);
+        b = nl + 1;
+      }
+      if (eof && b < end){ take_line(b, (size_t)(end - b), batch); b = end; }   // последняя строка без '\n'
+      have = (size_t)(end - b);
+      if (have == buf.size()){ bad_++; have = 0; }   // "строка" длиной в блок - мусор
+      std::memmove(buf.data(), b, have);
+      if (!batch.empty()){
+        store_->append_batch(batch.data(), batch.size());
+        for (auto& s : batch) live_->publish(s);
+        batches_++;
+        if (batch.size() > max_batch_) max_batch_ = batch.size();
+      }
+      if (eof){
+        log(LogLevel::Info, "ingest: end of " + source_ + ", " + std::to_string(lines_.load()) + " samples");
+        break;
+      }
+    }
+    running_ = false;
+  }
+
+  void take_line(const char* p, size_t len, std::vector<Sample>& out){
+    if (len && p[len-1] == '\r') len--;
+    if (!len) return;
+    Sample s{};
+    if (parse_csv_fast(p, len, s)){
+      out.push_back(s);
+      lines_++;
+    } else bad_++;
+  }
+
+  std::string source_;
+  int fd_ = -1, hold_fd_ = -1;
+  bool own_fd_ = false;
+  SegmentStore* store_ = nullptr;
+  LiveBoard* live_ = nullptr;
+  std::thread thr_;
+  std::atomic<bool> stop_{false}, running_{false};
+  std::atomic<uint64_t> bytes_{0}, lines_{0}, bad_{0}, batches_{0}, max_batch_{0};
+};
 #endif
-}
 
-// Парсинг строгого ISO UTC: YYYY-MM-DDTHH:MM:SSZ
-static time_t parse_iso_utc(const std::string& iso){
-  if (iso.size() < 20) return (time_t)-1;
-  if (!(iso[4]=='-' && iso[7]=='-' && iso[10]=='T' && iso[13]==':' && iso[16]==':' && iso.back()=='Z')) return (time_t)-1;
+// Общее состояние сервера: живет в main, потоки работают по ссылке
+struct ServerState {
+  std::filesystem::path data_dir;
+  LiveBoard live;              // последнее измерение (/api/current) и окно последних
+  SegmentStore store;          // сегменты csv с индексами и итогами
+  WorkerPool pool;             // обработчики соединений
+  RangeCache ranges;           // готовые ответы /api/stats по диапазонам
+  PerfStats perf;              // время фаз запросов по маршрутам (/api/debug/perf)
+  std::function<std::string()> io_stats;  // счетчики сетевого цикла io_uring (если включен)
+  std::function<std::string()> ingest_stats;  // счетчики приема из stdin/канала (если включен)
+};
 
-  std::tm t{};
-  try{
-    t.tm_year = std::stoi(iso.substr(0,4)) - 1900;
-    t.tm_mon  = std::stoi(iso.substr(5,2)) - 1;
-    t.tm_mday = std::stoi(iso.substr(8,2));
-    t.tm_hour = std::stoi(iso.substr(11,2));
-    t.tm_min  = std::stoi(iso.substr(14,2));
-    t.tm_sec  = std::stoi(iso.substr(17,2));
-    t.tm_isdst = 0;
-  } catch(...) { return (time_t)-1; }
+// HTTP ответ целиком: байты [off, buf.size()). Тело пишется в buf сразу за местом,
+// оставленным под заголовки, заголовки потом ставятся вплотную перед ним - тело не копируется.
+// У /api/raw в buf только заголовки, тело - байты [body_from, body_from + body_len) из body
+struct HttpReply {
+  std::string buf;
+  size_t off = 0;
+  std::shared_ptr<const RawBody> body;
+  uint64_t body_from = 0, body_len = 0;
+  const char* data() const { return buf.data() + off; }
+  size_t size() const { return buf.size() - off; }
+};
 
-  return timegm_portable(&t);
+static std::string_view http_status_line(int code){
+  return code==200 ? "HTTP/1.1 200 OK\r\n" :
+         code==206 ? "HTTP/1.1 206 Partial Content\r\n" :
+         code==404 ? "HTTP/1.1 404 Not Found\r\n" :
+         code==416 ? "HTTP/1.1 416 Range Not Satisfiable\r\n" :
+         code==503 ? "HTTP/1.1 503 Service Unavailable\r\n" : "HTTP/1.1 500 Internal Server Error\r\n";
 }
 
-// Форматирование time_t -> ISO UTC
-static std::string iso_utc_from(time_t tt){
-  std::tm t{};
-  if(!gmtime_r_portable(&tt, &t)) return "1970-01-01T00:00:00Z";
-  std::ostringstream os;
-  os << std::put_time(&t, "%Y-%m-%dT%H:%M:%SZ");
-  return os.str();
+// Заголовки перед телом, лежащим в r.buf с позиции head
+static void http_finish(HttpReply& r, size_t head, int code, std::string_view content_type){
+  std::string_view status = http_status_line(code);
+  char len[24];
+  size_t len_n = (size_t)(std::to_chars(len, len + sizeof(len), (uint64_t)(r.buf.size() - head)).ptr - len);
+  const std::string_view parts[] = {status, "Content-Type: ", content_type, "\r\nContent-Length: ",
+    std::string_view(len, len_n), "\r\nConnection: close\r\nAccess-Control-Allow-Origin: *\r\n\r\n"};
+  size_t n = 0;
+  for (auto& v : parts) n += v.size();
+  if (n > head){ r.buf.insert(0, n - head, ' '); head = n; }   // не влезло в запас
+  r.off = head - n;
+  char* p = &r.buf[r.off];
+  for (auto& v : parts){ std::memcpy(p, v.data(), v.size()); p += v.size(); }
 }
 
-// Hex символ -> число 0..15
-static int hexval(char c){
-  if (c>='0' && c<='9') return c - '0';
-  if (c>='a' && c<='f') return 10 + (c - 'a');
-  if (c>='A' && c<='F') return 10 + (c - 'A');
-  return -1;
+// Формирование HTTP ответа из готового тела (короткие и отладочные ответы)
+static HttpReply http_response(int code, std::string_view content_type, std::string_view body){
+  const size_t HEAD = 160;
+  HttpReply r;
+  r.buf.reserve(HEAD + body.size());
+  r.buf.resize(HEAD);
+  r.buf.append(body);
+  http_finish(r, HEAD, code, content_type);
+  return r;
 }
 
-// Декодирование URL query (percent-encoding +)
-static std::string url_decode(const std::string& s){
-  std::string out; out.reserve(s.size());
-  for (size_t i=0;i<s.size();i++){
-    if (s[i]=='%' && i+2<s.size()){
-      int a=hexval(s[i+1]), b=hexval(s[i+2]);
-      if (a>=0 && b>=0){
-        out.push_back(char((a<<4)|b));
-        i+=2;
-        continue;
+// Ответ /api/raw: CSV из body, целиком (200) или один диапазон байт из заголовка Range (206).
+// Диапазон за концом - 416. Несколько диапазонов или непонятный Range - весь файл (RFC 9110).
+// ETag - отпечаток тела; If-Range с другим значением (или датой) - тоже весь файл
+static HttpReply http_raw_response(std::shared_ptr<const RawBody> body, std::string_view range, std::string_view if_range){
+  uint64_t total = body->size(), a = 0, b = total;   // [a, b)
+  int code = 200;
+  char etag[18] = {'"'};
+  for (int i=0;i<16;i++) etag[1 + i] = "0123456789abcdef"[(body->tag() >> (60 - 4*i)) & 0xf];
+  etag[17] = '"';
+  std::string_view tag(etag, sizeof(etag));
+  if (!if_range.empty() && if_range != tag) range = {};
+  if (range.substr(0, 6) == "bytes=" && range.find(',') == std::string_view::npos){
+    std::string_view spec = range.substr(6);
+    size_t dash = spec.find('-');
+    auto num = [](std::string_view v, uint64_t& x){
+      return !v.empty() && std::from_chars(v.data(), v.data() + v.size(), x).ptr == v.data() + v.size();
+    };
+    uint64_t x = 0, y = 0;
+    if (dash != std::string_view::npos){
+      std::string_view l = spec.substr(0, dash), r = spec.substr(dash + 1);
+      if (l.empty() && num(r, y)){                         // последние y байт
+        code = y ? 206 : 416;
+        a = total - std::min(y, total);
+      } else if (num(l, x) && (r.empty() || (num(r, y) && y >= x))){
+        code = x < total ? 206 : 416;
+        a = x;
+        b = r.empty() ? total : std::min(y + 1, total);
       }
+      if (code == 206 && a >= b) code = 416;   // пустое тело
     }
-    if (s[i]=='+'){ out.push_back(' '); continue; }
-    out.push_back(s[i]);
   }
-  return out;
+  std::string head(http_status_line(code));
+  head += "Content-Type: text/csv; charset=utf-8\r\nAccept-Ranges: bytes\r\nETag: ";
+  head += tag;
+  head += "\r\n";
+  if (code == 206) head += "Content-Range: bytes " + std::to_string(a) + "-" + std::to_string(b - 1) + "/" + std::to_string(total) + "\r\n";
+  if (code == 416){
+    head += "Content-Range: bytes */" + std::to_string(total) + "\r\n";
+    a = b = 0;
+  }
+  head += "Content-Length: " + std::to_string(b - a) + "\r\nConnection: close\r\nAccess-Control-Allow-Origin: *\r\n\r\n";
+  HttpReply r;
+  r.buf = std::move(head);
+  if (b > a){
+    r.body = std::move(body);
+    r.body_from = a;
+    r.body_len = b - a;
+  }
+  return r;
 }
 
-// Парсинг строки "a=1&b=2" -> map
-static std::unordered_map<std::string,std::string> parse_query(const std::string& q){
-  std::unordered_map<std::string,std::string> m;
-  size_t i=0;
-  while(i<q.size()){
-    size_t amp = q.find('&', i);
-    if (amp==std::string::npos) amp=q.size();
-    size_t eq = q.find('=', i);
+// JSON ответ, который пишется прямо в буфер HttpReply: ключи и разделители - литералы
+// (длина известна при компиляции), числа - std::to_chars, время - format_iso_utc.
+// Ни потоков, ни временных строк
+class JsonOut {
+public:
+  static constexpr size_t HEAD = 160;   // запас под заголовки
 
-    if (eq==std::string::npos || eq>amp){
-      std::string k = url_decode(q.substr(i, amp-i));
-      if(!k.empty()) m[k] = "";
-    } else {
-      std::string k = url_decode(q.substr(i, eq-i));
-      std::string v = url_decode(q.substr(eq+1, amp-(eq+1)));
-      if(!k.empty()) m[k] = v;
-    }
-    i = amp + 1;
+  explicit JsonOut(size_t body_hint){
+    r_.buf.reserve(HEAD + body_hint);
+    r_.buf.resize(HEAD);
   }
-  return m;
-}
 
-// Экранирование строки для JSON
-static std::string json_escape(const std::string& s){
-  std::ostringstream os;
-  for(char c: s){
-    switch(c){
-      case '\\': os<<"\\\\"; break;
-      case '"':  os<<"\\\""; break;
-      case '\n': os<<"\\n"; break;
-      case '\r': os<<"\\r"; break;
-      case '\t': os<<"\\t"; break;
-      default:
-        if ((unsigned char)c < 0x20) {
-          os<<"\\u"<<std::hex<<std::setw(4)<<std::setfill('0')<<(int)(unsigned char)c<<std::dec;
-        } else os<<c;
+  template <size_t N>
+  JsonOut& raw(const char (&lit)[N]){ r_.buf.append(lit, N - 1); return *this; }
+
+  // Строка в кавычках с экранированием
+  JsonOut& str(std::string_view s){
+    std::string& b = r_.buf;
+    b.push_back('"');
+    for (char c : s){
+      switch(c){
+        case '\\': b.append("\\\\", 2); break;
+        case '"':  b.append("\\\"", 2); break;
+        case '\n': b.append("\\n", 2); break;
+        case '\r': b.append("\\r", 2); break;
+        case '\t': b.append("\\t", 2); break;
+        default:
+          if ((unsigned char)c < 0x20){
+            const char* hex = "0123456789abcdef";
+            char u[6] = {'\\', 'u', '0', '0', hex[(unsigned char)c >> 4], hex[c & 15]};
+            b.append(u, 6);
+          } else b.push_back(c);
+      }
     }
+    b.push_back('"');
+    return *this;
   }
-  return os.str();
-}
 
-// Одна запись измерения
-struct Sample { time_t tt{}; double temp{}; };
-
-// Парсинг CSV строки "ISO,temp"
-static bool parse_csv_line(const std::string& line, Sample& s){
-  auto p = line.find(',');
-  if (p==std::string::npos) return false;
-  std::string ts = line.substr(0,p);
-  std::string vs = line.substr(p+1);
-
-  time_t tt = parse_iso_utc(ts);
-  if (tt==(time_t)-1) return false;
-
-  char* end=nullptr;
-  double v = std::strtod(vs.c_str(), &end);
-  if (end==vs.c_str()) return false;
+  // "YYYY-MM-DDTHH:MM:SSZ"
+  JsonOut& iso(time_t tt){
+    char q[22];
+    q[0] = q[21] = '"';
+    format_iso_utc(tt, q + 1);
+    r_.buf.append(q, 22);
+    return *this;
+  }
 
-  s.tt = tt;
-  s.temp = v;
-  return true;
-}
+  JsonOut& num(uint64_t v){
+    char d[24];
+    r_.buf.append(d, (size_t)(std::to_chars(d, d + sizeof(d), v).ptr - d));
+    return *this;
+  }
 
-// Чтение последней строки CSV (для восстановления latest при старте)
-static bool read_last_sample(const std::filesystem::path& file, Sample& out){
-  std::ifstream f(file);
-  if(!f) return false;
-  std::string line, last;
-  while(std::getline(f,line)){
-    if(!line.empty()) last=line;
+  // Как std::fixed << std::setprecision(3)
+  JsonOut& fixed3(double v){
+    char d[330];   // хватает на любой double в фиксированной записи
+    auto res = std::to_chars(d, d + sizeof(d), v, std::chars_format::fixed, 3);
+    r_.buf.append(d, (size_t)(res.ptr - d));
+    return *this;
   }
-  if(last.empty()) return false;
-  return parse_csv_line(last, out);
-}
 
-// Простая статистика по диапазону
-struct Stats {
-  size_t count=0;
-  double sum=0.0;
-  double minv= std::numeric_limits<double>::infinity();
-  double maxv=-std::numeric_limits<double>::infinity();
-  void add(double x){
-    count++; sum+=x;
-    if (x<minv) minv=x;
-    if (x>maxv) maxv=x;
+  HttpReply finish(int code = 200){
+    http_finish(r_, HEAD, code, "application/json");
+    return std::move(r_);
   }
-  double avg() const { return count? (sum/double(count)) : std::numeric_limits<double>::quiet_NaN(); }
-};
 
-// Формирование HTTP ответа
-static std::string http_response(int code, const std::string& content_type, const std::string& body){
-  std::ostringstream os;
-  if (code==200) os<<"HTTP/1.1 200 OK\r\n";
-  else if (code==404) os<<"HTTP/1.1 404 Not Found\r\n";
-  else os<<"HTTP/1.1 500 Internal Server Error\r\n";
-
-  os<<"Content-Type: "<<content_type<<"\r\n";
-  os<<"Content-Length: "<<body.size()<<"\r\n";
-  os<<"Connection: close\r\n";
-  os<<"Access-Control-Allow-Origin: *\r\n";
-  os<<"\r\n";
-  os<<body;
-  return os.str();
-}
+private:
+  HttpReply r_;
+};
 
 // Отправка всего буфера в сокет
-static bool send_all(socket_t s, const std::string& data){
-  const char* p = data.data();
-  size_t left = data.size();
+static bool send_all(socket_t s, const char* p, size_t left){
   while(left){
 #ifdef _WIN32
     int n = ::send(s, p, (int)left, 0);
@@ -273,149 +3592,840 @@ static std::string recv_request(socket_t s){
   return buf;
 }
 
-// Обработка одного клиента: /api/current и /api/stats
-static void handle_client(socket_t c,
-                          const std::filesystem::path& data_dir,
-                          std::mutex& mtx,
-                          Sample& latest)
-{
-  std::string req = recv_request(c);
+// Итоги и точки по [from, to]: окно live, иначе хранилище (без кэша диапазонов).
+// Длинный диапазон хранилище считает по пирамиде - окно live для него не берем
+static void compute_range(ServerState& srv, time_t from, time_t to, Stats& st, SampleVec& out, size_t max_points){
+  if (srv.store.pyramid_level(from, to, max_points) >= 0 || !srv.live.query(from, to, st, out, max_points))
+    srv.store.query(from, to, st, out, max_points);
+}
+
+// Шаг прореживания: в ответ идут измерения с номерами 0, step, 2*step... (так режут все источники)
+static size_t sample_step(size_t n, size_t max_points){
+  return n > max_points ? (n + max_points - 1) / max_points : 1;
+}
+
+// Дописать к итогам st и точкам out (прорежены по st.count) хвост tst/tail без прореживания.
+// false (st и out не тронуты) - новый шаг прореживания не кратен старому
+static bool merge_tail(Stats& st, SampleVec& out, const Stats& tst, const SampleVec& tail, size_t max_points){
+  size_t n = st.count, s = sample_step(n, max_points), s2 = sample_step(n + tst.count, max_points);
+  if (s2 % s != 0) return false;
+  size_t w = 0;
+  for (size_t i=0;i<out.size();i++) if (i * s % s2 == 0) out[w++] = out[i];
+  out.resize(w);
+  for (size_t j=0;j<tail.size();j++) if ((n + j) % s2 == 0) out.push_back(tail[j]);
+  st.merge(tst);
+  return true;
+}
+
+// /api/stats через кэш диапазонов. Ответ строится по [from, min(to, последнее измерение)].
+// В секунду последнего измерения (живой край) еще могут прийти измерения, поэтому запись
+// кэша заканчивается секундой раньше, а сам край считается на каждый запрос и дописывается
+// хвостом. Запись, отставшая от края, так же достраивается, если новый шаг прореживания
+// кратен старому (тогда нужные точки - часть старых плюс часть хвоста), иначе считается заново.
+// Точки диапазона по пирамиде - средние по интервалам, хвостом их не достроить: такой
+// диапазон считается по [from, to] и пересчитывается, пока край живой или сдвинулся
+static void stats_query(ServerState& srv, time_t from, time_t to, Stats& st, SampleVec& out, size_t max_points){
+  if (!srv.ranges.enabled()){ compute_range(srv, from, to, st, out, max_points); return; }
+  const size_t TAIL_MAX = 4096;   // хвост длиннее - проще пересчитать
+  int64_t newest = srv.store.newest_ts();   // догоняет индекс: опоздавшие строки сдвигают эпоху
+  uint64_t epoch = srv.store.epoch();
+  int64_t edge = std::min<int64_t>((int64_t)to, newest);
+  int64_t cut = (edge == newest && edge >= (int64_t)from) ? edge - 1 : edge;   // конец записи кэша
+  bool exact = srv.store.pyramid_level(from, to, max_points) < 0;
+
+  // [a, b] без прореживания дописать к st/out
+  auto add_tail = [&](int64_t a, int64_t b){
+    a = std::max<int64_t>(a, (int64_t)from);
+    if (a > b) return true;
+    if (srv.store.pyramid_level((time_t)a, (time_t)b, TAIL_MAX) >= 0) return false;
+    Stats tst;
+    SampleVec tail(out.get_allocator());
+    compute_range(srv, (time_t)a, (time_t)b, tst, tail, TAIL_MAX);
+    return tst.count <= TAIL_MAX && merge_tail(st, out, tst, tail, max_points);
+  };
 
-  std::istringstream is(req);
-  std::string method, target, ver;
-  is >> method >> target >> ver;
+  int64_t c_edge = 0;
+  uint64_t c_epoch = 0;
+  if (srv.ranges.get(from, to, st, out, c_edge, c_epoch) && c_epoch == epoch && c_edge <= cut){
+    if (c_edge == edge){ srv.ranges.count(RangeCache::Outcome::Hit); return; }
+    if (exact && add_tail(c_edge + 1, cut)){
+      if (c_edge != cut) srv.ranges.put(from, to, st, out, cut, epoch);
+      if (add_tail(cut + 1, edge)){
+        srv.ranges.count(c_edge == cut ? RangeCache::Outcome::Hit : RangeCache::Outcome::Extended);
+        return;
+      }
+    }
+  }
+
+  st = Stats{};
+  out.clear();
+  if (!exact){
+    compute_range(srv, from, to, st, out, max_points);
+    srv.ranges.put(from, to, st, out, cut, epoch);
+  } else {
+    if (cut >= (int64_t)from) compute_range(srv, from, (time_t)cut, st, out, max_points);
+    srv.ranges.put(from, to, st, out, cut, epoch);
+    if (!add_tail(cut + 1, edge)){
+      st = Stats{};
+      out.clear();
+      compute_range(srv, from, (time_t)edge, st, out, max_points);
+    }
+  }
+  srv.ranges.count(RangeCache::Outcome::Miss);
+}
+
+// Следующее слово запроса (разделители - пробельные символы, как у operator>>)
+static std::string_view next_token(std::string_view s, size_t& i){
+  auto ws = [](char c){ return c==' ' || c=='\t' || c=='\r' || c=='\n' || c=='\v' || c=='\f'; };
+  while (i < s.size() && ws(s[i])) i++;
+  size_t b = i;
+  while (i < s.size() && !ws(s[i])) i++;
+  return s.substr(b, i - b);
+}
+
+// Время из параметра запроса: ISO с Z, (time_t)-1 - не разобрано
+static time_t parse_time_param(const std::pmr::string& v){
+  time_t t;
+  if (v.size() == 20 && parse_iso_fast(v.data(), t)) return t;
+  return parse_iso_utc(std::string(v));
+}
+
+// Разбор запроса и готовый HTTP ответ: /api/current, /api/stats и т.д.
+// (не зависит от того, как читается и пишется сокет). Временные данные запроса
+// (параметры, точки графика) берутся из арены на стеке, ответ пишется одним буфером.
+// В pf - маршрут и метки фаз parse/query; остаток до возврата вызывающий относит к render
+static HttpReply route_request(std::string_view req, ServerState& srv, ReqPerf& pf)
+{
+  size_t pos = 0;
+  std::string_view method = next_token(req, pos);
+  std::string_view target = next_token(req, pos);
 
   if (method != "GET" || target.empty()){
-    send_all(c, http_response(404, "text/plain; charset=utf-8", ""));
-    return;
+    return http_response(404, "text/plain; charset=utf-8", "");
   }
 
-  std::string path = target;
-  std::string query;
+  std::string_view path = target;
+  std::string_view query;
   auto qpos = target.find('?');
-  if (qpos!=std::string::npos){
+  if (qpos!=std::string_view::npos){
     path = target.substr(0,qpos);
     query = target.substr(qpos+1);
   }
 
-  // Текущее значение: берется из latest (под mutex)
-  if (path == "/api/current"){
-    Sample cur{};
-    { std::lock_guard<std::mutex> lk(mtx); cur = latest; }
+  pf.mark(ReqPerf::Parse);
 
-    std::ostringstream body;
-    body<<"{\"ts\":\""<<json_escape(iso_utc_from(cur.tt))<<"\",\"temp\":"
-        <<std::fixed<<std::setprecision(3)<<cur.temp<<"}";
-    send_all(c, http_response(200, "application/json", body.str()));
-    return;
+  // Текущее значение: берется из live (seqlock, без блокировок)
+  if (path == "/api/current"){
+    pf.route = ReqPerf::Current;
+    Sample cur = srv.live.latest();
+    pf.mark(ReqPerf::Query);
+    return JsonOut(64).raw("{\"ts\":").iso(cur.tt).raw(",\"temp\":").fixed3(cur.temp).raw("}").finish();
   }
 
   // Статистика по CSV в диапазоне времени from..to
   if (path == "/api/stats"){
-    auto q = parse_query(query);
-    auto itf = q.find("from");
-    auto itt = q.find("to");
-    if (itf==q.end() || itt==q.end()){
-      send_all(c, http_response(500, "application/json", "{\"error\":\"from/to required\"}"));
-      return;
+    pf.route = ReqPerf::Stats;
+    // 300 точек по 16 байт и строки параметров помещаются в арену без обращения к куче
+    alignas(std::max_align_t) char arena_buf[8192];
+    std::pmr::monotonic_buffer_resource arena(arena_buf, sizeof(arena_buf));
+    std::pmr::string from_s(&arena), to_s(&arena);
+    if (!query_param(query, "from", from_s) || !query_param(query, "to", to_s)){
+      return http_response(500, "application/json", "{\"error\":\"from/to required\"}");
     }
 
-    time_t from = parse_iso_utc(itf->second);
-    time_t to   = parse_iso_utc(itt->second);
+    time_t from = parse_time_param(from_s);
+    time_t to   = parse_time_param(to_s);
     if (from==(time_t)-1 || to==(time_t)-1 || to<=from){
-      send_all(c, http_response(500, "application/json", "{\"error\":\"bad from/to\"}"));
-      return;
-    }
-
-    std::filesystem::path file = data_dir / "measurements.csv";
-    std::ifstream f(file);
-
-    Stats st;
-    std::vector<Sample> samples;
-    samples.reserve(2048);
-
-    if (f){
-      std::string line;
-      while(std::getline(f,line)){
-        if(line.empty()) continue;
-        Sample s{};
-        if(!parse_csv_line(line,s)) continue;
-        if (s.tt >= from && s.tt <= to){
-          st.add(s.temp);
-          samples.push_back(s);
-        }
-      }
+      return http_response(500, "application/json", "{\"error\":\"bad from/to\"}");
     }
 
     // Ограничение количества точек, чтобы GUI не умер из за точек
     const size_t MAXP = 300;
-    if (samples.size() > MAXP){
-      size_t step = (samples.size() + MAXP - 1) / MAXP;
-      std::vector<Sample> ds;
-      ds.reserve((samples.size()+step-1)/step);
-      for(size_t i=0;i<samples.size();i+=step) ds.push_back(samples[i]);
-      samples.swap(ds);
-    }
-
-    std::ostringstream body;
-    body<<"{";
-    body<<"\"from\":\""<<json_escape(itf->second)<<"\",";
-    body<<"\"to\":\""<<json_escape(itt->second)<<"\",";
-    body<<"\"count\":"<<st.count<<",";
+    Stats st;
+    SampleVec samples(&arena);
+    pf.mark(ReqPerf::Parse);
+    stats_query(srv, from, to, st, samples, MAXP);
+    pf.mark(ReqPerf::Query);
 
+    JsonOut body(160 + samples.size() * 48);
+    body.raw("{\"from\":").str(from_s).raw(",\"to\":").str(to_s).raw(",\"count\":").num(st.count);
     if (st.count){
-      body<<"\"avg\":"<<std::fixed<<std::setprecision(3)<<st.avg()<<",";
-      body<<"\"min\":"<<std::fixed<<std::setprecision(3)<<st.minv<<",";
-      body<<"\"max\":"<<std::fixed<<std::setprecision(3)<<st.maxv<<",";
+      body.raw(",\"avg\":").fixed3(st.avg()).raw(",\"min\":").fixed3(st.minv).raw(",\"max\":").fixed3(st.maxv);
     } else {
-      body<<"\"avg\":null,\"min\":null,\"max\":null,";
+      body.raw(",\"avg\":null,\"min\":null,\"max\":null");
     }
-
-    body<<"\"samples\":[";
+    body.raw(",\"samples\":[");
     for(size_t i=0;i<samples.size();i++){
-      if(i) body<<",";
-      body<<"{\"ts\":\""<<json_escape(iso_utc_from(samples[i].tt))<<"\",\"temp\":"
-          <<std::fixed<<std::setprecision(3)<<samples[i].temp<<"}";
+      if(i) body.raw(",");
+      body.raw("{\"ts\":").iso(samples[i].tt).raw(",\"temp\":").fixed3(samples[i].temp).raw("}");
+    }
+    return body.raw("]}").finish();
+  }
+
+  // Сырые строки CSV за [from, to]: тело не собирается в памяти, а отправляется из файлов
+  // сегментов (sendfile/splice); поддерживается Range для докачки
+  if (path == "/api/raw"){
+    pf.route = ReqPerf::Raw;
+    alignas(std::max_align_t) char arena_buf[1024];
+    std::pmr::monotonic_buffer_resource arena(arena_buf, sizeof(arena_buf));
+    std::pmr::string from_s(&arena), to_s(&arena);
+    if (!query_param(query, "from", from_s) || !query_param(query, "to", to_s)){
+      return http_response(500, "application/json", "{\"error\":\"from/to required\"}");
+    }
+    time_t from = parse_time_param(from_s);
+    time_t to   = parse_time_param(to_s);
+    if (from==(time_t)-1 || to==(time_t)-1 || to<=from){
+      return http_response(500, "application/json", "{\"error\":\"bad from/to\"}");
     }
-    body<<"]}";
+    pf.mark(ReqPerf::Parse);
+    auto body = std::make_shared<RawBody>();
+    srv.store.raw(from, to, *body);
+    pf.mark(ReqPerf::Query);
+    return http_raw_response(std::move(body), header_value(req, "range"), header_value(req, "if-range"));
+  }
 
-    send_all(c, http_response(200, "application/json", body.str()));
-    return;
+  // Отладка: счетчики пула обработчиков
+  if (path == "/api/debug/stats"){
+    pf.route = ReqPerf::DebugStats;
+    std::string body = "{\"pool\":" + srv.pool.stats_json() +
+                       ",\"appender\":" + srv.store.appender().stats_json() +
+                       ",\"segments\":" + srv.store.stats_json() +
+                       ",\"cache\":" + srv.store.cache_json() +
+                       ",\"live\":" + srv.live.stats_json() +
+                       ",\"ranges\":" + srv.ranges.stats_json() +
+                       ",\"io\":" + (srv.io_stats ? srv.io_stats() : std::string("{\"backend\":\"threads\"}")) +
+                       (srv.ingest_stats ? ",\"ingest\":" + srv.ingest_stats() : std::string()) + "}";
+    return http_response(200, "application/json", body);
+  }
+
+  // Отладка: время фаз запросов по маршрутам
+  if (path == "/api/debug/perf"){
+    pf.route = ReqPerf::DebugPerf;
+    return http_response(200, "application/json", srv.perf.stats_json());
   }
 
   // Мини-страница подсказка
   if (path == "/" || path == "/index.html"){
+    pf.route = ReqPerf::Index;
     const char* html =
       "<!doctype html><html><head><meta charset='utf-8'><title>Temp Server</title></head>"
       "<body><h3>Temp Server</h3><ul>"
       "<li>/api/current</li>"
       "<li>/api/stats?from=YYYY-MM-DDTHH:MM:SSZ&to=YYYY-MM-DDTHH:MM:SSZ</li>"
+      "<li>/api/raw?from=YYYY-MM-DDTHH:MM:SSZ&to=YYYY-MM-DDTHH:MM:SSZ</li>"
+      "<li>/api/debug/stats</li>"
+      "<li>/api/debug/perf</li>"
       "</ul></body></html>";
-    send_all(c, http_response(200, "text/html; charset=utf-8", html));
-    return;
+    return http_response(200, "text/html; charset=utf-8", html);
+  }
+
+  return http_response(404, "text/plain; charset=utf-8", "");
+}
+
+// Байты [pos, end) тела RawBody в сокет. Куски файлов на Linux уходят sendfile (ядро
+// копирует из page cache в сокет), в других ОС - через буфер 64 КБ; строки TBIN - send
+static bool send_body(socket_t c, const RawBody& body, uint64_t pos, uint64_t end){
+  std::string buf;
+  while (pos < end){
+    RawBody::Chunk ch = body.chunk(pos, (size_t)std::min<uint64_t>(end - pos, 1u << 30), buf);
+    size_t n = (size_t)std::min<uint64_t>(ch.len, end - pos);
+    if (ch.fd < 0){
+      if (!send_all(c, ch.data, n)) return false;
+      pos += n;
+      continue;
+    }
+#ifdef __linux__
+    off_t off = (off_t)ch.off;
+    while (n > 0){
+      ssize_t k = ::sendfile(c, ch.fd, &off, n);
+      if (k < 0 && errno == EINTR) continue;
+      if (k <= 0) return false;
+      n -= (size_t)k;
+      pos += (uint64_t)k;
+    }
+#else
+    buf.resize(64 * 1024);
+    while (n > 0){
+      size_t want = std::min(n, buf.size());
+  #ifdef _WIN32
+      if (_lseeki64(ch.fd, (__int64)ch.off, SEEK_SET) < 0) return false;
+      int k = _read(ch.fd, &buf[0], (unsigned)want);
+  #else
+      ssize_t k = ::pread(ch.fd, &buf[0], want, (off_t)ch.off);
+  #endif
+      if (k <= 0 || !send_all(c, buf.data(), (size_t)k)) return false;
+      ch.off += (uint64_t)k;
+      n -= (size_t)k;
+      pos += (uint64_t)k;
+    }
+#endif
   }
+  return true;
+}
 
-  send_all(c, http_response(404, "text/plain; charset=utf-8", ""));
+// Обработка одного клиента в потоке пула: блокирующие recv/send
+static void handle_client(socket_t c, ServerState& srv){
+  ReqPerf pf;
+  std::string req = recv_request(c);
+  pf.mark(ReqPerf::Recv);
+  HttpReply r = route_request(req, srv, pf);
+  pf.mark(ReqPerf::Render);
+  if (send_all(c, r.data(), r.size()) && r.body) send_body(c, *r.body, r.body_from, r.body_from + r.body_len);
+  pf.mark(ReqPerf::Send);
+  srv.perf.finish(pf, req);
 }
 
+#ifdef TS_HAVE_URING
+// Минимальная обертка над io_uring без liburing: setup/enter/register через syscall,
+// кольца отображаются в память, SQE копятся и уходят одним io_uring_enter.
+class URing {
+public:
+  URing() = default;
+  URing(const URing&) = delete;
+  URing& operator=(const URing&) = delete;
+  ~URing(){ close(); }
+
+  bool init(unsigned entries){
+    io_uring_params p{};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    fd_ = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd_ < 0) return false;
+    sq_sz_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_sz_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    single_ = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_) sq_sz_ = cq_sz_ = std::max(sq_sz_, cq_sz_);
+    sq_ = mmap(nullptr, sq_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ == MAP_FAILED){ sq_ = nullptr; close(); return false; }
+    cq_ = single_ ? sq_ : mmap(nullptr, cq_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    if (cq_ == MAP_FAILED){ cq_ = nullptr; close(); return false; }
+    sqes_sz_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED){ close(); return false; }
+    sqes_ = (io_uring_sqe*)sqes;
+    char* sq = (char*)sq_;
+    char* cq = (char*)cq_;
+    sq_head_ = (unsigned*)(sq + p.sq_off.head);
+    sq_tail_ = (unsigned*)(sq + p.sq_off.tail);
+    sq_mask_ = *(unsigned*)(sq + p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    sq_array_ = (unsigned*)(sq + p.sq_off.array);
+    cq_head_ = (unsigned*)(cq + p.cq_off.head);
+    cq_tail_ = (unsigned*)(cq + p.cq_off.tail);
+    cq_mask_ = *(unsigned*)(cq + p.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    tail_ = *sq_tail_;
+    return true;
+  }
+
+  void close(){
+    if (sqes_) munmap(sqes_, sqes_sz_);
+    if (cq_ && !single_) munmap(cq_, cq_sz_);
+    if (sq_) munmap(sq_, sq_sz_);
+    if (fd_ >= 0) ::close(fd_);
+    sqes_ = nullptr; sq_ = cq_ = nullptr; fd_ = -1;
+  }
+
+  // Буферы для READ_FIXED (buf_index - номер в iov)
+  bool register_buffers(const std::vector<iovec>& iov){
+    return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, iov.data(), (unsigned)iov.size()) == 0;
+  }
+
+  // Свободный SQE (обнуленный); если очередь полна - сначала отправляем накопленное
+  io_uring_sqe* sqe(){
+    if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) submit(0);
+    unsigned i = tail_ & sq_mask_;
+    io_uring_sqe* e = &sqes_[i];
+    std::memset(e, 0, sizeof(*e));
+    sq_array_[i] = i;
+    tail_++;
+    pending_++;
+    return e;
+  }
+
+  // Отправить накопленные SQE и (wait > 0) дождаться событий; возвращает число отправленных
+  int submit(unsigned wait){
+    __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+    unsigned n = pending_;
+    for (;;){
+      int r = (int)syscall(__NR_io_uring_enter, fd_, n, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (r >= 0){ pending_ -= std::min<unsigned>(pending_, (unsigned)r); return r; }
+      if (errno != EINTR) return -errno;
+    }
+  }
+
+  // fn(cqe) для всех готовых событий
+  template <class F>
+  unsigned drain(F&& fn){
+    unsigned head = *cq_head_, n = 0;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, n++) fn(cqes_[head & cq_mask_]);
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return n;
+  }
+
+private:
+  int fd_ = -1;
+  bool single_ = false;
+  void* sq_ = nullptr;
+  void* cq_ = nullptr;
+  size_t sq_sz_ = 0, cq_sz_ = 0, sqes_sz_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  unsigned *sq_head_ = nullptr, *sq_tail_ = nullptr, *sq_array_ = nullptr;
+  unsigned sq_mask_ = 0, sq_entries_ = 0, tail_ = 0, pending_ = 0;
+  unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+// Сетевой цикл на io_uring: loops потоков, у каждого свое кольцо и таблица соединений.
+// На общий слушающий сокет каждый цикл ставит multishot accept (ядро без него - обычный
+// accept заново). Запрос читается READ_FIXED в зарегистрированный буфер соединения, ответ
+// route_request уходит SEND; чтение и отправка связаны с таймаутом 10 с. Запрос
+// обрабатывается прямо в потоке цикла. stop(): accept отменяется, текущие запросы
+// дорабатываются до timeout, оставшиеся соединения рвутся через shutdown().
+class UringServer {
+public:
+  // false - io_uring недоступен (старое ядро, запрещен seccomp и т.д.)
+  bool start(socket_t listen_fd, size_t loops, ServerState& srv){
+    for (size_t i=0;i<std::max<size_t>(1, loops);i++){
+      auto lp = std::make_unique<Loop>(*this, srv, listen_fd);
+      if (!lp->init()) break;
+      loops_.push_back(std::move(lp));
+    }
+    if (loops_.empty()) return false;
+    for (auto& lp : loops_) thr_.emplace_back([l = lp.get()]{ l->run(); });
+    return true;
+  }
+
+  void stop(std::chrono::milliseconds timeout){
+    deadline_ = std::chrono::steady_clock::now() + timeout;
+    stopping_ = true;
+    for (auto& t : thr_) t.join();
+    thr_.clear();
+    loops_.clear();
+  }
+
+  std::string stats_json() const {
+    uint64_t batches = batches_.load(), sqes = sqes_.load();
+    std::ostringstream os;
+    os<<"{\"backend\":\"io_uring\",\"loops\":"<<loops_.size()<<",\"accepted\":"<<accepted_.load()
+      <<",\"rejected\":"<<rejected_.load()<<",\"completed\":"<<completed_.load()
+      <<",\"active\":"<<active_.load()<<",\"timeouts\":"<<timeouts_.load()
+      <<",\"submits\":"<<batches<<",\"sqe_per_submit\":"<<std::fixed<<std::setprecision(2)
+      <<(batches ? (double)sqes / (double)batches : 0.0)<<"}";
+    return os.str();
+  }
+
+private:
+  static const size_t MAX_CONN = 512;     // соединений на цикл
+  static const size_t BUF = 8192;         // буфер запроса (заголовки)
+
+  enum Kind : uint64_t { K_ACCEPT = 1, K_READ, K_SEND, K_TICK, K_LINK, K_CANCEL, K_SPLICE_IN, K_SPLICE_OUT };
+  static uint64_t ud(Kind k, size_t slot = 0, uint32_t gen = 0){
+    return ((uint64_t)k << 56) | ((uint64_t)slot << 24) | (gen & 0xffffff);
+  }
+
+  class Loop {
+  public:
+    Loop(UringServer& owner, ServerState& srv, socket_t lfd) : o_(owner), srv_(srv), lfd_(lfd) {}
+
+    bool init(){
+      if (!ring_.init(1024)) return false;
+      bufs_.assign(MAX_CONN * BUF, 0);
+      std::vector<iovec> iov(MAX_CONN);
+      for (size_t i=0;i<MAX_CONN;i++) iov[i] = iovec{bufs_.data() + i * BUF, BUF};
+      fixed_ = ring_.register_buffers(iov);  // не вышло (лимит memlock) - обычный READ
+      conns_.resize(MAX_CONN);
+      for (size_t i=MAX_CONN;i>0;i--) free_.push_back(i - 1);
+      return true;
+    }
+
+    void run(){
+      arm_accept();
+      arm_tick();
+      bool draining = false;
+      while (true){
+        int r = ring_.submit(1);
+        if (r > 0){ o_.batches_++; o_.sqes_ += (uint64_t)r; }
+        ring_.drain([&](const io_uring_cqe& c){ on_cqe(c); });
+        if (o_.stopping_ && !draining){
+          draining = true;
+          io_uring_sqe* e = ring_.sqe();
+          e->opcode = IORING_OP_ASYNC_CANCEL;
+          e->addr = ud(K_ACCEPT);
+          e->user_data = ud(K_CANCEL);
+          accept_armed_ = false;
+        }
+        if (draining){
+          if (active_ == 0) break;
+          if (std::chrono::steady_clock::now() >= o_.deadline_)
+            for (auto& c : conns_) if (c.fd >= 0) ::shutdown(c.fd, SHUT_RDWR);
+        }
+      }
+    }
+
+  private:
+    struct Conn {
+      int fd = -1;
+      uint32_t gen = 0;
+      size_t len = 0;
+      std::string out;
+      size_t sent = 0;
+      ReqPerf pf;   // фазы считаются с момента accept
+      // тело /api/raw: байты [pos, end) отправляются после заголовков; куски файлов -
+      // splice файл -> pipe -> сокет без копирования в память процесса
+      std::shared_ptr<const RawBody> body;
+      uint64_t pos = 0, end = 0;
+      int pipe_r = -1, pipe_w = -1;
+      size_t in_pipe = 0;   // байт в pipe, еще не ушедших в сокет
+      bool no_splice = false;
+    };
+
+    void arm_accept(){
+      io_uring_sqe* e = ring_.sqe();
+      e->opcode = IORING_OP_ACCEPT;
+      e->fd = lfd_;
+      e->accept_flags = SOCK_CLOEXEC;
+      if (multishot_) e->ioprio = IORING_ACCEPT_MULTISHOT;
+      e->user_data = ud(K_ACCEPT);
+      accept_armed_ = true;
+    }
+
+    void arm_tick(){
+      io_uring_sqe* e = ring_.sqe();
+      e->opcode = IORING_OP_TIMEOUT;
+      e->addr = (uint64_t)(uintptr_t)&tick_;
+      e->len = 1;
+      e->user_data = ud(K_TICK);
+    }
+
+    // Операция над соединением, связанная с таймаутом io_tmo_
+    void link_timeout(size_t slot){
+      io_uring_sqe* t = ring_.sqe();
+      t->opcode = IORING_OP_LINK_TIMEOUT;
+      t->addr = (uint64_t)(uintptr_t)&io_tmo_;
+      t->len = 1;
+      t->user_data = ud(K_LINK, slot, conns_[slot].gen);
+    }
+
+    void arm_read(size_t slot){
+      Conn& c = conns_[slot];
+      io_uring_sqe* e = ring_.sqe();
+      e->opcode = fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      e->fd = c.fd;
+      e->addr = (uint64_t)(uintptr_t)(bufs_.data() + slot * BUF + c.len);
+      e->len = (unsigned)(BUF - c.len);
+      e->off = (uint64_t)-1;
+      if (fixed_) e->buf_index = (uint16_t)slot;
+      e->flags = IOSQE_IO_LINK;
+      e->user_data = ud(K_READ, slot, c.gen);
+      link_timeout(slot);
+    }
+
+    void arm_send(size_t slot){
+      Conn& c = conns_[slot];
+      io_uring_sqe* e = ring_.sqe();
+      e->opcode = IORING_OP_SEND;
+      e->fd = c.fd;
+      e->addr = (uint64_t)(uintptr_t)(c.out.data() + c.sent);
+      e->len = (unsigned)(c.out.size() - c.sent);
+      e->msg_flags = MSG_NOSIGNAL;
+      e->flags = IOSQE_IO_LINK;
+      e->user_data = ud(K_SEND, slot, c.gen);
+      link_timeout(slot);
+    }
+
+    // Следующий кусок тела: строки TBIN (и файлы, если splice недоступен) - через out и SEND,
+    // файлы - SPLICE в pipe соединения
+    void arm_body(size_t slot){
+      Conn& c = conns_[slot];
+      c.out.clear();
+      RawBody::Chunk ch = c.body->chunk(c.pos, (size_t)std::min<uint64_t>(c.end - c.pos, 64 * 1024), c.out);
+      size_t n = (size_t)std::min<uint64_t>(ch.len, c.end - c.pos);
+      if (ch.fd >= 0 && !c.no_splice && c.pipe_r < 0){
+        int p[2];
+        if (::pipe2(p, O_CLOEXEC) == 0){ c.pipe_r = p[0]; c.pipe_w = p[1]; }
+        else c.no_splice = true;
+      }
+      if (ch.fd >= 0 && !c.no_splice){
+        io_uring_sqe* e = ring_.sqe();
+        e->opcode = IORING_OP_SPLICE;
+        e->splice_fd_in = ch.fd;
+        e->splice_off_in = ch.off;
+        e->fd = c.pipe_w;
+        e->off = (uint64_t)-1;
+        e->len = (unsigned)std::min<size_t>(n, 64 * 1024);
+        e->user_data = ud(K_SPLICE_IN, slot, c.gen);
+        return;
+      }
+      if (ch.fd >= 0){
+        // чтение из page cache: в цикле допустимо, как и mmap сегментов
+        c.out.resize(std::min<size_t>(n, 64 * 1024));
+        ssize_t k = ::pread(ch.fd, &c.out[0], c.out.size(), (off_t)ch.off);
+        if (k <= 0){ close_conn(slot); return; }
+        c.out.resize((size_t)k);
+        c.sent = 0;
+        n = (size_t)k;
+      } else {
+        c.sent = (size_t)(ch.data - c.out.data());
+        c.out.resize(c.sent + n);
+      }
+      c.pos += n;
+      arm_send(slot);
+    }
+
+    void arm_splice_out(size_t slot){
+      Conn& c = conns_[slot];
+      io_uring_sqe* e = ring_.sqe();
+      e->opcode = IORING_OP_SPLICE;
+      e->splice_fd_in = c.pipe_r;
+      e->splice_off_in = (uint64_t)-1;
+      e->fd = c.fd;
+      e->off = (uint64_t)-1;
+      e->len = (unsigned)c.in_pipe;
+      e->flags = IOSQE_IO_LINK;
+      e->user_data = ud(K_SPLICE_OUT, slot, c.gen);
+      link_timeout(slot);
+    }
+
+    void on_splice(size_t slot, Kind k, int res){
+      Conn& c = conns_[slot];
+      if (k == K_SPLICE_IN){
+        if (res == -EINVAL){ c.no_splice = true; arm_body(slot); return; }   // ФС без splice
+        if (res <= 0){ close_conn(slot); return; }
+        c.in_pipe = (size_t)res;
+        arm_splice_out(slot);
+        return;
+      }
+      if (res <= 0){ close_conn(slot); return; }
+      c.in_pipe -= (size_t)res;
+      c.pos += (uint64_t)res;
+      if (c.in_pipe) arm_splice_out(slot);
+      else if (c.pos < c.end) arm_body(slot);
+      else finish_conn(slot);
+    }
+
+    void finish_conn(size_t slot){
+      Conn& c = conns_[slot];
+      c.pf.mark(ReqPerf::Send);
+      srv_.perf.finish(c.pf, std::string_view(bufs_.data() + slot * BUF, c.len));
+      o_.completed_++;
+      close_conn(slot);
+    }
+
+    void close_conn(size_t slot){
+      Conn& c = conns_[slot];
+      ::close(c.fd);
+      if (c.pipe_r >= 0){ ::close(c.pipe_r); ::close(c.pipe_w); }
+      c.pipe_r = c.pipe_w = -1;
+      c.body.reset();
+      c.pos = c.end = 0;
+      c.in_pipe = 0;
+      c.no_splice = false;
+      c.fd = -1;
+      c.gen++;
+      c.len = c.sent = 0;
+      std::string().swap(c.out);
+      free_.push_back(slot);
+      active_--;
+      o_.active_--;
+    }
+
+    void on_cqe(const io_uring_cqe& cq){
+      Kind k = (Kind)(cq.user_data >> 56);
+      size_t slot = (size_t)((cq.user_data >> 24) & 0xffffffff);
+      uint32_t gen = (uint32_t)(cq.user_data & 0xffffff);
+      switch (k){
+        case K_ACCEPT: on_accept(cq); break;
+        case K_TICK: if (!o_.stopping_ || active_) arm_tick(); break;
+        case K_READ:
+        case K_SEND:
+        case K_SPLICE_IN:
+        case K_SPLICE_OUT: {
+          if (slot >= conns_.size() || conns_[slot].fd < 0 || (conns_[slot].gen & 0xffffff) != gen) break;
+          if (cq.res == -ECANCELED) o_.timeouts_++;
+          if (k == K_READ) on_read(slot, cq.res);
+          else if (k == K_SEND) on_send(slot, cq.res);
+          else on_splice(slot, k, cq.res);
+          break;
+        }
+        default: break;   // K_LINK, K_CANCEL
+      }
+    }
+
+    void on_accept(const io_uring_cqe& cq){
+      if (!(cq.flags & IORING_CQE_F_MORE)) accept_armed_ = false;
+      if (cq.res == -EINVAL && multishot_){ multishot_ = false; }  // ядро до 5.19
+      else if (cq.res >= 0){
+        int fd = cq.res;
+        if (o_.stopping_){ ::close(fd); }
+        else if (free_.empty()){
+          o_.rejected_++;
+          HttpReply busy = http_response(503, "text/plain; charset=utf-8", "busy");
+          ::send(fd, busy.data(), busy.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+          ::close(fd);
+        } else {
+          size_t slot = free_.back();
+          free_.pop_back();
+          conns_[slot].fd = fd;
+          conns_[slot].pf = ReqPerf{};
+          active_++;
+          o_.active_++;
+          o_.accepted_++;
+          arm_read(slot);
+        }
+      }
+      if (!accept_armed_ && !o_.stopping_) arm_accept();
+    }
+
+    void on_read(size_t slot, int res){
+      Conn& c = conns_[slot];
+      if (res <= 0){ close_conn(slot); return; }
+      size_t old = c.len;
+      c.len += (size_t)res;
+      const char* b = bufs_.data() + slot * BUF;
+      std::string_view v(b, c.len);
+      bool done = v.find("\r\n\r\n", old >= 3 ? old - 3 : 0) != std::string_view::npos || c.len == BUF;
+      if (!done){ arm_read(slot); return; }
+      c.pf.mark(ReqPerf::Recv);
+      HttpReply r = route_request(v, srv_, c.pf);
+      c.pf.mark(ReqPerf::Render);
+      c.out = std::move(r.buf);
+      c.sent = r.off;   // заголовки начинаются не с нуля
+      c.body = std::move(r.body);
+      c.pos = r.body_from;
+      c.end = r.body_from + r.body_len;
+      arm_send(slot);
+    }
+
+    void on_send(size_t slot, int res){
+      Conn& c = conns_[slot];
+      if (res <= 0){ close_conn(slot); return; }
+      c.sent += (size_t)res;
+      if (c.sent < c.out.size()){ arm_send(slot); return; }
+      if (c.body && c.pos < c.end){ arm_body(slot); return; }
+      finish_conn(slot);
+    }
+
+    UringServer& o_;
+    ServerState& srv_;
+    socket_t lfd_;
+    URing ring_;
+    bool fixed_ = false;
+    bool multishot_ = true;
+    bool accept_armed_ = false;
+    std::vector<char> bufs_;
+    std::vector<Conn> conns_;
+    std::vector<size_t> free_;
+    size_t active_ = 0;
+    __kernel_timespec tick_{0, 200 * 1000 * 1000};   // проверка stop
+    __kernel_timespec io_tmo_{10, 0};               // медленный клиент
+  };
+
+  std::vector<std::unique_ptr<Loop>> loops_;
+  std::vector<std::thread> thr_;
+  std::atomic<bool> stopping_{false};
+  std::chrono::steady_clock::time_point deadline_;
+  std::atomic<uint64_t> accepted_{0}, rejected_{0}, completed_{0}, active_{0}, timeouts_{0};
+  std::atomic<uint64_t> batches_{0}, sqes_{0};
+};
+#endif
+
+// Тесты (tests/) подключают этот файл целиком, без main
+#ifndef TEMP_SERVER_NO_MAIN
 int main(int argc, char** argv){
   std::string data_dir = "data";
   int port = 8080;
   bool simulate = false;
+  size_t index_every = 1024; // запись индекса раз в N строк
+  int index_sec = 60;        // ... или раз в S секунд
+  size_t workers = std::max(4u, std::thread::hardware_concurrency()); // потоков-обработчиков
+  size_t conn_queue = 256;   // соединений в очереди к пулу
+  int shutdown_ms = 3000;    // сколько ждать текущие запросы при остановке
+  size_t flush_every = 1;    // сброс csv раз в N строк...
+  int flush_ms = 1000;       // ... или раз в T мс
+  bool fsync_on = true;      // fdatasync после сброса
+  bool framed = false;       // строки CSV с CRC32C и метками проверенного места
+  double sim_rate = 1.0;     // измерений в секунду в режиме --simulate
+  SegmentMode seg_mode = SegmentMode::Day; // нарезка файлов данных
+  int retain_days = 0;       // хранить сегменты N дней (0 - всегда)
+  size_t scan_threads = std::max(1u, std::thread::hardware_concurrency()); // разбор больших диапазонов
+  size_t cache_mb = 128;     // потолок кэша ряда в памяти (0 - без кэша)
+  size_t range_cache = 256;  // записей в кэше ответов по диапазонам (0 - без кэша)
+  int compact_after_days = 0; // сжимать закрытые сегменты старше N дней в TBIN (0 - нет)
+  bool pyramid_on = true;    // агрегаты по минутам и часам (.1m/.1h) для длинных диапазонов
+  bool rebuild_pyramid = false; // перестроить их по всем сегментам и выйти
+  bool io_uring_on = false;  // сетевой цикл на io_uring вместо пула потоков (Linux)
+  size_t io_loops = 1;       // потоков цикла io_uring
+  int slow_ms = 0;           // запросы дольше - в лог с разбивкой по фазам (0 - не писать)
+  bool ingest_stdin = false; // измерения из stdin (строки "ISOZ,temp")
+  std::string ingest_fifo;   // ... или из именованного канала
 
   // Аргументы:
   // --data-dir <папка>
   // --port <порт>
   // --simulate
+  // --index-every <строк>, --index-sec <секунд> (шаг разреженного индекса)
+  // --workers <N>, --conn-queue <N>, --shutdown-ms <мс> (пул обработчиков)
+  // --flush-every <N>, --flush-ms <мс>, --no-fsync (политика записи csv)
+  // --framed (CRC32C в каждой строке csv, при старте проверяется хвост после метки)
+  // --sim-rate <Гц> (частота симуляции)
+  // --segment day|hour|none, --retain-days <N> (сегменты данных и срок хранения)
+  // --scan-threads <N> (параллельный разбор больших диапазонов)
+  // --cache-mb <МБ> (кэш ряда в памяти, 0 - выключен)
+  // --range-cache <N> (кэш ответов /api/stats по диапазонам, записей; 0 - выключен)
+  // --compact-after-days <N> (сжатие закрытых сегментов в TBIN, 0 - выключено)
+  // --no-pyramid, --rebuild-pyramid (агрегаты по минутам и часам: выключить; перестроить и выйти)
+  // --io threads|uring, --io-loops <N> (сетевой ввод-вывод: пул потоков или io_uring)
+  // --slow-ms <мс> (лог медленных запросов с временем фаз, 0 - выключен)
+  // --ingest-stdin, --ingest-fifo <путь> (прием строк "ISOZ,temp" из потока, например temp_sim)
   for(int i=1;i<argc;i++){
     std::string a = argv[i];
     if (a=="--data-dir" && i+1<argc) data_dir = argv[++i];
     else if (a=="--port" && i+1<argc) port = std::atoi(argv[++i]);
     else if (a=="--simulate") simulate = true;
+    else if (a=="--index-every" && i+1<argc) index_every = (size_t)std::atoll(argv[++i]);
+    else if (a=="--index-sec" && i+1<argc) index_sec = std::atoi(argv[++i]);
+    else if (a=="--workers" && i+1<argc) workers = (size_t)std::max(1, std::atoi(argv[++i]));
+    else if (a=="--conn-queue" && i+1<argc) conn_queue = (size_t)std::max(1, std::atoi(argv[++i]));
+    else if (a=="--shutdown-ms" && i+1<argc) shutdown_ms = std::max(0, std::atoi(argv[++i]));
+    else if (a=="--flush-every" && i+1<argc) flush_every = (size_t)std::max(1, std::atoi(argv[++i]));
+    else if (a=="--flush-ms" && i+1<argc) flush_ms = std::atoi(argv[++i]);
+    else if (a=="--no-fsync") fsync_on = false;
+    else if (a=="--framed") framed = true;
+    else if (a=="--sim-rate" && i+1<argc) sim_rate = std::max(0.001, std::atof(argv[++i]));
+    else if (a=="--segment" && i+1<argc){
+      std::string m = argv[++i];
+      if (m=="day") seg_mode = SegmentMode::Day;
+      else if (m=="hour") seg_mode = SegmentMode::Hour;
+      else if (m=="none") seg_mode = SegmentMode::None;
+      else { log(LogLevel::Err, "bad --segment: " + m); return 1; }
+    }
+    else if (a=="--retain-days" && i+1<argc) retain_days = std::max(0, std::atoi(argv[++i]));
+    else if (a=="--scan-threads" && i+1<argc) scan_threads = (size_t)std::max(1, std::atoi(argv[++i]));
+    else if (a=="--cache-mb" && i+1<argc) cache_mb = (size_t)std::max(0, std::atoi(argv[++i]));
+    else if (a=="--range-cache" && i+1<argc) range_cache = (size_t)std::max(0, std::atoi(argv[++i]));
+    else if (a=="--compact-after-days" && i+1<argc) compact_after_days = std::max(0, std::atoi(argv[++i]));
+    else if (a=="--no-pyramid") pyramid_on = false;
+    else if (a=="--rebuild-pyramid") rebuild_pyramid = true;
+    else if (a=="--io" && i+1<argc){
+      std::string m = argv[++i];
+      if (m=="uring") io_uring_on = true;
+      else if (m=="threads") io_uring_on = false;
+      else { log(LogLevel::Err, "bad --io: " + m); return 1; }
+    }
+    else if (a=="--io-loops" && i+1<argc) io_loops = (size_t)std::max(1, std::atoi(argv[++i]));
+    else if (a=="--slow-ms" && i+1<argc) slow_ms = std::max(0, std::atoi(argv[++i]));
+    else if (a=="--ingest-stdin") ingest_stdin = true;
+    else if (a=="--ingest-fifo" && i+1<argc) ingest_fifo = argv[++i];
   }
 
   std::signal(SIGINT,  on_signal);
   std::signal(SIGTERM, on_signal);
+#ifndef _WIN32
+  std::signal(SIGPIPE, SIG_IGN); // клиент закрыл сокет - ошибка send(), а не падение
+#endif
 
   if(!sock_init()){
     log(LogLevel::Err, "socket init failed");
@@ -425,21 +4435,56 @@ int main(int argc, char** argv){
   std::filesystem::path dd(data_dir);
   std::error_code ec;
   std::filesystem::create_directories(dd, ec);
-  std::filesystem::path csv = dd / "measurements.csv";
+  ServerState srv;
+  srv.data_dir = dd;
 
-  // Последнее измерение (используется в /api/current)
-  std::mutex mtx;
+  // Последнее измерение (используется в /api/current).
+  // Сегменты: восстановить последнее измерение (оборванная строка в конце отрезается),
+  // проверить индексы и итоги
   Sample latest{};
   latest.tt = std::time(nullptr);
   latest.temp = 23.5;
-
-  // Если CSV уже есть, берем последнюю строку
+  srv.store.configure(dd, seg_mode, retain_days, index_every, index_sec, scan_threads, cache_mb, compact_after_days,
+                       pyramid_on || rebuild_pyramid, rebuild_pyramid, framed);
+  srv.ranges.configure(range_cache);
+  srv.perf.configure(slow_ms);
+  srv.store.appender().configure(flush_every, flush_ms, fsync_on, framed);
   Sample last{};
-  if (read_last_sample(csv, last)){
+  if (srv.store.open(last)){
     latest = last;
   }
+  srv.live.set_latest(latest);
+  bool ingest = ingest_stdin || !ingest_fifo.empty();
+  srv.live.enable_window(simulate || ingest);
+  log(LogLevel::Info, "segments: " + srv.store.stats_json());
+  if (rebuild_pyramid){
+    srv.store.close();
+    sock_cleanup();
+    log(LogLevel::Info, "pyramid rebuilt");
+    return 0;
+  }
+  srv.store.start_watch();
+
+  // Прием измерений из stdin или канала (отдельный поток)
+#ifndef _WIN32
+  StreamIngest ingest_rd;
+  if (ingest){
+    bool ok = ingest_stdin ? ingest_rd.start_stdin(srv.store, srv.live) : ingest_rd.start_fifo(ingest_fifo, srv.store, srv.live);
+    if (!ok){
+      srv.store.close();
+      sock_cleanup();
+      return 1;
+    }
+    srv.ingest_stats = [&ingest_rd]{ return ingest_rd.stats_json(); };
+  }
+#else
+  if (ingest){
+    log(LogLevel::Err, "--ingest-stdin/--ingest-fifo are not supported on Windows");
+    return 1;
+  }
+#endif
 
-  // Симуляция: раз в секунду генерируем значение и пишем в CSV
+  // Симуляция: sim_rate раз в секунду генерируем значение и пишем в CSV
   std::atomic<bool> sim_stop{false};
   std::thread sim_thr;
   if (simulate){
@@ -448,18 +4493,24 @@ int main(int argc, char** argv){
       std::normal_distribution<double> base(23.5, 0.9);
       std::uniform_real_distribution<double> noise(-0.8,0.8);
 
+      const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(1.0 / sim_rate));
+      auto next = std::chrono::steady_clock::now();
+
       while(!g_stop && !sim_stop){
         time_t now = std::time(nullptr);
         double temp = std::round((base(rng)+noise(rng))*1000.0)/1000.0;
 
-        { std::lock_guard<std::mutex> lk(mtx); latest.tt = now; latest.temp = temp; }
+        srv.live.publish(Sample{now, temp});
 
-        std::ofstream out(csv, std::ios::app);
-        if (out){
-          out<<iso_utc_from(now)<<","<<std::fixed<<std::setprecision(3)<<temp<<"\n";
-        }
+        srv.store.append(now, temp);
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        // при высокой частоте спим не дольше 100 мс, чтобы вовремя сбросить буфер по flush_ms
+        next += period;
+        while (std::chrono::steady_clock::now() < next && !g_stop && !sim_stop){
+          std::this_thread::sleep_until(std::min(next, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)));
+          srv.store.flush_if_due();
+        }
       }
     });
   }
@@ -497,7 +4548,7 @@ int main(int argc, char** argv){
     g_stop = true;
   }
 
-  if (!g_stop && ::listen(s, 16) != 0){
+  if (!g_stop && ::listen(s, 128) != 0){
     log(LogLevel::Err, "listen failed");
     g_stop = true;
   }
@@ -506,8 +4557,38 @@ int main(int argc, char** argv){
   log(LogLevel::Info, "data dir: " + std::filesystem::absolute(dd).string());
   log(LogLevel::Info, std::string("simulate: ") + (simulate ? "ON" : "OFF"));
 
-  // Принимаем подключения, на каждого клиента создаем поток
+  // io_uring: соединения принимает и обслуживает сам цикл, главный поток только ждет g_stop.
+  // Если io_uring недоступен - обычный пул потоков
+  bool uring_used = false;
+#ifdef TS_HAVE_URING
+  UringServer uring;
+  if (io_uring_on && !g_stop){
+    uring_used = uring.start(s, io_loops, srv);
+    if (uring_used) srv.io_stats = [&uring]{ return uring.stats_json(); };
+    else log(LogLevel::Warn, "io_uring unavailable, using worker pool");
+  }
+#else
+  if (io_uring_on) log(LogLevel::Warn, "io_uring is not supported on this platform, using worker pool");
+#endif
+  if (uring_used) log(LogLevel::Info, "io: io_uring, loops: " + std::to_string(io_loops));
+  else {
+    log(LogLevel::Info, "workers: " + std::to_string(workers) + ", queue: " + std::to_string(conn_queue));
+    srv.pool.start(workers, conn_queue, [&](socket_t c){ handle_client(c, srv); });
+  }
+
+  // Принимаем подключения и отдаем их пулу; select с таймаутом, чтобы видеть g_stop
   while(!g_stop){
+    if (uring_used){
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      continue;
+    }
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(s, &rfds);
+    timeval tv{};
+    tv.tv_usec = 200*1000;
+    if (select((int)(s+1), &rfds, nullptr, nullptr, &tv) <= 0) continue;
+
     sockaddr_in caddr{};
 #ifdef _WIN32
     int clen = sizeof(caddr);
@@ -528,17 +4609,43 @@ int main(int argc, char** argv){
     }
 #endif
 
-    std::thread([&, c](){
-      handle_client(c, dd, mtx, latest);
+    // медленный клиент не должен держать обработчик бесконечно
+#ifdef _WIN32
+    DWORD tmo = 10000;
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tmo, sizeof(tmo));
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tmo, sizeof(tmo));
+#else
+    timeval tmo{};
+    tmo.tv_sec = 10;
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tmo, sizeof(tmo));
+#endif
+
+    if (!srv.pool.submit(c)){
+      HttpReply busy = http_response(503, "text/plain; charset=utf-8", "busy");
+      send_all(c, busy.data(), busy.size());
       sock_close(c);
-    }).detach();
+    }
   }
 
-  // Корректное завершение
+  // Корректное завершение: больше не принимаем, дорабатываем запросы (не дольше shutdown_ms)
+#ifdef TS_HAVE_URING
+  if (uring_used){
+    uring.stop(std::chrono::milliseconds(shutdown_ms));
+    srv.io_stats = nullptr;
+  }
+#endif
+  sock_close(s);
+  srv.pool.stop(std::chrono::milliseconds(shutdown_ms));
   sim_stop = true;
   if (sim_thr.joinable()) sim_thr.join();
-  sock_close(s);
+#ifndef _WIN32
+  srv.ingest_stats = nullptr;
+  ingest_rd.stop();
+#endif
+  srv.store.close();
   sock_cleanup();
   log(LogLevel::Info, "server stopped");
   return 0;
 }
+#endif
@@ -0,0 +1,155 @@
+// CSV --framed: проверка хвоста при старте (verify_framed_tail + recover_last_sample) -
+// оборванная последняя запись без '\n' отрезается, целая остается, запись с неверной суммой
+// посреди хвоста остается в файле и пропускается разбором; писатель (CsvAppender)
+// после неудачного write не оставляет обрывков и не ставит метку
+#define TEMP_SERVER_NO_MAIN
+#include "../src/temp_server.cpp"
+#include "test_util.h"
+
+#include <sys/resource.h>
+
+static const time_t T0 = 1767225600;   // 2026-01-01T00:00:00Z
+
+// Файл, как его пишет сервер с --framed: два запуска, во втором - метка #ckpt
+static std::string make_framed(const std::filesystem::path& file, int n){
+  for (int run=0; run<2; run++){
+    CsvAppender app;
+    app.configure(1, -1, false, true);
+    CHECK(app.open(file));
+    for (int i=0;i<n;i++) app.append(T0 + run*n + i, 20.0 + i / 8.0);
+    app.close();
+  }
+  return read_file(file);
+}
+
+// Вид строк после смещения from: 'r' - запись с верной суммой, 'c' - верная метка на своем
+// смещении, '?' - остальное
+static std::string line_kinds(const std::string& data, size_t from){
+  std::string k;
+  for (size_t p = from; p < data.size();){
+    size_t nl = data.find('\n', p);
+    if (nl == std::string::npos) nl = data.size();
+    const char* l = data.data() + p;
+    size_t len = nl - p;
+    if (csv_frame_check(l, len) != 1) k += '?';
+    else if (l[0] != '#') k += 'r';
+    else k += std::strtoull(l + 6, nullptr, 10) == p ? 'c' : '?';
+    p = nl + 1;
+  }
+  return k;
+}
+
+// Проверка и восстановление, как в SegmentStore::open; last - последнее измерение
+static bool reopen(const std::filesystem::path& file, Sample& last){
+  verify_framed_tail(file);
+  return recover_last_sample(file, last, true);
+}
+
+int main(){
+  TempDir dir("test_framed");
+  std::filesystem::path file = dir.path / "measurements.csv";
+  std::string good = make_framed(file, 10);
+  CHECK(good.find("#ckpt,") != std::string::npos);
+  const time_t last_tt = T0 + 19;
+
+  // оборванная запись: суффикс не дописан (разбор числа до '*' прошел бы)
+  for (const char* torn : {"2026-10-18T23:59:59Z,99.999*ab", "2026-10-18T23:59:59Z,99.999*deadbeef",
+                           "2026-10-18T23:59:59Z,99.9", "#ckpt,12", "#"}){
+    write_file(file, good);
+    write_file(file, torn, true);
+    Sample s{};
+    CHECK(reopen(file, s));
+    CHECK_EQ(read_file(file), good);
+    CHECK_EQ(s.tt, last_tt);
+    CHECK(s.temp != 99.999);
+  }
+
+  // целая запись с верной суммой, только без '\n' - остается
+  {
+    char line[80];
+    format_iso_utc(T0 + 100, line);
+    size_t len = 20 + (size_t)std::snprintf(line + 20, 40, ",%.3f", 21.5);
+    len = csv_frame(line, len);
+    write_file(file, good);
+    write_file(file, std::string(line, len), true);
+    Sample s{};
+    CHECK(reopen(file, s));
+    CHECK_EQ(read_file(file), good + std::string(line, len) + "\n");
+    CHECK_EQ(s.tt, T0 + 100);
+    CHECK_EQ(s.temp, 21.5);
+  }
+
+  // после проверки сервер дописывает дальше: следующая запись - с новой строки и проверяется
+  {
+    write_file(file, good);
+    write_file(file, "2026-10-18T23:59:59Z,99.999*ab", true);
+    Sample s{};
+    reopen(file, s);
+    CsvAppender app;
+    app.configure(1, -1, false, true);
+    CHECK(app.open(file));
+    app.append(T0 + 200, 19.0);
+    app.close();
+    CHECK(!verify_framed_tail(file));
+    CHECK(read_file(file).find("99.999") == std::string::npos);
+  }
+  // запись с неверной суммой посреди хвоста: файл не меняется, разбор ее пропускает
+  {
+    size_t at = good.rfind("20.375*");   // последняя запись второго запуска
+    CHECK(at != std::string::npos);
+    std::string bad = good;
+    bad[at + 5] = '6';
+    CsvAppender app;
+    app.configure(1, -1, false, true);
+    write_file(file, bad);
+    CHECK(app.open(file));
+    app.append(T0 + 600, 17.0);
+    app.close();
+    std::string before = read_file(file);
+    Sample s{};
+    CHECK(!verify_framed_tail(file));
+    CHECK_EQ(read_file(file), before);
+    size_t b = bad.rfind('\n', at) + 1, e = bad.find('\n', at);
+    CHECK(!parse_csv_fast(bad.data() + b, e - b, s));
+    CHECK(!parse_csv_line(bad.substr(b, e - b), s));
+    std::string plain;
+    strip_framing(before.data(), before.data() + before.size(), &plain);
+    CHECK(plain.find("20.376") == std::string::npos);
+    CHECK(plain.find("20.250\n") != std::string::npos);
+    CHECK(recover_last_sample(file, s, true));
+    CHECK_EQ(s.tt, T0 + 600);
+  }
+
+  // write обрывается посреди строки (RLIMIT_FSIZE): недописанная строка отрезается, следующий
+  // сброс идет без метки (прошлый не удался), метка - только после удачного
+  {
+    write_file(file, good);
+    std::signal(SIGXFSZ, SIG_IGN);
+    rlimit old{};
+    getrlimit(RLIMIT_FSIZE, &old);
+    CsvAppender app;
+    app.configure(1000, -1, false, true);
+    CHECK(app.open(file));
+    for (int i=0;i<10;i++) app.append(T0 + 300 + i, 18.0);
+    rlimit lim = old;
+    lim.rlim_cur = good.size() + 50;
+    CHECK(setrlimit(RLIMIT_FSIZE, &lim) == 0);
+    app.flush();
+    CHECK(setrlimit(RLIMIT_FSIZE, &old) == 0);
+    CHECK(app.stats_json().find("\"errors\":0") == std::string::npos);
+    std::string cut = read_file(file);
+    CHECK(!cut.empty() && cut.back() == '\n');
+    for (int i=0;i<3;i++) app.append(T0 + 400 + i, 18.5);
+    app.flush();
+    app.append(T0 + 500, 19.5);
+    app.flush();
+    app.close();
+    std::string data = read_file(file);
+    CHECK_EQ(line_kinds(data, good.size()), std::string("crrrcr"));
+    CHECK(!verify_framed_tail(file));
+    Sample s{};
+    CHECK(recover_last_sample(file, s, true));
+    CHECK_EQ(s.tt, T0 + 500);
+  }
+  return test_result("test_framed");
+}
@@ -0,0 +1,78 @@
+// LiveBoard под нагрузкой: писатель публикует без пауз, читатели параллельно зовут latest()
+// и query(). Последнее не идет назад и не рвется (temp всегда от своего ts), ответ из окна -
+// подряд идущие измерения без обрывков от перезаписанных слотов, не старше уже виденного latest
+#define TEMP_SERVER_NO_MAIN
+#include "../src/temp_server.cpp"
+#include "test_util.h"
+
+static const time_t T0 = 1767225600;   // 2026-01-01T00:00:00Z
+static const uint64_t N = 2000000;
+
+static double temp_of(time_t tt){ return (double)(tt - T0) * 0.5 + 0.25; }
+
+int main(){
+  LiveBoard live;
+  live.enable_window(true);
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> hits{0}, latest_calls{0};
+
+  std::vector<std::thread> readers;
+  readers.emplace_back([&]{
+    time_t prev = 0;
+    int bad = 0;
+    while (!done.load(std::memory_order_relaxed)){
+      Sample s = live.latest();
+      latest_calls++;
+      if (!s.tt) continue;
+      if (s.tt < prev || s.temp != temp_of(s.tt)) bad++;
+      prev = s.tt;
+    }
+    CHECK_EQ(bad, 0);
+  });
+  for (int k=0;k<2;k++){
+    readers.emplace_back([&, k]{
+      std::pmr::unsynchronized_pool_resource arena;
+      uint32_t rnd = 12345 + k;
+      int bad = 0;
+      while (!done.load(std::memory_order_relaxed)){
+        Sample l = live.latest();
+        if (!l.tt) continue;
+        rnd = rnd * 1103515245u + 12345u;
+        time_t back = (time_t)((rnd >> 8) % (LiveBoard::RECENT + 512));
+        size_t max_points = (rnd & 3) ? 1000000 : 50;
+        Stats st;
+        SampleVec out(&arena);
+        if (!live.query(l.tt - back, l.tt + 1000000, st, out, max_points)) continue;
+        hits++;
+        if (out.empty() || out.front().tt != l.tt - back){ bad++; continue; }
+        size_t step = out.size() > 1 ? (size_t)(out[1].tt - out[0].tt) : 1;
+        if (max_points > LiveBoard::RECENT && (step != 1 || st.count != out.size())) bad++;
+        double sum = 0;
+        for (size_t i=0;i<out.size();i++){
+          if (out[i].tt != out[0].tt + (time_t)(i * step) || out[i].temp != temp_of(out[i].tt)) bad++;
+        }
+        time_t last = out[0].tt + (time_t)st.count - 1;
+        if (last < l.tt) bad++;
+        for (time_t t = out[0].tt; t <= last; t++) sum += temp_of(t);
+        if (st.sum != sum || st.minv != temp_of(out[0].tt) || st.maxv != temp_of(last)) bad++;
+      }
+      CHECK_EQ(bad, 0);
+    });
+  }
+
+  for (uint64_t i=0;i<N;i++){
+    time_t tt = T0 + (time_t)i;
+    live.publish(Sample{tt, temp_of(tt)});
+  }
+  // читатели должны успеть поймать окно хоть раз и после конца записи
+  for (int i=0;i<1000 && hits.load() < 10;i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  done = true;
+  for (auto& t : readers) t.join();
+
+  CHECK(hits.load() > 0);
+  CHECK(latest_calls.load() > 0);
+  Sample s = live.latest();
+  CHECK_EQ(s.tt, T0 + (time_t)N - 1);
+  std::printf("published %llu, window hits %llu\n", (unsigned long long)N, (unsigned long long)hits.load());
+  return test_result("test_live_board");
+}
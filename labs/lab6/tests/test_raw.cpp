@@ -0,0 +1,202 @@
+// /api/raw: тело RawBody из кусков CSV, TBIN и CSV --framed читается по chunk() с любой позиции
+// теми же байтами, что и целиком; http_raw_response разбирает Range и If-Range (один диапазон,
+// открытый, последние n байт, y < x, 416, несколько диапазонов - весь файл)
+#define TEMP_SERVER_NO_MAIN
+#include "../src/temp_server.cpp"
+#include "test_util.h"
+
+static const time_t T0 = 1767225600;   // 2026-01-01T00:00:00Z
+
+struct TbinMap {
+  MappedFile mf;
+  TbinReader rd;
+};
+
+// Тело с позиции from кусками не длиннее max (из файла - через pread)
+static std::string read_body(const RawBody& body, uint64_t from, size_t max){
+  std::string out, buf;
+  for (uint64_t pos = from; pos < body.size();){
+    RawBody::Chunk c = body.chunk(pos, max, buf);
+    if (!c.len){ CHECK(c.len > 0); break; }
+    if (c.fd >= 0){
+      std::string tmp(c.len, '\0');
+      CHECK_EQ(::pread(c.fd, &tmp[0], c.len, (off_t)c.off), (ssize_t)c.len);
+      out += tmp;
+    } else {
+      out.append(c.data, c.len);
+    }
+    pos += c.len;
+  }
+  return out;
+}
+
+static std::string line(time_t tt, double temp){
+  char l[64];
+  format_iso_utc(tt, l);
+  return std::string(l, 20 + (size_t)std::snprintf(l + 20, 44, ",%.3f\n", temp));
+}
+
+// Тело из трех кусков: CSV (строки [skip, ...) файла), TBIN (ts в [from, to]), CSV --framed
+static std::shared_ptr<RawBody> make_body(const std::filesystem::path& dir, size_t skip, int64_t from, int64_t to,
+                                          std::string& expect){
+  auto body = std::make_shared<RawBody>();
+  expect.clear();
+
+  std::string csv;
+  for (int i=0;i<3000;i++) csv += line(T0 + i, 20.0 + i % 100 / 8.0);
+  write_file(dir / "plain.csv", csv);
+  size_t off = 0;
+  for (size_t i=0;i<skip;i++) off = csv.find('\n', off) + 1;
+  CHECK(body->add_file(dir / "plain.csv", off, csv.size() - off));
+  expect += csv.substr(off);
+
+  TbinWriter w;
+  CHECK(w.open(dir / "seg.tbin"));
+  for (int i=0;i<10000;i++){
+    int64_t ts = T0 + 4000 + 2*i;
+    int32_t m = (i * 37) % 50000 - 20000;
+    w.add(ts, m);
+    if (ts >= from && ts <= to){
+      char l[64];
+      expect.append(l, tbin_csv_line(l, ts, m));
+    }
+  }
+  CHECK(w.finish());
+  auto tb = std::make_shared<TbinMap>();
+  CHECK(tb->mf.open(dir / "seg.tbin"));
+  CHECK(tb->rd.open(tb->mf.data(), tb->mf.size()));
+  CHECK(tb->rd.blocks() == 3);
+  body->add_tbin(tb, tb->rd, 0, tb->rd.blocks(), from, to);
+
+  // --framed: метки и запись с неверной суммой из тела пропадают, суффиксы отрезаются
+  std::string framed;
+  for (int i=0;i<5000;i++){
+    std::string l = line(T0 + 30000 + i, -5.0 + i % 40 / 4.0);
+    char f[80];
+    std::memcpy(f, l.data(), l.size() - 1);
+    std::string rec(f, csv_frame(f, l.size() - 1));
+    if (i == 1234) rec[22] ^= 1;
+    else expect += l;
+    framed += rec + "\n";
+    if (i % 1000 == 999) framed += "#ckpt," + std::to_string(framed.size()) + "*00000000\n";
+  }
+  write_file(dir / "framed.csv", framed);
+  auto mf = std::make_shared<MappedFile>();
+  CHECK(mf->open(dir / "framed.csv"));
+  body->add_framed(dir / "framed.csv", mf, 0, framed.size());
+  return body;
+}
+
+struct Reply {
+  std::string status, content_range, etag;
+  uint64_t from = 0, len = 0;
+  bool body = false;
+};
+
+static std::string header(const std::string& head, const char* name){
+  size_t at = head.find(std::string("\r\n") + name + ": ");
+  if (at == std::string::npos) return {};
+  at += std::strlen(name) + 4;
+  return head.substr(at, head.find("\r\n", at) - at);
+}
+
+static Reply get(std::shared_ptr<const RawBody> body, std::string_view range, std::string_view if_range = {}){
+  HttpReply r = http_raw_response(std::move(body), range, if_range);
+  std::string head(r.data(), r.size());
+  Reply out;
+  out.status = head.substr(9, 3);
+  out.content_range = header(head, "Content-Range");
+  out.etag = header(head, "ETag");
+  out.from = r.body_from;
+  out.len = r.body_len;
+  out.body = r.body != nullptr;
+  CHECK_EQ(header(head, "Content-Length"), std::to_string(r.body_len));
+  return out;
+}
+
+int main(){
+  TempDir dir("test_raw");
+  std::string expect;
+  auto body = make_body(dir.path, 100, T0 + 5001, T0 + 20001, expect);
+  const uint64_t total = expect.size();
+  CHECK_EQ(body->size(), total);
+
+  // целиком и с любой позиции - те же байты, при любом max
+  CHECK(read_body(*body, 0, 65536) == expect);
+  CHECK(read_body(*body, 0, 1000) == expect);
+  std::string buf;
+  for (uint64_t pos = 0; pos < total; pos += 997){
+    RawBody::Chunk c = body->chunk(pos, 4096, buf);
+    CHECK(c.len > 0 && pos + c.len <= total);
+    if (c.fd < 0) CHECK(std::string(c.data, c.len) == expect.substr(pos, c.len));
+  }
+  for (uint64_t pos : {total - 1, total - 37, (uint64_t)expect.find("2026-01-01T01:23:2"), (uint64_t)expect.find("2026-01-01T08:20:0")})
+    CHECK(read_body(*body, pos, 4096) == expect.substr(pos));
+
+  // отпечаток: то же содержимое - тот же ETag, другие границы - другой
+  std::string e2;
+  auto same = make_body(dir.path, 100, T0 + 5001, T0 + 20001, e2);
+  auto other = make_body(dir.path, 100, T0 + 5001, T0 + 20003, e2);
+  CHECK_EQ(same->tag(), body->tag());
+  CHECK(other->tag() != body->tag());
+
+  Reply r = get(body, "");
+  CHECK_EQ(r.status, std::string("200"));
+  CHECK(r.body && r.from == 0 && r.len == total);
+  CHECK_EQ(r.etag.size(), (size_t)18);
+  const std::string etag = r.etag;
+  const std::string tot = std::to_string(total);
+
+  r = get(body, "bytes=10-19");
+  CHECK_EQ(r.status, std::string("206"));
+  CHECK(r.from == 10 && r.len == 10);
+  CHECK_EQ(r.content_range, "bytes 10-19/" + tot);
+
+  r = get(body, "bytes=100-");                       // до конца
+  CHECK_EQ(r.status, std::string("206"));
+  CHECK(r.from == 100 && r.len == total - 100);
+
+  r = get(body, "bytes=0-" + std::to_string(total + 50));   // конец за файлом - до конца
+  CHECK_EQ(r.status, std::string("206"));
+  CHECK(r.from == 0 && r.len == total);
+
+  r = get(body, "bytes=-500");                       // последние 500 байт
+  CHECK_EQ(r.status, std::string("206"));
+  CHECK(r.from == total - 500 && r.len == 500);
+  CHECK_EQ(r.content_range, "bytes " + std::to_string(total - 500) + "-" + std::to_string(total - 1) + "/" + tot);
+
+  r = get(body, "bytes=-" + std::to_string(total * 2));   // больше файла - весь
+  CHECK_EQ(r.status, std::string("206"));
+  CHECK(r.from == 0 && r.len == total);
+
+  for (std::string bad : {std::string("bytes=-0"), "bytes=" + tot + "-", "bytes=" + tot + "-" + std::to_string(total + 9)}){
+    r = get(body, bad);
+    CHECK_EQ(r.status, std::string("416"));
+    CHECK_EQ(r.content_range, "bytes */" + tot);
+    CHECK(!r.body && r.len == 0);
+  }
+
+  // непонятный Range и несколько диапазонов - весь файл
+  for (const char* whole : {"bytes=20-10", "bytes=0-5,10-15", "bytes=abc", "bytes=1-2x", "bytes=-", "items=0-5", "bytes 0-5"}){
+    r = get(body, whole);
+    CHECK_EQ(r.status, std::string("200"));
+    CHECK(r.body && r.from == 0 && r.len == total);
+    CHECK(r.content_range.empty());
+  }
+
+  // If-Range: диапазон только при совпадении ETag
+  r = get(body, "bytes=10-19", etag);
+  CHECK_EQ(r.status, std::string("206"));
+  for (std::string ir : {std::string("\"0000000000000000\""), "W/" + etag, std::string("Thu, 01 Jan 2026 00:00:00 GMT")}){
+    r = get(body, "bytes=10-19", ir);
+    CHECK_EQ(r.status, std::string("200"));
+    CHECK(r.len == total);
+  }
+
+  // пустое тело: любой диапазон - 416
+  auto empty = std::make_shared<RawBody>();
+  CHECK_EQ(get(empty, "").status, std::string("200"));
+  CHECK_EQ(get(empty, "bytes=0-").status, std::string("416"));
+  CHECK_EQ(get(empty, "bytes=-5").status, std::string("416"));
+  return test_result("test_raw");
+}
@@ -0,0 +1,62 @@
+// recover_last_sample: последняя строка без '\n' остается, только если целиком совпадает с
+// форматом писателя (в режиме framed - еще и с верной суммой), иначе отрезается
+#define TEMP_SERVER_NO_MAIN
+#include "../src/temp_server.cpp"
+#include "test_util.h"
+
+static const std::string HEAD =
+  "2026-01-01T00:00:00Z,20.000\n"
+  "2026-01-01T00:00:01Z,21.500\n";
+static const time_t T1 = 1767225601;   // 2026-01-01T00:00:01Z
+
+// Файл HEAD + tail; true - хвост остался (с '\n'), false - отрезан до HEAD
+static bool kept(const std::filesystem::path& file, const std::string& tail, bool framed, Sample& s){
+  write_file(file, HEAD + tail);
+  s = Sample{};
+  CHECK(recover_last_sample(file, s, framed));
+  std::string data = read_file(file);
+  if (data == HEAD){
+    CHECK_EQ(s.tt, T1);
+    return false;
+  }
+  CHECK_EQ(data, HEAD + tail + "\n");
+  return true;
+}
+
+static std::string framed_line(const char* text){
+  char line[80];
+  size_t len = std::strlen(text);
+  std::memcpy(line, text, len);
+  return std::string(line, csv_frame(line, len));
+}
+
+int main(){
+  TempDir dir("test_recover");
+  std::filesystem::path file = dir.path / "measurements.csv";
+  Sample s{};
+
+  // обрывки записи "2026-01-01T00:00:02Z,23.456" разбираются, но не в формате писателя
+  for (const char* torn : {"2026-01-01T00:00:02Z,23", "2026-01-01T00:00:02Z,23.", "2026-01-01T00:00:02Z,23.45",
+                           "2026-01-01T00:00:02Z,", "2026-01-01T00:00:0", "2026-01-01T00:00:02Z,23.4567"})
+    CHECK(!kept(file, torn, false, s));
+
+  CHECK(kept(file, "2026-01-01T00:00:02Z,23.456", false, s));
+  CHECK_EQ(s.tt, T1 + 1);
+  CHECK_EQ(s.temp, 23.456);
+  CHECK(kept(file, "2026-01-01T00:00:02Z,-0.500", false, s));
+  CHECK_EQ(s.temp, -0.5);
+
+  // framed: нужна верная сумма
+  std::string fl = framed_line("2026-01-01T00:00:02Z,23.456");
+  CHECK(!kept(file, "2026-01-01T00:00:02Z,23.456", true, s));
+  CHECK(kept(file, fl, true, s));
+  CHECK_EQ(s.temp, 23.456);
+  CHECK(!kept(file, fl.substr(0, fl.size() - 1), true, s));
+  CHECK(kept(file, fl, false, s));   // framed-файл, сервер без --framed
+
+  // весь файл - одна оборванная строка
+  write_file(file, "2026-01-01T00:00:00Z,2");
+  CHECK(!recover_last_sample(file, s, false));
+  CHECK_EQ(read_file(file), std::string());
+  return test_result("test_recover");
+}
@@ -0,0 +1,54 @@
+// SeriesCache::tail: файл кончается недописанной строкой - ее не видно, пока размер тот же,
+// и видно, как только строку дописали; другой файл читается с начала
+#define TEMP_SERVER_NO_MAIN
+#include "../src/temp_server.cpp"
+#include "test_util.h"
+
+static const time_t T0 = 1767225600;   // 2026-01-01T00:00:00Z
+
+static size_t count(const SeriesCache& c, Sample* last = nullptr){
+  Stats st;
+  SampleVec out;
+  CHECK(c.query(T0 - 10, T0 + 100000, st, out, 1000000));
+  if (last && !out.empty()) *last = out.back();
+  return st.count;
+}
+
+int main(){
+  TempDir dir("test_series_cache");
+  std::filesystem::path file = dir.path / "measurements.csv";
+  write_file(file, "2026-01-01T00:00:00Z,20.000\n2026-01-01T00:00:01Z,21.500\n2026-01-01T00:00:02Z,2");
+
+  SeriesCache c;
+  c.configure(1 << 20);
+  c.load({file});
+  c.set_ready();
+  CHECK_EQ(count(c), (size_t)2);
+  for (int i=0;i<3;i++) c.tail(file);
+  CHECK_EQ(count(c), (size_t)2);
+
+  write_file(file, "2.500\n2026-01-01T00:00:03Z,-1", true);
+  c.tail(file);
+  c.tail(file);
+  Sample s{};
+  CHECK_EQ(count(c, &s), (size_t)3);
+  CHECK_EQ(s.tt, T0 + 2);
+  CHECK_EQ(s.temp, 22.5);
+
+  write_file(file, ".250\n", true);
+  c.tail(file);
+  CHECK_EQ(count(c, &s), (size_t)4);
+  CHECK_EQ(s.temp, -1.25);
+
+  // следующий сегмент: с начала, недописанная строка тоже ждет
+  std::filesystem::path next = dir.path / "measurements-2.csv";
+  write_file(next, "2026-01-01T00:00:04Z,5.000\n2026-01-01T00:00:05Z,6");
+  c.tail(next);
+  c.tail(next);
+  CHECK_EQ(count(c, &s), (size_t)5);
+  write_file(next, ".000\n", true);
+  c.tail(next);
+  CHECK_EQ(count(c, &s), (size_t)6);
+  CHECK_EQ(s.temp, 6.0);
+  return test_result("test_series_cache");
+}
@@ -0,0 +1,47 @@
+#pragma once
+// Общее для тестов lab6: проверки и временный каталог. Тест - отдельная программа,
+// код 0 - все проверки прошли (CTest)
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+static int g_failed = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)){ std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); g_failed++; } \
+  } while (0)
+
+#define CHECK_EQ(a, b) do { \
+    auto va_ = (a); auto vb_ = (b); \
+    if (!(va_ == vb_)){ std::fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed\n", __FILE__, __LINE__, #a, #b); g_failed++; } \
+  } while (0)
+
+// Пустой каталог под тест в temp_directory_path; удаляется в деструкторе
+struct TempDir {
+  std::filesystem::path path;
+  explicit TempDir(const std::string& name){
+    path = std::filesystem::temp_directory_path() /
+           (name + "-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    std::filesystem::remove_all(path);
+    std::filesystem::create_directories(path);
+  }
+  ~TempDir(){ std::error_code ec; std::filesystem::remove_all(path, ec); }
+};
+
+static std::string read_file(const std::filesystem::path& p){
+  std::ifstream f(p, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::filesystem::path& p, const std::string& data, bool append = false){
+  std::ofstream f(p, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+  f << data;
+}
+
+static int test_result(const char* name){
+  if (g_failed) std::fprintf(stderr, "%s: %d checks failed\n", name, g_failed);
+  else std::printf("%s: ok\n", name);
+  return g_failed ? 1 : 0;
+}